@@ -0,0 +1,691 @@
+// Генератор нагрузки: N соединений проходят вход по парам из файла паролей,
+// затем выполняют смесь команд; результат выводится в JSON для сравнения сборок
+// Сборка: gcc -O2 -pthread -Icommon -Ipassmaker bench/loadgen.c common/credentials.c common/passindex.c -o loadgen
+// Запуск: loadgen <порт> <файл паролей> [параметры]
+//   -c <n>          количество соединений (50)
+//   -j <n>          потоков генератора (1)
+//   -d <с>          длительность выполнения команд (10)
+//   -m echo:9,cat:1 веса команд: echo - интерактивная команда, cat - вывод большого файла
+//   -s <байт>       размер файла для cat (1 МБ)
+//   -t <мс>         пауза между командами одного соединения (0)
+//   -o <файл>       куда записать JSON (stdout)
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "pass_pair.h"
+#include "credentials.h"
+
+#define DEFAULT_CONNECTIONS 50
+#define DEFAULT_THREADS 1
+#define DEFAULT_DURATION 10
+#define DEFAULT_FILE_SIZE (1024 * 1024)
+#define LOGIN_TIMEOUT 30
+#define EVENT_BATCH 64
+#define READ_BUFFER_SIZE 65536
+#define MARKER_SIZE 32
+
+#define COMMAND_ECHO 0
+#define COMMAND_CAT 1
+#define COMMAND_TYPES 2
+
+// Шаги соединения
+#define STATE_LOGIN 0       // Ждём приглашения ввести логин
+#define STATE_PASSWORD 1    // Ждём приглашения ввести пароль
+#define STATE_AUTH 2        // Пароль отправлен, ждём подтверждения
+#define STATE_READY 3       // Вход выполнен, ждём начала выполнения команд
+#define STATE_COMMAND 4     // Команда отправлена, ждём метку конца её вывода
+#define STATE_THINK 5       // Пауза между командами
+#define STATE_DONE 6
+
+#define MATCH_MARKER 1
+#define MATCH_FAILURE 2
+
+static const char *commandNames[COMMAND_TYPES] = {"echo", "cat"};
+
+// Выборка задержек в наносекундах
+struct Samples {
+    long long *values;
+    size_t count;
+    size_t size;
+};
+
+struct Client {
+    int fd;
+    int state;
+    const struct PassPair *pair;
+    const char *marker;             // Строка, которой заканчивается текущий шаг
+    const char *failure;            // Строка, означающая отказ во входе
+    char commandMarker[MARKER_SIZE];
+    char tail[MARKER_SIZE];         // Конец прошлого куска: метка может прийти в двух чтениях
+    size_t tailLength;
+    long long connectStarted;
+    long long started;              // Начало текущего шага
+    long long wakeAt;
+    int command;
+    long long received;
+    unsigned int sequence;
+};
+
+struct Worker {
+    pthread_t thread;
+    int epollfd;
+    struct Client *clients;
+    int count;
+    int first;                      // Номер первого соединения потока, от него выбираются пары
+    unsigned int seed;
+    int authenticated;
+    int failed;
+    long long errors;               // Соединений, потерянных во время выполнения команд
+    long long loginTime;
+    struct Samples authLatency;
+    struct Samples loginLatency;
+    struct Samples latency[COMMAND_TYPES];
+    long long commands[COMMAND_TYPES];
+    long long bytes[COMMAND_TYPES];
+    long long segments;             // Сегментов TCP, принятых от сервера (TCP_INFO)
+    long long segmentBytes;         // Байт, принятых в этих сегментах
+};
+
+// Параметры запуска, общие для всех потоков
+struct sockaddr_in address;
+struct Credentials *credentials;
+int duration = DEFAULT_DURATION;
+int thinkTime = 0;
+int weights[COMMAND_TYPES] = {1, 0};
+int weightSum = 1;
+long fileSize = DEFAULT_FILE_SIZE;
+char filePath[] = "/tmp/loadgen-XXXXXX";
+pthread_barrier_t commandsBarrier;
+
+// Буфер чтения, один на поток
+static __thread char readBuffer[READ_BUFFER_SIZE];
+
+// Время в наносекундах
+long long getNanoseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+void addSample(struct Samples *samples, long long value) {
+    if (samples->count == samples->size) {
+        size_t size = samples->size == 0 ? 1024 : samples->size * 2;
+        long long *grown = (long long *)realloc(samples->values, size * sizeof(long long));
+        if (grown == NULL) {
+            return;
+        }
+        samples->values = grown;
+        samples->size = size;
+    }
+    samples->values[samples->count++] = value;
+}
+
+void mergeSamples(struct Samples *dest, const struct Samples *source) {
+    for (size_t i = 0; i < source->count; i++) {
+        addSample(dest, source->values[i]);
+    }
+}
+
+int compareSamples(const void *left, const void *right) {
+    long long a = *(const long long *)left;
+    long long b = *(const long long *)right;
+    return (a > b) - (a < b);
+}
+
+// Значение перцентиля q из отсортированной выборки, в микросекундах
+double getPercentile(const struct Samples *samples, double q) {
+    if (samples->count == 0) {
+        return 0;
+    }
+    size_t position = (size_t)(q * samples->count);
+    if (position >= samples->count) {
+        position = samples->count - 1;
+    }
+    return samples->values[position] / 1e3;
+}
+
+// Ищем метку шага и строку отказа в куске вместе с концом прошлого куска
+int matchStream(struct Client *client, const char *data, size_t length) {
+    char window[2 * MARKER_SIZE];
+    size_t head = length < MARKER_SIZE ? length : MARKER_SIZE;
+    memcpy(window, client->tail, client->tailLength);
+    memcpy(window + client->tailLength, data, head);
+    size_t windowLength = client->tailLength + head;
+
+    const char *patterns[2] = {client->marker, client->failure};
+    int matches[2] = {MATCH_MARKER, MATCH_FAILURE};
+    for (int i = 0; i < 2; i++) {
+        if (patterns[i] == NULL) {
+            continue;
+        }
+        size_t patternLength = strlen(patterns[i]);
+        if (memmem(window, windowLength, patterns[i], patternLength) != NULL
+                || memmem(data, length, patterns[i], patternLength) != NULL) {
+            client->tailLength = 0;
+            return matches[i];
+        }
+    }
+
+    // Сохраняем конец потока для следующего куска
+    const char *end = length >= MARKER_SIZE - 1 ? data + length : window + windowLength;
+    size_t available = length >= MARKER_SIZE - 1 ? length : windowLength;
+    client->tailLength = available < MARKER_SIZE - 1 ? available : MARKER_SIZE - 1;
+    memmove(client->tail, end - client->tailLength, client->tailLength);
+    return 0;
+}
+
+// Отправляем строку целиком: команды короткие и помещаются в буфер сокета
+int sendLine(struct Client *client, const char *line, size_t length) {
+    ssize_t written = send(client->fd, line, length, MSG_NOSIGNAL);
+    if (written != (ssize_t)length) {
+        if (written == -1) {
+            perror("sending to server");
+        }
+        return -1;
+    }
+    return 0;
+}
+
+// Выбираем команду по весам и отправляем её, в конце вывода команды - уникальная метка
+// Метку печатает оболочка: в эхе введённой строки стоит выражение, а не готовое число
+int startCommand(struct Worker *worker, struct Client *client) {
+    int choice = rand_r(&worker->seed) % weightSum;
+    int command = 0;
+    while (choice >= weights[command]) {
+        choice -= weights[command];
+        command++;
+    }
+    char line[256];
+    unsigned int sequence = client->sequence++;
+    int length;
+    if (command == COMMAND_CAT) {
+        length = snprintf(line, sizeof(line), "cat %s; echo R$((%u+1))Z\n", filePath, sequence);
+    } else {
+        length = snprintf(line, sizeof(line), "echo R$((%u+1))Z\n", sequence);
+    }
+    snprintf(client->commandMarker, sizeof(client->commandMarker), "R%uZ", sequence + 1);
+    client->marker = client->commandMarker;
+    client->failure = NULL;
+    client->tailLength = 0;
+    client->command = command;
+    client->received = 0;
+    client->state = STATE_COMMAND;
+    client->started = getNanoseconds();
+    return sendLine(client, line, (size_t)length);
+}
+
+// Учитываем, сколькими сегментами сервер передал данные соединения:
+// меньше сегментов на тот же объём - вывод собран в полные сегменты
+void countSegments(struct Worker *worker, int fd) {
+    struct tcp_info info;
+    socklen_t length = sizeof(info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &length) == 0) {
+        worker->segments += info.tcpi_segs_in;
+        worker->segmentBytes += (long long)info.tcpi_bytes_received;
+    }
+}
+
+// Закрываем соединение, разрыв до входа считается отказом, после - ошибкой
+void closeClient(struct Worker *worker, struct Client *client) {
+    if (client->state == STATE_DONE) {
+        return;
+    }
+    if (client->state < STATE_READY) {
+        worker->failed++;
+    } else {
+        worker->errors++;
+    }
+    countSegments(worker, client->fd);
+    close(client->fd);
+    client->fd = -1;
+    client->state = STATE_DONE;
+}
+
+// Переходим к следующему шагу, когда пришла метка текущего
+int advanceClient(struct Worker *worker, struct Client *client) {
+    long long now = getNanoseconds();
+    char line[MAX_LOGIN_LEN + 2];
+    int length;
+    switch (client->state) {
+        case STATE_LOGIN:
+            length = snprintf(line, sizeof(line), "%.*s\n", (int)strnlen(client->pair->login, MAX_LOGIN_LEN), client->pair->login);
+            client->state = STATE_PASSWORD;
+            client->marker = "Enter password: ";
+            client->failure = "try again";
+            return sendLine(client, line, (size_t)length);
+        case STATE_PASSWORD:
+            length = snprintf(line, sizeof(line), "%.*s\n", (int)strnlen(client->pair->pass, MAX_PASS_LEN), client->pair->pass);
+            client->state = STATE_AUTH;
+            client->marker = "Authentication complete!\n";
+            client->started = getNanoseconds();
+            return sendLine(client, line, (size_t)length);
+        case STATE_AUTH:
+            addSample(&worker->authLatency, now - client->started);
+            addSample(&worker->loginLatency, now - client->connectStarted);
+            worker->authenticated++;
+            client->state = STATE_READY;
+            client->marker = NULL;
+            client->failure = NULL;
+            return 0;
+        case STATE_COMMAND:
+            addSample(&worker->latency[client->command], now - client->started);
+            worker->commands[client->command]++;
+            worker->bytes[client->command] += client->received;
+            if (thinkTime > 0) {
+                client->state = STATE_THINK;
+                client->marker = NULL;
+                client->wakeAt = now + thinkTime * 1000000LL;
+                return 0;
+            }
+            return startCommand(worker, client);
+        default:
+            return 0;
+    }
+}
+
+// Читаем всё, что пришло от сервера
+void readClient(struct Worker *worker, struct Client *client) {
+    for (;;) {
+        ssize_t count = read(client->fd, readBuffer, READ_BUFFER_SIZE);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count == -1 && errno == EAGAIN) {
+            return;
+        }
+        if (count <= 0) {
+            closeClient(worker, client);
+            return;
+        }
+        client->received += count;
+        if (client->marker == NULL && client->failure == NULL) {
+            continue;
+        }
+        int match = matchStream(client, readBuffer, (size_t)count);
+        if (match == MATCH_FAILURE) {
+            fprintf(stderr, "Login failed: %.*s\n", (int)strnlen(client->pair->login, MAX_LOGIN_LEN), client->pair->login);
+            closeClient(worker, client);
+            return;
+        }
+        if (match == MATCH_MARKER && advanceClient(worker, client) == -1) {
+            closeClient(worker, client);
+            return;
+        }
+    }
+}
+
+// Обрабатываем события epoll, timeout в миллисекундах
+void pollClients(struct Worker *worker, int timeout) {
+    struct epoll_event events[EVENT_BATCH];
+    int count = epoll_wait(worker->epollfd, events, EVENT_BATCH, timeout);
+    if (count == -1 && errno != EINTR) {
+        perror("epoll_wait");
+    }
+    for (int i = 0; i < count; i++) {
+        struct Client *client = (struct Client *)events[i].data.ptr;
+        if (client->state == STATE_DONE) {
+            continue;
+        }
+        if (events[i].events & EPOLLIN) {
+            readClient(worker, client);
+        } else {
+            closeClient(worker, client);
+        }
+    }
+}
+
+// Открываем соединение, приглашение ввести логин сервер присылает сам
+int connectClient(struct Worker *worker, struct Client *client) {
+    client->connectStarted = getNanoseconds();
+    client->state = STATE_LOGIN;
+    client->marker = "Enter login: ";
+    client->failure = NULL;
+    client->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (client->fd == -1) {
+        perror("creating socket");
+        return -1;
+    }
+    int enable = 1;
+    setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    if (connect(client->fd, (struct sockaddr *)&address, sizeof(address)) == -1 && errno != EINPROGRESS) {
+        perror("connecting to server");
+        return -1;
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.ptr = client;
+    if (epoll_ctl(worker->epollfd, EPOLL_CTL_ADD, client->fd, &event) == -1) {
+        perror("adding client to epoll");
+        return -1;
+    }
+    return 0;
+}
+
+// Поток генератора: сначала все его соединения входят, затем все потоки
+// одновременно начинают выполнять команды
+void *runWorker(void *arg) {
+    struct Worker *worker = (struct Worker *)arg;
+    long long begin = getNanoseconds();
+    for (int i = 0; i < worker->count; i++) {
+        struct Client *client = &worker->clients[i];
+        client->pair = &credentials->index.pairs[(worker->first + i) % credentials->index.count];
+        if (connectClient(worker, client) == -1) {
+            if (client->fd != -1) {
+                close(client->fd);
+            }
+            client->state = STATE_DONE;
+            worker->failed++;
+        }
+    }
+    long long deadline = begin + LOGIN_TIMEOUT * 1000000000LL;
+    while (worker->authenticated + worker->failed < worker->count && getNanoseconds() < deadline) {
+        pollClients(worker, 100);
+    }
+    worker->loginTime = getNanoseconds() - begin;
+    for (int i = 0; i < worker->count; i++) {
+        if (worker->clients[i].state < STATE_READY) {
+            closeClient(worker, &worker->clients[i]);
+        }
+    }
+
+    pthread_barrier_wait(&commandsBarrier);
+    begin = getNanoseconds();
+    deadline = begin + duration * 1000000000LL;
+    for (int i = 0; i < worker->count; i++) {
+        struct Client *client = &worker->clients[i];
+        if (client->state == STATE_READY && startCommand(worker, client) == -1) {
+            closeClient(worker, client);
+        }
+    }
+    for (long long now = begin; now < deadline; now = getNanoseconds()) {
+        int timeout = (int)((deadline - now) / 1000000) + 1;
+        if (thinkTime > 0) {
+            timeout = 1;
+        } else if (timeout > 100) {
+            timeout = 100;
+        }
+        pollClients(worker, timeout);
+        if (thinkTime == 0) {
+            continue;
+        }
+        now = getNanoseconds();
+        for (int i = 0; i < worker->count; i++) {
+            struct Client *client = &worker->clients[i];
+            if (client->state == STATE_THINK && client->wakeAt <= now && startCommand(worker, client) == -1) {
+                closeClient(worker, client);
+            }
+        }
+    }
+
+    // Незавершённые команды не учитываются
+    for (int i = 0; i < worker->count; i++) {
+        if (worker->clients[i].fd != -1) {
+            countSegments(worker, worker->clients[i].fd);
+            close(worker->clients[i].fd);
+        }
+    }
+    return NULL;
+}
+
+// Разбираем смесь команд вида echo:9,cat:1
+int parseMix(char *mix) {
+    memset(weights, 0, sizeof(weights));
+    weightSum = 0;
+    char *save = NULL;
+    for (char *item = strtok_r(mix, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+        char *separator = strchr(item, ':');
+        int weight = separator == NULL ? 1 : atoi(separator + 1);
+        if (separator != NULL) {
+            *separator = '\0';
+        }
+        int command = -1;
+        for (int i = 0; i < COMMAND_TYPES; i++) {
+            if (strcmp(item, commandNames[i]) == 0) {
+                command = i;
+            }
+        }
+        if (command == -1 || weight < 0) {
+            fprintf(stderr, "Error: wrong command mix item %s\n", item);
+            return -1;
+        }
+        weights[command] = weight;
+        weightSum += weight;
+    }
+    return weightSum > 0 ? 0 : -1;
+}
+
+// Создаём файл для cat: строки из строчных букв, чтобы в нём не встретилась метка
+int createBulkFile() {
+    int fd = mkstemp(filePath);
+    if (fd == -1) {
+        perror("creating bulk file");
+        return -1;
+    }
+    char line[64];
+    for (int i = 0; i < (int)sizeof(line) - 1; i++) {
+        line[i] = (char)('a' + i % 26);
+    }
+    line[sizeof(line) - 1] = '\n';
+    for (long written = 0; written < fileSize; ) {
+        size_t chunk = fileSize - written < (long)sizeof(line) ? (size_t)(fileSize - written) : sizeof(line);
+        if (write(fd, line, chunk) != (ssize_t)chunk) {
+            perror("writing bulk file");
+            close(fd);
+            return -1;
+        }
+        written += (long)chunk;
+    }
+    close(fd);
+    return 0;
+}
+
+void printLatency(FILE *output, const char *indent, const char *name, struct Samples *samples, const char *suffix) {
+    qsort(samples->values, samples->count, sizeof(long long), compareSamples);
+    double sum = 0;
+    for (size_t i = 0; i < samples->count; i++) {
+        sum += samples->values[i];
+    }
+    fprintf(output, "%s\"%s\": {\"count\": %zu, \"mean\": %.1f, \"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}%s\n",
+            indent, name, samples->count, samples->count > 0 ? sum / samples->count / 1e3 : 0,
+            getPercentile(samples, 0.5), getPercentile(samples, 0.99), getPercentile(samples, 0.999),
+            getPercentile(samples, 1.0), suffix);
+}
+
+// Сводим результаты потоков и выводим JSON
+void printReport(FILE *output, struct Worker *workers, int threads, int connections) {
+    struct Samples authLatency = {0};
+    struct Samples loginLatency = {0};
+    struct Samples latency[COMMAND_TYPES];
+    memset(latency, 0, sizeof(latency));
+    long long commands[COMMAND_TYPES] = {0};
+    long long bytes[COMMAND_TYPES] = {0};
+    int authenticated = 0;
+    int failed = 0;
+    long long errors = 0;
+    long long loginTime = 0;
+    long long segments = 0;
+    long long segmentBytes = 0;
+    for (int i = 0; i < threads; i++) {
+        mergeSamples(&authLatency, &workers[i].authLatency);
+        mergeSamples(&loginLatency, &workers[i].loginLatency);
+        for (int j = 0; j < COMMAND_TYPES; j++) {
+            mergeSamples(&latency[j], &workers[i].latency[j]);
+            commands[j] += workers[i].commands[j];
+            bytes[j] += workers[i].bytes[j];
+        }
+        authenticated += workers[i].authenticated;
+        failed += workers[i].failed;
+        errors += workers[i].errors;
+        segments += workers[i].segments;
+        segmentBytes += workers[i].segmentBytes;
+        if (workers[i].loginTime > loginTime) {
+            loginTime = workers[i].loginTime;
+        }
+    }
+
+    fprintf(output, "{\n");
+    fprintf(output, "  \"config\": {\"port\": %d, \"connections\": %d, \"threads\": %d, \"duration\": %d, "
+            "\"think_ms\": %d, \"file_size\": %ld, \"mix\": {", ntohs(address.sin_port), connections, threads,
+            duration, thinkTime, fileSize);
+    for (int i = 0; i < COMMAND_TYPES; i++) {
+        fprintf(output, "%s\"%s\": %d", i > 0 ? ", " : "", commandNames[i], weights[i]);
+    }
+    fprintf(output, "}},\n");
+    fprintf(output, "  \"login\": {\n");
+    fprintf(output, "    \"authenticated\": %d,\n    \"failed\": %d,\n    \"seconds\": %.3f,\n"
+            "    \"connections_per_second\": %.1f,\n", authenticated, failed, loginTime / 1e9,
+            loginTime > 0 ? authenticated / (loginTime / 1e9) : 0);
+    printLatency(output, "    ", "auth_latency_us", &authLatency, ",");
+    printLatency(output, "    ", "login_latency_us", &loginLatency, "");
+    fprintf(output, "  },\n");
+    fprintf(output, "  \"errors\": %lld,\n", errors);
+    fprintf(output, "  \"tcp\": {\"segments_received\": %lld, \"bytes_received\": %lld, "
+            "\"bytes_per_segment\": %.1f},\n", segments, segmentBytes,
+            segments > 0 ? (double)segmentBytes / segments : 0);
+    fprintf(output, "  \"commands\": {\n");
+    for (int i = 0; i < COMMAND_TYPES; i++) {
+        fprintf(output, "    \"%s\": {\n", commandNames[i]);
+        fprintf(output, "      \"completed\": %lld,\n      \"per_second\": %.1f,\n      \"bytes\": %lld,\n"
+                "      \"megabytes_per_second\": %.2f,\n", commands[i], (double)commands[i] / duration, bytes[i],
+                bytes[i] / 1048576.0 / duration);
+        printLatency(output, "      ", "latency_us", &latency[i], "");
+        fprintf(output, "    }%s\n", i + 1 < COMMAND_TYPES ? "," : "");
+    }
+    fprintf(output, "  }\n}\n");
+
+    free(authLatency.values);
+    free(loginLatency.values);
+    for (int i = 0; i < COMMAND_TYPES; i++) {
+        free(latency[i].values);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <port> <passwords file> [-c connections] [-j threads] [-d seconds] "
+                "[-m echo:9,cat:1] [-s file size] [-t think ms] [-o output]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    int connections = DEFAULT_CONNECTIONS;
+    int threads = DEFAULT_THREADS;
+    char *outputPath = NULL;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-c") == 0) {
+            connections = atoi(argv[i+1]);
+        } else if (strcmp(argv[i], "-j") == 0) {
+            threads = atoi(argv[i+1]);
+        } else if (strcmp(argv[i], "-d") == 0) {
+            duration = atoi(argv[i+1]);
+        } else if (strcmp(argv[i], "-m") == 0) {
+            if (parseMix(argv[i+1]) == -1) {
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-s") == 0) {
+            fileSize = atol(argv[i+1]);
+        } else if (strcmp(argv[i], "-t") == 0) {
+            thinkTime = atoi(argv[i+1]);
+        } else if (strcmp(argv[i], "-o") == 0) {
+            outputPath = argv[i+1];
+        } else {
+            fprintf(stderr, "Error: unknown option %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (connections < 1 || threads < 1 || duration < 1 || fileSize < 0 || thinkTime < 0) {
+        fprintf(stderr, "Error: wrong parameters\n");
+        exit(EXIT_FAILURE);
+    }
+    if (threads > connections) {
+        threads = connections;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t)atoi(argv[1]));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    credentials = loadCredentials(argv[2]);
+    if (credentials == NULL || credentials->index.count == 0) {
+        fprintf(stderr, "Error: no login-password pairs in %s\n", argv[2]);
+        exit(EXIT_FAILURE);
+    }
+    // Каждому соединению нужен дескриптор
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if (weights[COMMAND_CAT] > 0 && createBulkFile() == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    struct Worker *workers = (struct Worker *)calloc((size_t)threads, sizeof(struct Worker));
+    struct Client *clients = (struct Client *)calloc((size_t)connections, sizeof(struct Client));
+    if (workers == NULL || clients == NULL) {
+        fprintf(stderr, "Error: allocating clients\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_barrier_init(&commandsBarrier, NULL, (unsigned int)threads);
+    int first = 0;
+    for (int i = 0; i < threads; i++) {
+        struct Worker *worker = &workers[i];
+        worker->first = first;
+        worker->count = connections / threads + (i < connections % threads);
+        worker->clients = clients + first;
+        worker->seed = (unsigned int)i + 1;
+        first += worker->count;
+        worker->epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (worker->epollfd == -1) {
+            perror("creating epoll");
+            exit(EXIT_FAILURE);
+        }
+        if (pthread_create(&worker->thread, NULL, runWorker, worker) != 0) {
+            fprintf(stderr, "Error: creating worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    FILE *output = outputPath == NULL ? stdout : fopen(outputPath, "w");
+    if (output == NULL) {
+        perror("opening output file");
+        output = stdout;
+    }
+    printReport(output, workers, threads, connections);
+    if (output != stdout) {
+        fclose(output);
+    }
+
+    if (weights[COMMAND_CAT] > 0) {
+        unlink(filePath);
+    }
+    for (int i = 0; i < threads; i++) {
+        close(workers[i].epollfd);
+        free(workers[i].authLatency.values);
+        free(workers[i].loginLatency.values);
+        for (int j = 0; j < COMMAND_TYPES; j++) {
+            free(workers[i].latency[j].values);
+        }
+    }
+    free(clients);
+    free(workers);
+    freeCredentials(credentials);
+    return 0;
+}
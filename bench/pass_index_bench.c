@@ -0,0 +1,97 @@
+// Микробенчмарк поиска пары логин-пароль:
+// хеш-индекс против прежнего линейного поиска
+// Сборка: gcc -O2 -Icommon -Ipassmaker bench/pass_index_bench.c common/passindex.c -o pass_index_bench
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pass_pair.h"
+#include "passindex.h"
+
+#define DEFAULT_PAIRS 300000
+#define DEFAULT_LOOKUPS 1000000
+#define LINEAR_LOOKUPS 200
+
+// Время в наносекундах
+long long getNanoseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Линейный поиск, как до появления индекса
+const struct PassPair *findLinear(const struct PassPair *pairs, uint32_t count, const char *login, size_t length) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (strnlen(pairs[i].login, MAX_LOGIN_LEN) == length && memcmp(pairs[i].login, login, length) == 0) {
+            return &pairs[i];
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t count = argc > 1 ? (uint32_t)atoi(argv[1]) : DEFAULT_PAIRS;
+    int lookups = argc > 2 ? atoi(argv[2]) : DEFAULT_LOOKUPS;
+    if (count < 1 || lookups < 1) {
+        fprintf(stderr, "Usage: %s [pairs] [lookups]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    struct PassPair *pairs = (struct PassPair *)calloc(count, sizeof(struct PassPair));
+    if (pairs == NULL) {
+        fprintf(stderr, "Error: allocating pairs\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        snprintf(pairs[i].login, MAX_LOGIN_LEN, "u%u", i);
+        snprintf(pairs[i].pass, MAX_PASS_LEN, "p%u", i);
+    }
+
+    long long begin = getNanoseconds();
+    struct PassIndex index;
+    if (buildPassIndex(&index, pairs, count) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    long long buildTime = getNanoseconds() - begin;
+
+    // Заранее готовим логины, чтобы форматирование не попало в замер
+    char (*logins)[MAX_LOGIN_LEN] = malloc((size_t)lookups * MAX_LOGIN_LEN);
+    size_t *lengths = malloc((size_t)lookups * sizeof(size_t));
+    srand(1);
+    for (int i = 0; i < lookups; i++) {
+        // Каждый десятый логин отсутствует в таблице
+        if (i % 10 == 0) {
+            snprintf(logins[i], MAX_LOGIN_LEN, "n%d", rand() % 1000000);
+        } else {
+            snprintf(logins[i], MAX_LOGIN_LEN, "u%u", (uint32_t)rand() % count);
+        }
+        lengths[i] = strlen(logins[i]);
+    }
+
+    int found = 0;
+    begin = getNanoseconds();
+    for (int i = 0; i < lookups; i++) {
+        found += findPassPair(&index, logins[i], lengths[i]) != NULL;
+    }
+    long long indexTime = getNanoseconds() - begin;
+
+    int linearLookups = lookups < LINEAR_LOOKUPS ? lookups : LINEAR_LOOKUPS;
+    int linearFound = 0;
+    begin = getNanoseconds();
+    for (int i = 0; i < linearLookups; i++) {
+        linearFound += findLinear(pairs, count, logins[i], lengths[i]) != NULL;
+    }
+    long long linearTime = getNanoseconds() - begin;
+
+    printf("pairs: %u\n", count);
+    printf("index build: %.2f ms\n", buildTime / 1e6);
+    printf("index lookup: %.1f ns/op (%d lookups, %d found)\n", (double)indexTime / lookups, lookups, found);
+    printf("linear lookup: %.1f ns/op (%d lookups, %d found)\n", (double)linearTime / linearLookups, linearLookups, linearFound);
+
+    free(logins);
+    free(lengths);
+    destroyPassIndex(&index);
+    free(pairs);
+    return 0;
+}
@@ -0,0 +1,327 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+
+#include "audit.h"
+#include "compress.h"
+#include "outbuf.h"
+
+// Журнал включён, записи принимаются
+int auditEnabled = 0;
+
+static int auditfd = -1;
+static size_t bufferSize = 0;
+static struct Compressor compressor;
+static struct OutputBuffer compressed;   // Сжатая пачка до записи в файл
+
+// Кольца всех потоков, список только растёт
+static _Atomic(struct AuditBuffer *) buffers = NULL;
+static __thread struct AuditBuffer *threadBuffer = NULL;
+
+static atomic_ulong sessions = 0;
+static int wakefd = -1;
+static atomic_int writerSignaled = 0;
+static atomic_int stopping = 0;
+static pthread_t writer;
+
+// Статистика писателя, её читает только он сам и stopAudit после его завершения
+static unsigned long batches = 0;
+static unsigned long bytesIn = 0;
+static unsigned long bytesOut = 0;
+static unsigned long writeErrors = 0;
+
+// Кольцо вызывающего потока, создаётся при первой записи
+static struct AuditBuffer *getThreadBuffer(void) {
+    if (threadBuffer != NULL) {
+        return threadBuffer;
+    }
+    struct AuditBuffer *buffer = (struct AuditBuffer *)calloc(1, sizeof(struct AuditBuffer));
+    if (buffer == NULL || (buffer->data = (char *)malloc(bufferSize)) == NULL) {
+        free(buffer);
+        return NULL;
+    }
+    buffer->size = bufferSize;
+    atomic_init(&buffer->head, 0);
+    atomic_init(&buffer->tail, 0);
+    atomic_init(&buffer->writing, 0);
+    buffer->next = atomic_load(&buffers);
+    while (!atomic_compare_exchange_weak(&buffers, &buffer->next, buffer)) {
+    }
+    threadBuffer = buffer;
+    return buffer;
+}
+
+// Копируем в кольцо с позиции position, кусок может перейти через конец
+static void copyToRing(struct AuditBuffer *buffer, size_t position, const char *data, size_t length) {
+    size_t offset = position % buffer->size;
+    size_t first = buffer->size - offset < length ? buffer->size - offset : length;
+    memcpy(buffer->data + offset, data, first);
+    memcpy(buffer->data, data + first, length - first);
+}
+
+// Добавляем запись в кольцо потока, без блокировок и системных вызовов
+// Если кольцо заполнено, запись отбрасывается и учитывается: передача данных сессии не ждёт диск
+static void appendAuditRecord(struct AuditBuffer *buffer, const struct AuditTag *tag, const char *data, size_t length) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    char header[AUDIT_HEADER_SIZE];
+    int headerLength = snprintf(header, sizeof(header), "%c %ld.%06ld %lu %d %zu\n", tag->kind, (long)now.tv_sec,
+                                now.tv_nsec / 1000, tag->session, tag->stream, length);
+    size_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&buffer->tail, memory_order_acquire);
+    size_t used = head - tail;
+    if (used + headerLength + length > buffer->size) {
+        atomic_store_explicit(&buffer->droppedRecords,
+                              atomic_load_explicit(&buffer->droppedRecords, memory_order_relaxed) + 1, memory_order_relaxed);
+        atomic_store_explicit(&buffer->droppedBytes,
+                              atomic_load_explicit(&buffer->droppedBytes, memory_order_relaxed) + length, memory_order_relaxed);
+        return;
+    }
+    copyToRing(buffer, head, header, (size_t)headerLength);
+    copyToRing(buffer, head + headerLength, data, length);
+    atomic_store_explicit(&buffer->records, atomic_load_explicit(&buffer->records, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    atomic_store_explicit(&buffer->head, head + headerLength + length, memory_order_release);
+    // Кольцо заполнено наполовину: будим писателя, не дожидаясь его таймера
+    used += headerLength + length;
+    if (used > buffer->size / 2 && atomic_exchange(&writerSignaled, 1) == 0) {
+        uint64_t value = 1;
+        if (write(wakefd, &value, sizeof(value)) == -1) {
+            perror("waking audit writer");
+        }
+    }
+}
+
+// Записи после начала остановки журнала отбрасываются
+void writeAuditRecord(const struct AuditTag *tag, const char *data, size_t length) {
+    if (atomic_load_explicit(&stopping, memory_order_relaxed)) {
+        return;
+    }
+    struct AuditBuffer *buffer = getThreadBuffer();
+    if (buffer == NULL) {
+        return;
+    }
+    // Отмечаемся до повторной проверки: либо остановка увидит отметку и дождётся записи,
+    // либо мы увидим остановку и не тронем закрываемый wakefd
+    atomic_store(&buffer->writing, 1);
+    if (atomic_load(&stopping)) {
+        atomic_store_explicit(&buffer->writing, 0, memory_order_release);
+        return;
+    }
+    appendAuditRecord(buffer, tag, data, length);
+    atomic_store_explicit(&buffer->writing, 0, memory_order_release);
+}
+
+// Пишем в файл целиком, файл открыт с O_APPEND и блокирующийся
+static void writeBatch(struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(auditfd, iov, count);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("writing audit log");
+            writeErrors++;
+            return;
+        }
+        bytesOut += written;
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+// Забираем всё накопленное в кольцах и записываем одной пачкой
+// Места в кольцах освобождаем после записи: пока пачка пишется, потоки продолжают заполнять свободное
+static int drainBuffers(void) {
+    struct iovec iov[AUDIT_MAX_IOV];
+    struct AuditBuffer *taken[AUDIT_MAX_IOV / 2];
+    size_t heads[AUDIT_MAX_IOV / 2];
+    int iovCount = 0;
+    int takenCount = 0;
+    size_t total = 0;
+    for (struct AuditBuffer *buffer = atomic_load(&buffers);
+            buffer != NULL && takenCount < AUDIT_MAX_IOV / 2; buffer = buffer->next) {
+        size_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+        if (head == tail) {
+            continue;
+        }
+        size_t offset = tail % buffer->size;
+        size_t length = head - tail;
+        size_t first = buffer->size - offset < length ? buffer->size - offset : length;
+        iov[iovCount].iov_base = buffer->data + offset;
+        iov[iovCount++].iov_len = first;
+        if (first < length) {
+            iov[iovCount].iov_base = buffer->data;
+            iov[iovCount++].iov_len = length - first;
+        }
+        taken[takenCount] = buffer;
+        heads[takenCount++] = head;
+        total += length;
+    }
+    if (total == 0) {
+        return 0;
+    }
+    batches++;
+    bytesIn += total;
+    if (compressor.algorithm == COMPRESS_NONE) {
+        writeBatch(iov, iovCount);
+    } else {
+        // Каждая пачка сбрасывается: журнал читается целиком до последней записанной пачки
+        for (int i = 0; i < iovCount; i++) {
+            if (compressData(&compressor, iov[i].iov_base, iov[i].iov_len, 0, &compressed) == -1) {
+                writeErrors++;
+            }
+        }
+        if (compressData(&compressor, NULL, 0, 1, &compressed) == -1) {
+            writeErrors++;
+        }
+        size_t length = compressed.length;
+        if (flushOutput(&compressed, auditfd) != 0) {
+            writeErrors++;
+            destroyOutputBuffer(&compressed);
+        } else {
+            bytesOut += length;
+        }
+    }
+    for (int i = 0; i < takenCount; i++) {
+        atomic_store_explicit(&taken[i]->tail, heads[i], memory_order_release);
+    }
+    return 1;
+}
+
+// Поток писателя: просыпается по таймеру или когда чьё-то кольцо заполнено наполовину
+static void *writeAudit(void *args) {
+    // Буфер сжатых данных принадлежит потоку, поэтому сжатие запускает сам писатель
+    if (compressor.algorithm != COMPRESS_NONE && startCompressor(&compressor) == -1) {
+        fprintf(stderr, "Error: audit log compression isn't available, writing it uncompressed\n");
+        destroyCompressor(&compressor);
+    }
+    struct pollfd wake = {wakefd, POLLIN, 0};
+    while (!atomic_load(&stopping)) {
+        if (poll(&wake, 1, AUDIT_FLUSH_MS) > 0) {
+            uint64_t value;
+            if (read(wakefd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+                perror("reading audit eventfd");
+            }
+        }
+        atomic_store(&writerSignaled, 0);
+        while (!atomic_load(&stopping) && drainBuffers()) {
+        }
+    }
+    // Потоки сервера ещё работают: дописываем то, что есть сейчас, и не ждём новых записей
+    drainBuffers();
+    return NULL;
+}
+
+// Открываем журнал и запускаем писателя
+// algorithm - сжатие журнала, bufferSize - размер кольца каждого потока в КБ
+int startAudit(const char *path, int algorithm, size_t size) {
+    bufferSize = size * 1024;
+    auditfd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (auditfd == -1) {
+        perror("opening audit log");
+        return -1;
+    }
+    initCompressor(&compressor);
+    initOutputBuffer(&compressed);
+    compressor.algorithm = algorithm;
+    wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakefd == -1) {
+        perror("creating audit eventfd");
+        close(auditfd);
+        return -1;
+    }
+    // Сигналы сервера писателю не нужны
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &previous);
+    int status = pthread_create(&writer, NULL, writeAudit, NULL);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (status != 0) {
+        fprintf(stderr, "Error: starting audit writer\n");
+        close(wakefd);
+        close(auditfd);
+        return -1;
+    }
+    auditEnabled = 1;
+    return 0;
+}
+
+void initAuditTag(struct AuditTag *tag) {
+    tag->session = 0;
+    tag->kind = AUDIT_OUTPUT;
+    tag->stream = 0;
+}
+
+// Начинаем запись сессии, 0 если журнал выключен
+unsigned long openAuditSession(const char *login, size_t length) {
+    if (!auditEnabled) {
+        return 0;
+    }
+    struct AuditTag tag = {atomic_fetch_add(&sessions, 1) + 1, AUDIT_LOGIN, 0};
+    writeAuditRecord(&tag, login, length);
+    return tag.session;
+}
+
+void closeAuditSession(unsigned long session) {
+    if (session == 0) {
+        return;
+    }
+    struct AuditTag tag = {session, AUDIT_CLOSE, 0};
+    writeAuditRecord(&tag, "", 0);
+}
+
+// Дописываем накопленное и выводим статистику журнала
+// Кольца не освобождаем: потоки сервера ещё могут проверять в них остановку
+void stopAudit(void) {
+    if (!auditEnabled) {
+        return;
+    }
+    atomic_store(&stopping, 1);
+    // Дожидаемся записей, начатых до остановки: они ещё могут будить писателя через wakefd,
+    // а последний проход писателя их допишет
+    for (struct AuditBuffer *buffer = atomic_load(&buffers); buffer != NULL; buffer = buffer->next) {
+        while (atomic_load_explicit(&buffer->writing, memory_order_acquire)) {
+            sched_yield();
+        }
+    }
+    uint64_t value = 1;
+    if (write(wakefd, &value, sizeof(value)) == -1) {
+        perror("waking audit writer");
+    }
+    pthread_join(writer, NULL);
+    unsigned long records = 0, droppedRecords = 0, droppedBytes = 0;
+    for (struct AuditBuffer *buffer = atomic_load(&buffers); buffer != NULL; buffer = buffer->next) {
+        records += atomic_load(&buffer->records);
+        droppedRecords += atomic_load(&buffer->droppedRecords);
+        droppedBytes += atomic_load(&buffer->droppedBytes);
+    }
+    fprintf(stderr, "Audit: %lu records, %lu bytes in %lu writes, %lu bytes on disk (%s), "
+                    "dropped %lu records (%lu bytes), write errors %lu\n",
+            records, bytesIn, batches, bytesOut, getCompressionName(compressor.algorithm),
+            droppedRecords, droppedBytes, writeErrors);
+    destroyCompressor(&compressor);
+    close(wakefd);
+    close(auditfd);
+    auditEnabled = 0;
+}
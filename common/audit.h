@@ -0,0 +1,54 @@
+#ifndef AUDIT_H
+    #include <stddef.h>
+    #include <stdatomic.h>
+
+    #define AUDIT_BUFFER_SIZE 1024          // Кольцо записей потока по умолчанию, КБ
+    #define AUDIT_FLUSH_MS 100              // Записи уходят в файл не позже чем через столько
+    #define AUDIT_HEADER_SIZE 64
+    #define AUDIT_MAX_IOV 256               // Кусков в одном writev
+
+    // Записи журнала: "<тип> <секунды>.<микросекунды> <сессия> <поток> <длина>\n<данные>"
+    // Поток - номер канала в режиме каналов, иначе 0
+    #define AUDIT_LOGIN 'L'                 // Начало сессии, данные - логин
+    #define AUDIT_INPUT 'I'                 // Ввод клиента
+    #define AUDIT_OUTPUT 'O'                // Вывод оболочки или команды
+    #define AUDIT_CLOSE 'C'
+
+    // Что и куда записывать для одного направления данных, session 0 - не записывать
+    struct AuditTag {
+        unsigned long session;
+        char kind;
+        int stream;
+    };
+
+    // Кольцо записей одного потока: пишет только этот поток, читает только писатель журнала
+    // Позиции растут без переполнения, заполнено head - tail байт
+    struct AuditBuffer {
+        char *data;
+        size_t size;
+        atomic_size_t head;
+        atomic_size_t tail;
+        atomic_ulong records;
+        atomic_ulong droppedRecords;    // Не поместились: писатель не успевает за потоком
+        atomic_ulong droppedBytes;
+        atomic_int writing;             // Поток добавляет запись, остановка журнала ждёт её конца
+        struct AuditBuffer *next;
+    };
+
+    extern int auditEnabled;
+
+    int startAudit(const char *path, int algorithm, size_t bufferSize);
+    void initAuditTag(struct AuditTag *tag);
+    unsigned long openAuditSession(const char *login, size_t length);
+    void closeAuditSession(unsigned long session);
+    void writeAuditRecord(const struct AuditTag *tag, const char *data, size_t length);
+    void stopAudit(void);
+
+    // Записываем данные сессии, без журнала - только проверка
+    static inline void auditData(const struct AuditTag *tag, const char *data, size_t length) {
+        if (tag != NULL && tag->session != 0 && length > 0) {
+            writeAuditRecord(tag, data, length);
+        }
+    }
+    #define AUDIT_H
+#endif
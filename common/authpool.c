@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "authpool.h"
+
+#define AUTH_STOP_FD -1     // Запрос с таким дескриптором завершает поток пула
+
+// Поток проверки: забираем запрос, проверяем пароль и отдаём результат владельцу
+static void *authWorker(void *args) {
+    struct AuthPool *pool = args;
+    struct AuthRequest request;
+    for (;;) {
+        if (popQueue(&pool->requests, &request) == -1) {
+            waitQueue(&pool->requests);
+            continue;
+        }
+        // Завершаемся по запросу в очереди, а не по флагу: пробуждение без запроса теряется,
+        // если придёт между проверкой флага и засыпанием
+        if (request.fd == AUTH_STOP_FD) {
+            break;
+        }
+        request.result = pool->verify(&request);
+        // Пароль больше не нужен
+        memset(request.password, 0, sizeof(request.password));
+        pool->complete(&request);
+    }
+    return NULL;
+}
+
+// Создаём пул потоков проверки паролей
+int initAuthPool(struct AuthPool *pool, int threadsCount, int (*verify)(struct AuthRequest *),
+                 void (*complete)(struct AuthRequest *)) {
+    pool->verify = verify;
+    pool->complete = complete;
+    pool->threadsCount = threadsCount;
+    if (initQueueCapacity(&pool->requests, sizeof(struct AuthRequest), AUTH_QUEUE_CAPACITY) == -1) {
+        return -1;
+    }
+    pool->threads = (pthread_t *)malloc(threadsCount * sizeof(pthread_t));
+    if (pool->threads == NULL) {
+        fprintf(stderr, "Error: allocating auth pool threads\n");
+        destroyQueue(&pool->requests);
+        return -1;
+    }
+    for (int i = 0; i < threadsCount; i++) {
+        if (pthread_create(&pool->threads[i], NULL, authWorker, pool) != 0) {
+            fprintf(stderr, "Error: creating auth pool thread\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Отправляем запрос на проверку, -1 если очередь пула заполнена
+int submitAuth(struct AuthPool *pool, struct AuthRequest *request) {
+    return pushQueue(&pool->requests, request);
+}
+
+// Останавливаем пул: запросы из очереди проверяются до конца, потоки дожидаемся
+// Новых запросов к этому моменту быть не должно
+void destroyAuthPool(struct AuthPool *pool) {
+    struct AuthRequest stop;
+    memset(&stop, 0, sizeof(stop));
+    stop.fd = AUTH_STOP_FD;
+    for (int i = 0; i < pool->threadsCount; i++) {
+        while (pushQueue(&pool->requests, &stop) == -1) {
+            sched_yield();
+        }
+    }
+    for (int i = 0; i < pool->threadsCount; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    destroyQueue(&pool->requests);
+}
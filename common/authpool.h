@@ -0,0 +1,36 @@
+#ifndef AUTHPOOL_H
+    #include <stddef.h>
+    #include <pthread.h>
+
+    #include "pass_pair.h"
+    #include "queue.h"
+
+    #define AUTH_QUEUE_CAPACITY 1024
+
+    // Запрос на проверку пароля, результат возвращается владельцу соединения
+    struct AuthRequest {
+        int fd;
+        unsigned int generation;
+        void *owner;
+        char login[MAX_LOGIN_LEN];
+        size_t loginLength;
+        char password[MAX_PASS_LEN];
+        size_t passwordLength;      // Больше MAX_PASS_LEN - пароль заведомо неверный
+        int result;                 // 0 - пароль верный, -1 - неверный
+    };
+
+    // Пул потоков проверки паролей с ограниченной очередью
+    struct AuthPool {
+        struct Queue requests;
+        pthread_t *threads;
+        int threadsCount;
+        int (*verify)(struct AuthRequest *);
+        void (*complete)(struct AuthRequest *);
+    };
+
+    int initAuthPool(struct AuthPool *pool, int threadsCount, int (*verify)(struct AuthRequest *),
+                     void (*complete)(struct AuthRequest *));
+    int submitAuth(struct AuthPool *pool, struct AuthRequest *request);
+    void destroyAuthPool(struct AuthPool *pool);
+    #define AUTHPOOL_H
+#endif
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "channel.h"
+
+#define CHANNEL_TABLE_MIN_SIZE 16
+
+// Каналов нет, память выделяется при открытии первого
+void initChannelTable(struct ChannelTable *table) {
+    table->items = NULL;
+    table->size = 0;
+    table->count = 0;
+}
+
+// Открываем канал с номером id, NULL если номер занят или вне диапазона
+struct Channel *openChannel(struct ChannelTable *table, int id) {
+    if (id < 0 || id >= MAX_CHANNELS || getChannel(table, id) != NULL) {
+        return NULL;
+    }
+    if (id >= table->size) {
+        int size = table->size > 0 ? table->size : CHANNEL_TABLE_MIN_SIZE;
+        while (size <= id) {
+            size *= 2;
+        }
+        if (size > MAX_CHANNELS) {
+            size = MAX_CHANNELS;
+        }
+        struct Channel **items = (struct Channel **)realloc(table->items, size * sizeof(struct Channel *));
+        if (items == NULL) {
+            fprintf(stderr, "Error: allocating channel table\n");
+            return NULL;
+        }
+        memset(items + table->size, 0, (size - table->size) * sizeof(struct Channel *));
+        table->items = items;
+        table->size = size;
+    }
+    struct Channel *channel = (struct Channel *)calloc(1, sizeof(struct Channel));
+    if (channel == NULL) {
+        fprintf(stderr, "Error: allocating channel\n");
+        return NULL;
+    }
+    channel->id = id;
+    initExecSession(&channel->exec);
+    initShell(&channel->process);
+    initOutputBuffer(&channel->input);
+    channel->sendWindow = CHANNEL_WINDOW;
+    channel->receiveWindow = CHANNEL_WINDOW;
+    table->items[id] = channel;
+    table->count++;
+    return channel;
+}
+
+// Канал с номером id, NULL если он не открыт
+struct Channel *getChannel(struct ChannelTable *table, int id) {
+    if (id < 0 || id >= table->size) {
+        return NULL;
+    }
+    return table->items[id];
+}
+
+// Освобождаем номер канала, дескрипторы канала уже закрыты
+void releaseChannel(struct ChannelTable *table, struct Channel *channel) {
+    table->items[channel->id] = NULL;
+    table->count--;
+    destroyOutputBuffer(&channel->input);
+    free(channel);
+}
+
+// Дескриптор принадлежит каналу id: каналы, ptm или pidfd его процесса
+int channelOwnsFd(struct ChannelTable *table, int id, int fd) {
+    struct Channel *channel = getChannel(table, id);
+    if (channel == NULL) {
+        return 0;
+    }
+    struct ExecSession *exec = &channel->exec;
+    return exec->out == fd || exec->err == fd || exec->pidfd == fd || exec->in == fd;
+}
+
+// Освобождаем таблицу, каналы уже закрыты
+void destroyChannelTable(struct ChannelTable *table) {
+    free(table->items);
+    initChannelTable(table);
+}
+
+// Выделяем следующий кадр клиента
+// Возвращаем 1 если кадр пришёл целиком, 0 если ещё нет, -1 если заголовок неверный
+// Заголовок и данные кадра всегда помещаются в буфер ввода
+int nextFrame(struct InputBuffer *input, struct Frame *frame) {
+    if (input->length == 0) {
+        return 0;
+    }
+    char *begin = input->data + input->start;
+    char *end = memchr(begin, '\n', input->length < CHANNEL_HEADER_SIZE ? input->length : CHANNEL_HEADER_SIZE);
+    if (end == NULL) {
+        return input->length < CHANNEL_HEADER_SIZE ? 0 : -1;
+    }
+    char header[CHANNEL_HEADER_SIZE];
+    size_t headerLength = end - begin;
+    memcpy(header, begin, headerLength);
+    header[headerLength] = '\0';
+    int parsed = 0;
+    if (sscanf(header, "%c %d %ld%n", &frame->type, &frame->channel, &frame->value, &parsed) != 3
+            || parsed != headerLength || frame->value < 0) {
+        return -1;
+    }
+    frame->data = end + 1;
+    frame->length = 0;
+    if (frame->type == CHANNEL_OPEN_COMMAND || frame->type == CHANNEL_DATA) {
+        if (frame->value > CHANNEL_MAX_PACKET) {
+            return -1;
+        }
+        frame->length = (size_t)frame->value;
+    }
+    size_t consumed = headerLength + 1 + frame->length;
+    if (consumed > input->length) {
+        return 0;
+    }
+    input->start += consumed;
+    input->length -= consumed;
+    return 1;
+}
+
+// Заголовок кадра канала: тип, номер канала и длина данных, окно или код завершения
+int formatChannelHeader(char *header, char type, int id, long value) {
+    return snprintf(header, CHANNEL_HEADER_SIZE, "%c %d %ld\n", type, id, value);
+}
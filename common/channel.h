@@ -0,0 +1,68 @@
+#ifndef CHANNEL_H
+    #include <stddef.h>
+
+    #include "inbuf.h"
+    #include "outbuf.h"
+    #include "command.h"
+    #include "zygote.h"
+
+    #define MUX_PREFIX "mux "               // Логин с этим префиксом выбирает режим каналов
+    #define MAX_CHANNELS 1024
+    #define CHANNEL_WINDOW (256 * 1024)     // Начальное окно канала в каждую сторону
+    #define CHANNEL_MAX_WINDOW (1L << 30)
+    #define CHANNEL_MAX_PACKET 2048         // Наибольшие данные кадра клиента
+    #define CHANNEL_HEADER_SIZE 48
+    #define CHANNEL_EXIT_UNKNOWN -1         // Код завершения оболочки сервер не получает
+
+    // Кадры клиента "<тип> <канал> <число>\n", у C и D число - длина данных за заголовком
+    #define CHANNEL_OPEN_COMMAND 'C'        // Запустить команду из данных кадра
+    #define CHANNEL_OPEN_SHELL 'S'          // Запустить оболочку на псевдотерминале
+    #define CHANNEL_DATA 'D'                // Ввод команды или оболочки
+    #define CHANNEL_EOF 'F'                 // Ввода команды больше не будет
+    #define CHANNEL_WINDOW_ADJUST 'W'       // Получатель готов принять ещё столько байт
+    #define CHANNEL_CLOSE 'K'               // Завершить канал
+    // Кадры сервера: вывод EXEC_FRAME_STDOUT и EXEC_FRAME_STDERR "<тип> <канал> <длина>\n<данные>",
+    // окно CHANNEL_WINDOW_ADJUST для ввода и последний кадр канала EXEC_FRAME_EXIT "X <канал> <код>\n"
+
+    // Разобранный кадр клиента, данные указывают внутрь буфера ввода
+    struct Frame {
+        char type;
+        int channel;
+        long value;
+        const char *data;
+        size_t length;
+    };
+
+    // Команда или оболочка, запущенная в канале соединения
+    struct Channel {
+        int id;
+        int shell;                  // Оболочка на псевдотерминале: exec.in и exec.out - один ptm
+        struct ExecSession exec;
+        struct Shell process;       // Процесс оболочки канала
+        struct OutputBuffer input;  // Ввод клиента, ещё не записанный в exec.in
+        int inputClosed;            // Клиент прислал CHANNEL_EOF, exec.in закрывается после записи буфера
+        long sendWindow;            // Сколько байт вывода клиент ещё готов принять
+        long receiveWindow;         // Сколько байт ввода клиент ещё может прислать
+        long consumed;              // Записано в exec.in, но ещё не возвращено клиенту кадром окна
+    };
+
+    // Каналы соединения, номер канала выбирает клиент
+    struct ChannelTable {
+        int requested;              // Клиент выбрал режим каналов при входе
+        int active;                 // Вход выполнен, соединение принимает кадры
+        int inputClosed;            // Клиент больше не пришлёт кадров
+        struct Channel **items;     // Канал с номером id лежит в items[id], NULL если номер свободен
+        int size;
+        int count;                  // Открытых каналов
+    };
+
+    void initChannelTable(struct ChannelTable *table);
+    struct Channel *openChannel(struct ChannelTable *table, int id);
+    struct Channel *getChannel(struct ChannelTable *table, int id);
+    void releaseChannel(struct ChannelTable *table, struct Channel *channel);
+    int channelOwnsFd(struct ChannelTable *table, int id, int fd);
+    void destroyChannelTable(struct ChannelTable *table);
+    int nextFrame(struct InputBuffer *input, struct Frame *frame);
+    int formatChannelHeader(char *header, char type, int id, long value);
+    #define CHANNEL_H
+#endif
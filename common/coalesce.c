@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "coalesce.h"
+
+// Без -coalesce 0 сокеты клиентов работают с TCP_NODELAY и пробкой для массового вывода
+int coalesceEnabled = 1;
+
+static int setCork(int fd, int enable) {
+    if (setsockopt(fd, IPPROTO_TCP, TCP_CORK, &enable, sizeof(enable)) == -1) {
+        perror("setting TCP_CORK");
+        return -1;
+    }
+    return 0;
+}
+
+// Отключаем алгоритм Нейгла: эхо ввода не ждёт подтверждения предыдущего сегмента
+int enableNoDelay(int fd) {
+    int enable = 1;
+    if (!coalesceEnabled) {
+        return 0;
+    }
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable)) == -1) {
+        perror("setting TCP_NODELAY");
+        return -1;
+    }
+    return 0;
+}
+
+// Учитываем кусок, прочитанный из источника, до его записи клиенту
+// Как только проход набрал COALESCE_BULK_BYTES, это массовый вывод: ставим пробку,
+// и дальше ядро отправляет только полные сегменты
+void coalesceChunk(struct Coalescer *coalescer, int fd, size_t bytes) {
+    if (coalescer == NULL || !coalesceEnabled) {
+        return;
+    }
+    coalescer->passBytes += bytes;
+    if (coalescer->corked) {
+        coalescer->corkedBytes += bytes;
+    } else if (coalescer->passBytes >= COALESCE_BULK_BYTES && setCork(fd, 1) == 0) {
+        coalescer->corked = 1;
+        coalescer->corkedBytes = 0;
+    }
+}
+
+// Проход закончен, blocked - клиент принял не всё
+// Короткий проход - интерактивный вывод или хвост массового: снимаем пробку, чтобы он ушёл сразу
+// Возвращаем 1, если пробка осталась, а сброс хвоста ещё не запланирован
+int finishCoalescing(struct Coalescer *coalescer, int fd, int blocked) {
+    if (!coalesceEnabled) {
+        return 0;
+    }
+    if (coalescer->passBytes > 0 && coalescer->passBytes < COALESCE_BULK_BYTES && !blocked) {
+        flushCoalesced(coalescer, fd);
+    }
+    coalescer->passBytes = 0;
+    if (!coalescer->corked || coalescer->scheduled) {
+        return 0;
+    }
+    coalescer->scheduled = 1;
+    return 1;
+}
+
+// Срабатывание таймера сброса: если под пробкой ещё идёт массовый вывод, отправляем хвост
+// и оставляем пробку, возвращаем 1 - нужен следующий сброс; вывод затих - снимаем пробку
+int pushCoalesced(struct Coalescer *coalescer, int fd) {
+    coalescer->scheduled = 0;
+    if (!coalescer->corked) {
+        return 0;
+    }
+    if (coalescer->corkedBytes == 0) {
+        flushCoalesced(coalescer, fd);
+        return 0;
+    }
+    setCork(fd, 0);
+    setCork(fd, 1);
+    coalescer->corkedBytes = 0;
+    coalescer->scheduled = 1;
+    return 1;
+}
+
+// Снимаем пробку: ядро сразу отправляет накопленное
+void flushCoalesced(struct Coalescer *coalescer, int fd) {
+    if (!coalescer->corked) {
+        return;
+    }
+    setCork(fd, 0);
+    coalescer->corked = 0;
+    coalescer->corkedBytes = 0;
+}
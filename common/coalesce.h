@@ -0,0 +1,23 @@
+#ifndef COALESCE_H
+    #include <stddef.h>
+
+    #define COALESCE_BULK_BYTES 2048            // Проход передачи от этого размера - массовый вывод
+    #define COALESCE_FLUSH_DELAY_US 2000        // Через столько хвост массового вывода уходит без пробки
+
+    // Отправка вывода сессии: интерактивный вывод уходит сразу (TCP_NODELAY),
+    // массовый собирается в полные сегменты под TCP_CORK
+    struct Coalescer {
+        int corked;
+        int scheduled;          // Сброс пробки уже стоит в списке реактора
+        size_t passBytes;       // Прочитано из источника за текущий проход
+        size_t corkedBytes;     // Передано под пробкой с последнего сброса
+    };
+
+    extern int coalesceEnabled;
+    int enableNoDelay(int fd);
+    void coalesceChunk(struct Coalescer *coalescer, int fd, size_t bytes);
+    int finishCoalescing(struct Coalescer *coalescer, int fd, int blocked);
+    int pushCoalesced(struct Coalescer *coalescer, int fd);
+    void flushCoalesced(struct Coalescer *coalescer, int fd);
+    #define COALESCE_H
+#endif
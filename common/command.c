@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "command.h"
+#include "common.h"
+
+extern char **environ;
+
+// Команда не выполняется
+void initExecSession(struct ExecSession *exec) {
+    exec->pid = -1;
+    exec->in = -1;
+    exec->out = -1;
+    exec->err = -1;
+    exec->pidfd = -1;
+    exec->status = -1;
+}
+
+// Запускаем команду через /bin/sh -c на каналах stdout и stderr,
+// stdin - тоже канал при withInput, иначе /dev/null
+// posix_spawn не копирует память сервера, в отличие от fork
+int spawnCommand(struct ExecSession *exec, const char *command, size_t length, int withInput) {
+    char *text = strndup(command, length);
+    if (text == NULL) {
+        fprintf(stderr, "Error: allocating command\n");
+        return -1;
+    }
+    int outPipe[2] = {-1, -1};
+    int errPipe[2] = {-1, -1};
+    int inPipe[2] = {-1, -1};
+    if (pipe2(outPipe, O_CLOEXEC) == -1 || pipe2(errPipe, O_CLOEXEC) == -1
+            || (withInput && pipe2(inPipe, O_CLOEXEC) == -1)) {
+        perror("creating command pipes");
+        free(text);
+        int *pipes[] = {outPipe, errPipe};
+        for (int i = 0; i < 2; i++) {
+            if (pipes[i][0] != -1) {
+                close(pipes[i][0]);
+                close(pipes[i][1]);
+            }
+        }
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (withInput) {
+        posix_spawn_file_actions_adddup2(&actions, inPipe[0], 0);
+    } else {
+        posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    }
+    posix_spawn_file_actions_adddup2(&actions, outPipe[1], 1);
+    posix_spawn_file_actions_adddup2(&actions, errPipe[1], 2);
+#if __GLIBC_PREREQ(2, 34)
+    // Дескрипторы сервера без O_CLOEXEC команде не нужны
+    posix_spawn_file_actions_addclosefrom_np(&actions, 3);
+#endif
+    // Команда не должна унаследовать игнорирование сигналов и маску сигналов сервера,
+    // своя группа процессов позволяет завершить команду вместе с её потомками
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attributes, &signals);
+    sigaddset(&signals, SIGPIPE);
+    sigaddset(&signals, SIGCHLD);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGHUP);
+    posix_spawnattr_setsigdefault(&attributes, &signals);
+    posix_spawnattr_setpgroup(&attributes, 0);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+
+    char *argv[] = {"/bin/sh", "-c", text, NULL};
+    pid_t pid;
+    int error = posix_spawn(&pid, argv[0], &actions, &attributes, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+    free(text);
+    close(outPipe[1]);
+    close(errPipe[1]);
+    if (withInput) {
+        close(inPipe[0]);
+    }
+    if (error != 0) {
+        fprintf(stderr, "Error: spawning command: %s\n", strerror(error));
+        close(outPipe[0]);
+        close(errPipe[0]);
+        if (withInput) {
+            close(inPipe[1]);
+        }
+        return -1;
+    }
+    if (setNonBlock(outPipe[0]) == -1 || setNonBlock(errPipe[0]) == -1
+            || (withInput && setNonBlock(inPipe[1]) == -1)) {
+        fprintf(stderr, "Error: making command pipes non-block\n");
+    }
+    exec->pid = pid;
+    exec->in = inPipe[1];
+    exec->out = outPipe[0];
+    exec->err = errPipe[0];
+    exec->status = -1;
+    // Без pidfd завершение узнаём после конца вывода
+    exec->pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    return 0;
+}
+
+// Забираем код завершения команды, 0 если команда ещё выполняется
+int reapCommand(struct ExecSession *exec, int block) {
+    int status;
+    pid_t result;
+    do {
+        result = waitpid(exec->pid, &status, block ? 0 : WNOHANG);
+    } while (result == -1 && errno == EINTR);
+    if (result == 0) {
+        return 0;
+    }
+    if (result == -1) {
+        perror("waiting for command");
+        exec->status = EXEC_SPAWN_FAILED;
+    } else if (WIFEXITED(status)) {
+        exec->status = WEXITSTATUS(status);
+    } else {
+        exec->status = 128 + WTERMSIG(status);
+    }
+    return 1;
+}
+
+// Клиент отключился: завершаем группу процессов команды и забираем её
+void killCommand(struct ExecSession *exec) {
+    if (exec->pid == -1 || exec->status != -1) {
+        return;
+    }
+    kill(-exec->pid, SIGKILL);
+    reapCommand(exec, 1);
+}
+
+// Заголовок кадра: тип и длина данных или код завершения
+int formatFrameHeader(char *header, char type, long value) {
+    return snprintf(header, EXEC_FRAME_HEADER_SIZE, "%c %ld\n", type, value);
+}
@@ -0,0 +1,32 @@
+#ifndef COMMAND_H
+    #include <stddef.h>
+    #include <sys/types.h>
+
+    #define EXEC_PREFIX "exec "         // Логин с этим префиксом выбирает режим выполнения команд
+    #define EXEC_FRAME_STDOUT 'O'       // Кадр "<тип> <длина>\n<данные>"
+    #define EXEC_FRAME_STDERR 'E'
+    #define EXEC_FRAME_EXIT 'X'         // Кадр "X <код завершения>\n"
+    #define EXEC_FRAME_HEADER_SIZE 32
+    #define EXEC_SPAWN_FAILED 127
+    #define EXEC_CHUNK_SIZE 65536       // Наибольшие данные одного кадра
+
+    // Команда соединения, выполняемая без терминала на обычных каналах
+    struct ExecSession {
+        int requested;      // Клиент выбрал режим команд при входе
+        int active;         // Вход выполнен, соединение принимает команды
+        int inputClosed;    // Клиент больше не пришлёт команд
+        pid_t pid;          // -1 если команда не выполняется
+        int in;             // Канал stdin команды, -1 если ввод не нужен или закрыт
+        int out;            // Каналы stdout и stderr команды, -1 после конца вывода
+        int err;
+        int pidfd;          // Становится читаемым при завершении команды, -1 после этого или без pidfd
+        int status;         // Код завершения, -1 пока команда выполняется
+    };
+
+    void initExecSession(struct ExecSession *exec);
+    int spawnCommand(struct ExecSession *exec, const char *command, size_t length, int withInput);
+    int reapCommand(struct ExecSession *exec, int block);
+    void killCommand(struct ExecSession *exec);
+    int formatFrameHeader(char *header, char type, long value);
+    #define COMMAND_H
+#endif
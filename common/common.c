@@ -12,8 +12,10 @@
 #include "common.h"
 
 #define WRITE_BUFFER_SIZE 8
-#define READ_BUFFER_SIZE 8
-#define BUFFER_SIZE 1024
+#define BUFFER_SIZE 65536
+
+// Буфер для копирования, один на поток и переиспользуется между вызовами
+static __thread char messageBuffer[BUFFER_SIZE];
 
 // Делаем дескриптор не блокирующимся
 int setNonBlock(int fd) {
@@ -25,6 +27,16 @@ int setNonBlock(int fd) {
     return 0;
 }
 
+// Возвращаем дескриптор в блокирующий режим
+int setBlock(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (fcntl(fd, F_SETFL, flags & ~O_NONBLOCK)) {
+        perror("Making descriptor block");
+        return -1;
+    }
+    return 0;
+}
+
 // Добавляем дескриптор в epoll
 int addToEpoll(int epollfd, int fd, uint32_t flags) {
     struct epoll_event event;
@@ -61,85 +73,53 @@ int writeNonBlock(int fd, char *string) {
     return 0;
 }
 
-// Чтение из неблокирующегося дескриптора
-ssize_t readNonBlock(int fd, char **buffer, size_t beginSize) {
-    size_t size = beginSize;
-    if (size < 1)
-        size = READ_BUFFER_SIZE;
-    if (*buffer == NULL) {
-        *buffer = (char *)malloc(size * sizeof(char));
+// Послать сообщение
+// Копируем через большой буфер потока, пока в source есть данные
+// То, что dest не принял, сохраняем в output, при OUTPUT_HIGH_WATER байт в output чтение приостанавливается
+// Возвращаем 0, если данные закончились, SOURCE_CLOSED если source закрыт,
+// DEST_BLOCKED если в output остались данные, -1 при ошибке
+// Прочитанные из source байты прибавляются к received и записываются в журнал аудита по audit
+int sendMessage(int dest, int source, struct OutputBuffer *output, size_t *received, const struct AuditTag *audit) {
+    if (flushOutput(output, dest) == -1) {
+        return -1;
     }
-    intmax_t count = 0;
-    int legth = 0;
-    do {
-        count = read(fd, ((*buffer) + legth), READ_BUFFER_SIZE);
-        legth += count;
-        if (legth == size) {
-            size *= 2;
-            *buffer = realloc(*buffer, size * sizeof(char));
+    for (;;) {
+        if (output->length >= OUTPUT_HIGH_WATER) {
+            return DEST_BLOCKED;
+        }
+        ssize_t readCount = read(source, messageBuffer, BUFFER_SIZE);
+        if (readCount == 0) {
+            return SOURCE_CLOSED;
         }
-    } while (count > 0);
-    switch(count) {
-        case -1: {
-            if (errno != EAGAIN) {
-                perror("reading non-block error");
+        if (readCount == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                return output->length > 0 ? DEST_BLOCKED : 0;
+            // Терминал закрыт с другой стороны
+            if (errno == EIO)
+                return SOURCE_CLOSED;
+            perror("reading message from fd");
+            return -1;
+        }
+        *received += readCount;
+        auditData(audit, messageBuffer, (size_t)readCount);
+        ssize_t written = 0;
+        // Пока в output есть данные, новые пишем только после них
+        while (output->length == 0 && written < readCount) {
+            ssize_t writeCount = write(dest, messageBuffer + written, (size_t)(readCount - written));
+            if (writeCount == -1) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN)
+                    break;
+                perror("writing message to fd");
                 return -1;
             }
-            break;
+            written += writeCount;
         }
-        case 0: {
-            printf("Connection have been closed");
+        if (written < readCount && appendOutput(output, messageBuffer + written, (size_t)(readCount - written)) == -1) {
+            return -1;
         }
-        default:
-            break;
     }
-    size = strlen(*buffer);
-    *buffer = (char *)realloc(*buffer, size * sizeof(char));
-    return size;
 }
-
-// Очистить строку от символов \n
-char *cleanString(char *string) {
-    int length = strlen(string);
-    char *tmp = (char *)malloc(length);
-    memcpy(tmp, string, length);
-    int count = 0;
-    for (int i = 0; i < length; i++) {
-        if (tmp[i] == '\n' || tmp[i] == '\r')
-            count++;
-        else
-            break;
-    }
-    tmp += count;
-    length = strlen(tmp);
-    count = 0;
-    for (int i = 1; i < length; i++) {
-        if (tmp[length-i] == '\n' || tmp[length-i] == '\r')
-            count++;
-        else
-            break;
-    }
-    length-=count;
-    tmp[length] = '\0';
-    return tmp;
-}
-
-// Послать сообщение
-int sendMessage(int dest, int source) {
-    char buffer[BUFFER_SIZE];
-    ssize_t readCount = read(source, buffer, BUFFER_SIZE);
-    ssize_t writeCount;
-    while (readCount > -1) {
-        writeCount = write(dest, buffer, (size_t) readCount);
-        readCount = read(source, buffer, BUFFER_SIZE);
-    }
-    if (readCount == -1 && errno != EAGAIN) {
-        perror("reading message from fd");
-        return -1;
-    }
-    if (writeCount == -1 && errno != EAGAIN) {
-        perror("writing message to fd");
-        return -1;
-    }
-    return 0;
-}
\ No newline at end of file
@@ -3,12 +3,19 @@
 //
 
 #ifndef COMMON_H
+    #include <stdint.h>
+    #include <sys/types.h>
+
+    #include "outbuf.h"
+    #include "audit.h"
     int setNonBlock(int fd);
+    int setBlock(int fd);
     int addToEpoll(int epollfd, int fd, uint32_t flags);
     int changeEpoll(int epollfd, int fd, uint32_t flags);
     int writeNonBlock(int fd, char *string);
-    ssize_t readNonBlock(int fd, char **buffer, size_t beginSize);
-    char *cleanString(char *string);
-    int sendMessage(int dest, int source);
+    int sendMessage(int dest, int source, struct OutputBuffer *output, size_t *received, const struct AuditTag *audit);
+    #define SOURCE_CLOSED 1
+    #define DEST_BLOCKED 2
+    #define OUTPUT_HIGH_WATER (256 * 1024)
     #define COMMON_H
 #endif //COMMON_H
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef USE_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "compress.h"
+
+// Буфер для сжатых данных, один на поток
+static __thread char *scratch = NULL;
+static __thread size_t scratchSize = 0;
+
+#ifdef USE_LZ4
+// Блоки зависят от предыдущих: повторы между кусками вывода тоже сжимаются
+static const LZ4F_preferences_t lz4Preferences = {
+    .frameInfo = {.blockSizeID = LZ4F_max64KB, .blockMode = LZ4F_blockLinked},
+};
+#endif
+
+// Алгоритм по имени, COMPRESS_NONE если он неизвестен или сервер собран без него
+int parseCompression(const char *name, size_t length) {
+#ifdef USE_LZ4
+    if (length == strlen("lz4") && memcmp(name, "lz4", length) == 0) {
+        return COMPRESS_LZ4;
+    }
+#endif
+#ifdef USE_ZSTD
+    if (length == strlen("zstd") && memcmp(name, "zstd", length) == 0) {
+        return COMPRESS_ZSTD;
+    }
+#endif
+    return COMPRESS_NONE;
+}
+
+const char *getCompressionName(int algorithm) {
+    switch (algorithm) {
+        case COMPRESS_LZ4:
+            return "lz4";
+        case COMPRESS_ZSTD:
+            return "zstd";
+        default:
+            return "none";
+    }
+}
+
+// Сжатие не запрошено
+void initCompressor(struct Compressor *compressor) {
+    memset(compressor, 0, sizeof(struct Compressor));
+}
+
+// Выделяем буфер сжатых данных потока, размер зависит от алгоритма
+static int reserveScratch(int algorithm) {
+    size_t size = 0;
+#ifdef USE_LZ4
+    if (algorithm == COMPRESS_LZ4) {
+        size = LZ4F_compressBound(COMPRESS_CHUNK_SIZE, &lz4Preferences);
+        if (size < LZ4F_HEADER_SIZE_MAX) {
+            size = LZ4F_HEADER_SIZE_MAX;
+        }
+    }
+#endif
+#ifdef USE_ZSTD
+    if (algorithm == COMPRESS_ZSTD) {
+        size = ZSTD_CStreamOutSize();
+    }
+#endif
+    if (size <= scratchSize) {
+        return 0;
+    }
+    char *buffer = (char *)realloc(scratch, size);
+    if (buffer == NULL) {
+        fprintf(stderr, "Error: allocating compression buffer\n");
+        return -1;
+    }
+    scratch = buffer;
+    scratchSize = size;
+    return 0;
+}
+
+// Создаём контекст сжатия выбранного алгоритма
+int startCompressor(struct Compressor *compressor) {
+    if (reserveScratch(compressor->algorithm) == -1) {
+        return -1;
+    }
+#ifdef USE_LZ4
+    if (compressor->algorithm == COMPRESS_LZ4) {
+        LZ4F_cctx *context;
+        if (LZ4F_isError(LZ4F_createCompressionContext(&context, LZ4F_VERSION))) {
+            fprintf(stderr, "Error: creating lz4 context\n");
+            return -1;
+        }
+        compressor->context = context;
+    }
+#endif
+#ifdef USE_ZSTD
+    if (compressor->algorithm == COMPRESS_ZSTD) {
+        ZSTD_CCtx *context = ZSTD_createCCtx();
+        if (context == NULL) {
+            fprintf(stderr, "Error: creating zstd context\n");
+            return -1;
+        }
+        ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, COMPRESS_ZSTD_LEVEL);
+        compressor->context = context;
+    }
+#endif
+    return compressor->context != NULL ? 0 : -1;
+}
+
+#if defined(USE_LZ4) || defined(USE_ZSTD)
+// Переносим сжатые данные из буфера потока в выходной буфер
+static int appendCompressed(struct Compressor *compressor, struct OutputBuffer *output, size_t count) {
+    if (count == 0) {
+        return 0;
+    }
+    compressor->bytesOut += count;
+    return appendOutput(output, scratch, count);
+}
+#endif
+
+#ifdef USE_LZ4
+static int compressLz4(struct Compressor *compressor, const char *data, size_t length, int flush,
+                       struct OutputBuffer *output) {
+    LZ4F_cctx *context = (LZ4F_cctx *)compressor->context;
+    size_t count;
+    if (!compressor->started) {
+        count = LZ4F_compressBegin(context, scratch, scratchSize, &lz4Preferences);
+        if (LZ4F_isError(count) || appendCompressed(compressor, output, count) == -1) {
+            return -1;
+        }
+        compressor->started = 1;
+    }
+    // Граница буфера рассчитана на кусок COMPRESS_CHUNK_SIZE вместе с данными, которые LZ4 держит внутри
+    for (size_t offset = 0; offset < length; ) {
+        size_t size = length - offset < COMPRESS_CHUNK_SIZE ? length - offset : COMPRESS_CHUNK_SIZE;
+        count = LZ4F_compressUpdate(context, scratch, scratchSize, data + offset, size, NULL);
+        if (LZ4F_isError(count) || appendCompressed(compressor, output, count) == -1) {
+            return -1;
+        }
+        offset += size;
+    }
+    if (flush) {
+        count = LZ4F_flush(context, scratch, scratchSize, NULL);
+        if (LZ4F_isError(count) || appendCompressed(compressor, output, count) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+#endif
+
+#ifdef USE_ZSTD
+static int compressZstd(struct Compressor *compressor, const char *data, size_t length, int flush,
+                        struct OutputBuffer *output) {
+    ZSTD_inBuffer input = {data, length, 0};
+    ZSTD_EndDirective mode = flush ? ZSTD_e_flush : ZSTD_e_continue;
+    for (;;) {
+        ZSTD_outBuffer out = {scratch, scratchSize, 0};
+        size_t remaining = ZSTD_compressStream2((ZSTD_CCtx *)compressor->context, &out, &input, mode);
+        if (ZSTD_isError(remaining) || appendCompressed(compressor, output, out.pos) == -1) {
+            return -1;
+        }
+        // При сбросе ждём, пока zstd отдаст всё, что держит внутри
+        if (input.pos == input.size && (!flush || remaining == 0)) {
+            return 0;
+        }
+    }
+}
+#endif
+
+// Сжимаем данные в выходной буфер, при flush сбрасываем поток:
+// клиент сможет распаковать всё, что было передано до этого места
+int compressData(struct Compressor *compressor, const char *data, size_t length, int flush,
+                 struct OutputBuffer *output) {
+    if (length == 0 && (!flush || !compressor->unflushed)) {
+        return 0;
+    }
+    struct timespec begin, end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin);
+    int result = -1;
+#ifdef USE_LZ4
+    if (compressor->algorithm == COMPRESS_LZ4) {
+        result = compressLz4(compressor, data, length, flush, output);
+    }
+#endif
+#ifdef USE_ZSTD
+    if (compressor->algorithm == COMPRESS_ZSTD) {
+        result = compressZstd(compressor, data, length, flush, output);
+    }
+#endif
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+    compressor->nanoseconds += (end.tv_sec - begin.tv_sec) * 1000000000UL + end.tv_nsec - begin.tv_nsec;
+    compressor->bytesIn += length;
+    compressor->unflushed = !flush;
+    if (result == -1) {
+        fprintf(stderr, "Error: compressing session output\n");
+    }
+    return result;
+}
+
+// Освобождаем контекст сжатия
+void destroyCompressor(struct Compressor *compressor) {
+#ifdef USE_LZ4
+    if (compressor->algorithm == COMPRESS_LZ4 && compressor->context != NULL) {
+        LZ4F_freeCompressionContext((LZ4F_cctx *)compressor->context);
+    }
+#endif
+#ifdef USE_ZSTD
+    if (compressor->algorithm == COMPRESS_ZSTD && compressor->context != NULL) {
+        ZSTD_freeCCtx((ZSTD_CCtx *)compressor->context);
+    }
+#endif
+    initCompressor(compressor);
+}
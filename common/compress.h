@@ -0,0 +1,33 @@
+#ifndef COMPRESS_H
+    #include <stddef.h>
+
+    #include "outbuf.h"
+
+    #define COMPRESS_PREFIX "compress "     // Логин "compress <алгоритм> <логин>" запрашивает сжатие вывода
+    #define COMPRESS_NONE 0
+    #define COMPRESS_LZ4 1                  // Кадр LZ4 Frame, собирается с -DUSE_LZ4 -llz4
+    #define COMPRESS_ZSTD 2                 // Поток zstd, собирается с -DUSE_ZSTD -lzstd
+    #define COMPRESS_ZSTD_LEVEL 3
+    #define COMPRESS_CHUNK_SIZE 16384       // Данные сжимаются кусками не больше этого
+
+    // Потоковое сжатие вывода сессии
+    struct Compressor {
+        int requested;              // Клиент запросил сжатие при входе, сервер ответит выбранным алгоритмом
+        int algorithm;              // COMPRESS_NONE, если сжатие не запрошено или не собрано
+        void *context;              // LZ4F_cctx или ZSTD_CCtx, NULL до начала сессии
+        int started;                // Заголовок кадра LZ4 уже записан
+        int unflushed;              // Есть сжатые данные, не сброшенные в выход
+        unsigned long bytesIn;
+        unsigned long bytesOut;
+        unsigned long nanoseconds;  // Процессорное время сжатия
+    };
+
+    int parseCompression(const char *name, size_t length);
+    const char *getCompressionName(int algorithm);
+    void initCompressor(struct Compressor *compressor);
+    int startCompressor(struct Compressor *compressor);
+    int compressData(struct Compressor *compressor, const char *data, size_t length, int flush,
+                     struct OutputBuffer *output);
+    void destroyCompressor(struct Compressor *compressor);
+    #define COMPRESS_H
+#endif
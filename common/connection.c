@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "connection.h"
+
+// Таблица соединений индексируется дескриптором и растёт блоками,
+// уже выделенные блоки не перемещаются, поэтому поиск идёт без блокировок
+#define TABLE_CHUNK_BITS 12
+#define TABLE_CHUNK_SIZE (1 << TABLE_CHUNK_BITS)
+#define TABLE_MAX_CHUNKS 1024
+#define POOL_BLOCK_SIZE 256
+
+// Слот таблицы: соединение и номер его канала, которому принадлежит дескриптор
+typedef struct {
+    _Atomic(struct Connection *) connection;
+    atomic_int channel;             // -1 для дескрипторов самого соединения
+} ConnectionSlot;
+
+// Блоки таблицы: дескриптор fd лежит в chunks[fd >> TABLE_CHUNK_BITS][fd & (TABLE_CHUNK_SIZE - 1)]
+static _Atomic(ConnectionSlot *) chunks[TABLE_MAX_CHUNKS];
+
+// Структуры соединений не возвращаются системе, а переиспользуются через список свободных,
+// поэтому указатель, полученный без блокировки, всегда указывает на struct Connection
+static struct Connection *freeConnections = NULL;
+static struct Connection **poolBlocks = NULL;
+static int poolBlocksCount = 0;
+static atomic_int activeConnections = 0;
+
+// Мьютекс нужен только для выделения новых блоков и списка свободных структур
+static pthread_mutex_t tableMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Инициализируем таблицу соединений
+int initConnections(void) {
+    for (int i = 0; i < TABLE_MAX_CHUNKS; i++) {
+        atomic_init(&chunks[i], NULL);
+    }
+    return 0;
+}
+
+// Получаем слот таблицы для дескриптора, при необходимости выделяем блок
+static ConnectionSlot *getSlot(int fd, int create) {
+    if (fd < 0 || (fd >> TABLE_CHUNK_BITS) >= TABLE_MAX_CHUNKS) {
+        return NULL;
+    }
+    _Atomic(ConnectionSlot *) *chunkPtr = &chunks[fd >> TABLE_CHUNK_BITS];
+    ConnectionSlot *chunk = atomic_load_explicit(chunkPtr, memory_order_acquire);
+    if (chunk == NULL && create) {
+        pthread_mutex_lock(&tableMutex);
+        chunk = atomic_load_explicit(chunkPtr, memory_order_acquire);
+        if (chunk == NULL) {
+            chunk = (ConnectionSlot *)calloc(TABLE_CHUNK_SIZE, sizeof(ConnectionSlot));
+            if (chunk == NULL) {
+                fprintf(stderr, "Error: allocating connection table chunk\n");
+            } else {
+                atomic_store_explicit(chunkPtr, chunk, memory_order_release);
+            }
+        }
+        pthread_mutex_unlock(&tableMutex);
+    }
+    if (chunk == NULL) {
+        return NULL;
+    }
+    return &chunk[fd & (TABLE_CHUNK_SIZE - 1)];
+}
+
+// Берём свободную структуру соединения из пула
+static struct Connection *allocConnection(void) {
+    pthread_mutex_lock(&tableMutex);
+    if (freeConnections == NULL) {
+        struct Connection *block = (struct Connection *)calloc(POOL_BLOCK_SIZE, sizeof(struct Connection));
+        struct Connection **blocks = (struct Connection **)realloc(poolBlocks, (poolBlocksCount + 1) * sizeof(struct Connection *));
+        if (block == NULL || blocks == NULL) {
+            fprintf(stderr, "Error: allocating connections pool\n");
+            free(block);
+            if (blocks != NULL)
+                poolBlocks = blocks;
+            pthread_mutex_unlock(&tableMutex);
+            return NULL;
+        }
+        poolBlocks = blocks;
+        poolBlocks[poolBlocksCount++] = block;
+        for (int i = 0; i < POOL_BLOCK_SIZE; i++) {
+            block[i].nextFree = freeConnections;
+            freeConnections = &block[i];
+        }
+    }
+    struct Connection *connection = freeConnections;
+    freeConnections = connection->nextFree;
+    pthread_mutex_unlock(&tableMutex);
+    return connection;
+}
+
+// Добавляем соединение в таблицу
+struct Connection *addConnectionIntoList(int connectionfd) {
+    struct Connection *connection = allocConnection();
+    if (connection == NULL) {
+        return NULL;
+    }
+    unsigned int generation = connection->generation;
+    memset(connection, 0, sizeof(struct Connection));
+    connection->generation = generation;
+    connection->connectionfd = connectionfd;
+    connection->ptm = -1;
+    connection->lastRequest = getCoarseTime();
+    connection->createdAt = connection->lastRequest;
+    connection->loginLength = 0;
+    connection->timers = NULL;
+    initTimerNode(&connection->timer);
+    initInputBuffer(&connection->input);
+    initRelay(&connection->toPty);
+    initRelay(&connection->toClient);
+    connection->toClient.coalescer = &connection->coalescer;
+    initExecSession(&connection->exec);
+    initShell(&connection->shell);
+    initChannelTable(&connection->channels);
+    initCompressor(&connection->compressor);
+    if (registerConnectionFd(connection, connectionfd) == -1) {
+        pthread_mutex_lock(&tableMutex);
+        connection->nextFree = freeConnections;
+        freeConnections = connection;
+        pthread_mutex_unlock(&tableMutex);
+        return NULL;
+    }
+    atomic_fetch_add(&activeConnections, 1);
+    return connection;
+}
+
+// Дескриптор принадлежит соединению: сокет, ptm и pidfd оболочки, каналы и pidfd команды или дескриптор канала channel
+static int ownsFd(struct Connection *connection, int channel, int fd) {
+    if (channel >= 0) {
+        return channelOwnsFd(&connection->channels, channel, fd);
+    }
+    return connection->connectionfd == fd || connection->ptm == fd || connection->shell.pidfd == fd
+           || connection->exec.out == fd || connection->exec.err == fd || connection->exec.pidfd == fd;
+}
+
+// Привязываем дескриптор канала channel к соединению
+int registerChannelFd(struct Connection *connection, int fd, int channel) {
+    ConnectionSlot *slot = getSlot(fd, 1);
+    if (slot == NULL) {
+        fprintf(stderr, "Error: descriptor %d doesn't fit into connection table\n", fd);
+        return -1;
+    }
+    atomic_store_explicit(&slot->channel, channel, memory_order_relaxed);
+    atomic_store_explicit(&slot->connection, connection, memory_order_release);
+    return 0;
+}
+
+// Привязываем дескриптор (сокет, ptm или канал команды) к соединению
+int registerConnectionFd(struct Connection *connection, int fd) {
+    return registerChannelFd(connection, fd, -1);
+}
+
+// Отвязываем дескриптор от соединения
+void unregisterConnectionFd(int fd) {
+    ConnectionSlot *slot = getSlot(fd, 0);
+    if (slot != NULL) {
+        atomic_store_explicit(&slot->connection, NULL, memory_order_release);
+    }
+}
+
+// Ищем соединение и номер канала по любому его дескриптору, номер -1 у дескрипторов самого соединения
+struct Connection *getConnectionChannel(int fd, int *channel) {
+    ConnectionSlot *slot = getSlot(fd, 0);
+    if (slot == NULL) {
+        return NULL;
+    }
+    struct Connection *connection = atomic_load_explicit(&slot->connection, memory_order_acquire);
+    if (connection == NULL) {
+        return NULL;
+    }
+    *channel = atomic_load_explicit(&slot->channel, memory_order_relaxed);
+    if (!ownsFd(connection, *channel, fd)) {
+        return NULL;
+    }
+    return connection;
+}
+
+// Ищем соединение по любому его дескриптору
+struct Connection *getConnection(int fd) {
+    int channel;
+    return getConnectionChannel(fd, &channel);
+}
+
+// Удаляем соединение из таблицы и возвращаем структуру в пул
+void removeConnectionFromList(struct Connection *connection) {
+    if (getConnection(connection->connectionfd) == connection) {
+        unregisterConnectionFd(connection->connectionfd);
+    }
+    int fds[] = {connection->ptm, connection->exec.out, connection->exec.err, connection->exec.pidfd,
+                 connection->shell.pidfd};
+    for (int i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (fds[i] != -1 && getConnection(fds[i]) == connection) {
+            unregisterConnectionFd(fds[i]);
+        }
+    }
+    pthread_mutex_lock(&tableMutex);
+    connection->generation++;
+    connection->connectionfd = -1;
+    connection->ptm = -1;
+    connection->nextFree = freeConnections;
+    freeConnections = connection;
+    pthread_mutex_unlock(&tableMutex);
+    atomic_fetch_sub(&activeConnections, 1);
+}
+
+// Вызываем callback для каждого открытого соединения
+void forEachConnection(void (*callback)(struct Connection *)) {
+    for (int i = 0; i < TABLE_MAX_CHUNKS; i++) {
+        ConnectionSlot *chunk = atomic_load_explicit(&chunks[i], memory_order_acquire);
+        if (chunk == NULL) {
+            continue;
+        }
+        for (int j = 0; j < TABLE_CHUNK_SIZE; j++) {
+            int fd = (i << TABLE_CHUNK_BITS) | j;
+            struct Connection *connection = atomic_load_explicit(&chunk[j].connection, memory_order_acquire);
+            // Соединение встречается под каждым своим дескриптором, обходим его по дескриптору сокета
+            if (connection != NULL && connection->connectionfd == fd) {
+                callback(connection);
+            }
+        }
+    }
+}
+
+// Количество открытых соединений
+int countConnections(void) {
+    return atomic_load(&activeConnections);
+}
+
+// Освобождаем таблицу и пул
+void destroyConnections(void) {
+    for (int i = 0; i < TABLE_MAX_CHUNKS; i++) {
+        free(atomic_load(&chunks[i]));
+        atomic_store(&chunks[i], NULL);
+    }
+    for (int i = 0; i < poolBlocksCount; i++) {
+        free(poolBlocks[i]);
+    }
+    free(poolBlocks);
+    poolBlocks = NULL;
+    poolBlocksCount = 0;
+    freeConnections = NULL;
+}
@@ -0,0 +1,79 @@
+#ifndef CONNECTION_H
+    #include <time.h>
+    #include <stdatomic.h>
+
+    #include "pass_pair.h"
+    #include "timerwheel.h"
+    #include "relay.h"
+    #include "inbuf.h"
+    #include "uring.h"
+    #include "command.h"
+    #include "channel.h"
+    #include "zygote.h"
+    #include "coalesce.h"
+    #include "ratelimit.h"
+
+    #define LOGIN_REQUEST 0
+    #define LOGIN_CHECK 1
+    #define PASSWORD_REQUEST 2
+    #define PASSWORD_CHECK 3
+    #define PASSWORD_VERIFYING 4
+    #define AUTHENTICATED 5
+
+    #define WATCH_SOCKET 1
+    #define WATCH_PTM 2
+
+    // Структура содержащая информацию об аутентификации
+    struct Authentication {
+        int status;  // 0 - Запрос логина 1 - Проверка логина 2 - Запрос пароля 3 - Проверка пароля
+                     // 4 - Пароль проверяется в пуле аутентификации 5 - Аутентифицирован
+        int attempts;
+    };
+
+    struct Reactor;
+
+    // Структура содержащая информацию о соединении
+    struct Connection {
+        int connectionfd;
+        int ptm;
+        struct Shell shell;             // Оболочка сессии, её pidfd обрабатывается событиями epoll
+        struct Authentication auth;
+        char login[MAX_LOGIN_LEN];      // Введённый логин, пара ищется заново при проверке пароля
+        size_t loginLength;
+        time_t lastRequest;             // Время последней активности по грубым часам
+        time_t createdAt;
+        struct TimerNode timer;         // Таймер таймаута в колесе реактора
+        struct TimerWheel *timers;
+        struct InputBuffer input;       // Ввод клиента до запуска оболочки
+        struct Relay toPty;             // Передача данных сессии в обе стороны
+        struct Relay toClient;          // Буфер toClient используется и для сообщений сервера
+        struct UringSession uring;      // Передача данных сессии через io_uring реактора
+        struct ExecSession exec;        // Выполнение команд без терминала
+        struct ChannelTable channels;   // Каналы соединения в режиме каналов
+        struct Compressor compressor;   // Сжатие вывода оболочки
+        struct Coalescer coalescer;     // Пробка TCP_CORK для массового вывода
+        int epollfd;
+        struct Reactor *reactor;        // Реактор, которому принадлежит соединение
+        int worker;                     // Рабочий поток общего epoll, обрабатывающий события соединения
+        int writeWatched;               // Дескрипторы, для которых ждём EPOLLOUT (WATCH_*)
+        unsigned long auditSession;     // Номер сессии в журнале аудита, 0 - не записывается
+        struct RateKey source;          // Адрес клиента для ограничения частоты проверок
+        size_t outputSinceInput;        // Передано клиенту с последнего ввода
+        atomic_int bulk;                // Идёт массовая передача клиенту, читает диспетчер
+        unsigned int generation;        // Увеличивается при каждом освобождении структуры
+        struct Connection *nextFree;
+    };
+
+    int initConnections(void);
+    struct Connection *addConnectionIntoList(int connectionfd);
+    int registerConnectionFd(struct Connection *connection, int fd);
+    int registerChannelFd(struct Connection *connection, int fd, int channel);
+    void unregisterConnectionFd(int fd);
+    struct Connection *getConnection(int fd);
+    struct Connection *getConnectionChannel(int fd, int *channel);
+    void removeConnectionFromList(struct Connection *connection);
+    void forEachConnection(void (*callback)(struct Connection *));
+    int countConnections(void);
+    void destroyConnections(void);
+    #define CONNECTION_H
+#endif
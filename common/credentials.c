@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "credentials.h"
+
+// Читаем пароли из файла старого формата: записи struct PassPair подряд
+struct PassPair *readPassPairs(const char *path, uint32_t *count) {
+    FILE *ptr = fopen(path, "r");
+    if (ptr == NULL) {
+        perror("opening passwords file");
+        return NULL;
+    }
+    size_t size = 8;
+    size_t length = 0;
+    struct PassPair *pairs = (struct PassPair *)malloc(size * sizeof(struct PassPair));
+    while (pairs != NULL && fread(pairs + length, sizeof(struct PassPair), 1, ptr) == 1) {
+        length++;
+        if (length == size) {
+            size *= 2;
+            struct PassPair *grown = (struct PassPair *)realloc(pairs, size * sizeof(struct PassPair));
+            if (grown == NULL) {
+                free(pairs);
+            }
+            pairs = grown;
+        }
+    }
+    fclose(ptr);
+    if (pairs == NULL) {
+        fprintf(stderr, "Error: allocating memory for passwords\n");
+        return NULL;
+    }
+    *count = (uint32_t)length;
+    return pairs;
+}
+
+// Заголовок нового формата: кроме метки совпадают версия, размер записи и раскладка файла,
+// которую даёт writeCredentials. Файл старого формата с первым логином SSHPASS её не пройдёт
+static int isCredentialsHeader(const struct CredentialsHeader *header, size_t fileSize) {
+    if (memcmp(header->magic, CREDENTIALS_MAGIC, sizeof(CREDENTIALS_MAGIC)) != 0
+            || header->version != CREDENTIALS_VERSION || header->recordSize != sizeof(struct PassPair)
+            || header->recordsOffset != sizeof(struct CredentialsHeader)) {
+        return 0;
+    }
+    uint64_t recordsEnd = header->recordsOffset + (uint64_t)header->count * sizeof(struct PassPair);
+    uint64_t indexOffset = (recordsEnd + 7) & ~(uint64_t)7;
+    return header->indexOffset == indexOffset
+           && header->indexOffset + (uint64_t)header->indexSize * sizeof(uint32_t) == fileSize;
+}
+
+// Отображаем файл базы в память, проверяем заголовок и границы
+static int mapCredentials(struct Credentials *credentials, int fd, size_t fileSize) {
+    void *mapping = mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        perror("mapping credentials file");
+        return -1;
+    }
+    const struct CredentialsHeader *header = mapping;
+    uint64_t recordsEnd = header->recordsOffset + (uint64_t)header->count * sizeof(struct PassPair);
+    uint64_t indexEnd = header->indexOffset + (uint64_t)header->indexSize * sizeof(uint32_t);
+    if (header->version != CREDENTIALS_VERSION || header->recordSize != sizeof(struct PassPair)
+            || header->recordsOffset > fileSize || header->indexOffset > fileSize
+            || recordsEnd > fileSize || indexEnd > fileSize || header->indexOffset % sizeof(uint32_t) != 0) {
+        fprintf(stderr, "Error: wrong credentials file header\n");
+        munmap(mapping, fileSize);
+        return -1;
+    }
+    if (initPassIndex(&credentials->index, (const struct PassPair *)((char *)mapping + header->recordsOffset),
+                      header->count, (const uint32_t *)((char *)mapping + header->indexOffset), header->indexSize) == -1) {
+        munmap(mapping, fileSize);
+        return -1;
+    }
+    credentials->mapping = mapping;
+    credentials->mappingSize = fileSize;
+    return 0;
+}
+
+// Загружаем базу паролей
+// Файл нового формата отображается в память с готовым индексом,
+// файл старого формата читается целиком и индекс строится при загрузке
+struct Credentials *loadCredentials(const char *path) {
+    struct Credentials *credentials = (struct Credentials *)calloc(1, sizeof(struct Credentials));
+    if (credentials == NULL) {
+        fprintf(stderr, "Error: allocating credentials\n");
+        return NULL;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror("opening passwords file");
+        free(credentials);
+        return NULL;
+    }
+    struct stat info;
+    struct CredentialsHeader header;
+    if (fstat(fd, &info) == -1) {
+        perror("reading passwords file size");
+        close(fd);
+        free(credentials);
+        return NULL;
+    }
+    if (info.st_size >= (off_t)sizeof(header) && read(fd, &header, sizeof(header)) == sizeof(header)
+            && isCredentialsHeader(&header, (size_t)info.st_size)) {
+        int status = mapCredentials(credentials, fd, (size_t)info.st_size);
+        close(fd);
+        if (status == -1) {
+            free(credentials);
+            return NULL;
+        }
+        return credentials;
+    }
+    close(fd);
+
+    uint32_t count = 0;
+    credentials->pairs = readPassPairs(path, &count);
+    if (credentials->pairs == NULL || buildPassIndex(&credentials->index, credentials->pairs, count) == -1) {
+        free(credentials->pairs);
+        free(credentials);
+        return NULL;
+    }
+    return credentials;
+}
+
+// Записываем базу нового формата: через временный файл и rename, чтобы сервер не увидел её наполовину
+int writeCredentials(const char *path, const struct PassPair *pairs, uint32_t count) {
+    struct CredentialsHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CREDENTIALS_MAGIC, sizeof(CREDENTIALS_MAGIC));
+    header.version = CREDENTIALS_VERSION;
+    header.recordSize = sizeof(struct PassPair);
+    header.count = count;
+    header.indexSize = getPassIndexSize(count);
+    header.recordsOffset = sizeof(header);
+    header.indexOffset = (header.recordsOffset + (uint64_t)count * sizeof(struct PassPair) + 7) & ~(uint64_t)7;
+
+    uint32_t *slots = (uint32_t *)malloc(header.indexSize * sizeof(uint32_t));
+    if (slots == NULL || fillPassIndexSlots(slots, header.indexSize, pairs, count) == -1) {
+        fprintf(stderr, "Error: building credentials index\n");
+        free(slots);
+        return -1;
+    }
+
+    size_t pathLength = strlen(path);
+    char *tmpPath = (char *)malloc(pathLength + 5);
+    if (tmpPath == NULL) {
+        free(slots);
+        return -1;
+    }
+    memcpy(tmpPath, path, pathLength);
+    memcpy(tmpPath + pathLength, ".tmp", 5);
+
+    FILE *ptr = fopen(tmpPath, "wb");
+    int status = -1;
+    if (ptr == NULL) {
+        perror("opening credentials file for writing");
+    } else {
+        static const char padding[8];
+        size_t paddingLength = header.indexOffset - header.recordsOffset - (uint64_t)count * sizeof(struct PassPair);
+        if (fwrite(&header, sizeof(header), 1, ptr) == 1
+                && fwrite(pairs, sizeof(struct PassPair), count, ptr) == count
+                && fwrite(padding, 1, paddingLength, ptr) == paddingLength
+                && fwrite(slots, sizeof(uint32_t), header.indexSize, ptr) == header.indexSize
+                && fflush(ptr) == 0 && fsync(fileno(ptr)) == 0) {
+            status = 0;
+        } else {
+            perror("writing credentials file");
+        }
+        if (fclose(ptr) != 0) {
+            status = -1;
+        }
+        if (status == 0 && rename(tmpPath, path) == -1) {
+            perror("renaming credentials file");
+            status = -1;
+        }
+        if (status == -1) {
+            unlink(tmpPath);
+        }
+    }
+    free(tmpPath);
+    free(slots);
+    return status;
+}
+
+// Освобождаем версию базы
+void freeCredentials(struct Credentials *credentials) {
+    if (credentials == NULL) {
+        return;
+    }
+    destroyPassIndex(&credentials->index);
+    if (credentials->mapping != NULL) {
+        munmap(credentials->mapping, credentials->mappingSize);
+    }
+    free(credentials->pairs);
+    free(credentials);
+}
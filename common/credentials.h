@@ -0,0 +1,35 @@
+#ifndef CREDENTIALS_H
+    #include <stddef.h>
+    #include <stdint.h>
+
+    #include "pass_pair.h"
+    #include "passindex.h"
+
+    #define CREDENTIALS_MAGIC "SSHPASS"
+    #define CREDENTIALS_VERSION 1
+
+    // Заголовок файла базы: за ним записи struct PassPair и таблица слотов индекса
+    struct CredentialsHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t recordSize;
+        uint32_t count;
+        uint32_t indexSize;
+        uint64_t recordsOffset;
+        uint64_t indexOffset;
+    };
+
+    // Загруженная версия базы паролей
+    struct Credentials {
+        struct PassIndex index;
+        struct PassPair *pairs;     // Записи старого формата, прочитанные в память
+        void *mapping;              // Отображение файла базы нового формата
+        size_t mappingSize;
+    };
+
+    struct PassPair *readPassPairs(const char *path, uint32_t *count);
+    struct Credentials *loadCredentials(const char *path);
+    int writeCredentials(const char *path, const struct PassPair *pairs, uint32_t count);
+    void freeCredentials(struct Credentials *credentials);
+    #define CREDENTIALS_H
+#endif
@@ -0,0 +1,213 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "handoff.h"
+
+extern char **environ;
+
+// Ограничиваем ожидание на сокете передачи: зависший процесс не должен остановить другой
+static int setHandoffTimeout(int socketfd) {
+    struct timeval timeout = {HANDOFF_TIMEOUT, 0};
+    if (setsockopt(socketfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1
+            || setsockopt(socketfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1) {
+        perror("setting handoff timeout");
+        return -1;
+    }
+    return 0;
+}
+
+// Окружение нового процесса: текущее и номер сокета передачи
+// Собираем до fork: в потомке многопоточного процесса нельзя выделять память
+static char **buildSuccessorEnv(int socketfd, char **variable) {
+    size_t count = 0;
+    while (environ[count] != NULL) {
+        count++;
+    }
+    char **envp = (char **)malloc((count + 2) * sizeof(char *));
+    *variable = (char *)malloc(sizeof(HANDOFF_ENV) + 16);
+    if (envp == NULL || *variable == NULL) {
+        free(envp);
+        free(*variable);
+        return NULL;
+    }
+    size_t length = strlen(HANDOFF_ENV);
+    size_t used = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (strncmp(environ[i], HANDOFF_ENV, length) != 0 || environ[i][length] != '=') {
+            envp[used++] = environ[i];
+        }
+    }
+    snprintf(*variable, sizeof(HANDOFF_ENV) + 16, "%s=%d", HANDOFF_ENV, socketfd);
+    envp[used++] = *variable;
+    envp[used] = NULL;
+    return envp;
+}
+
+// Запускаем новый процесс сервера с теми же аргументами, возвращаем наш конец сокета передачи
+// argv[0] ищется заново: на диске уже может лежать новая версия сервера
+int startSuccessor(char *argv[], pid_t *pid) {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) == -1) {
+        perror("creating handoff socket");
+        return -1;
+    }
+    char *variable = NULL;
+    char **envp = buildSuccessorEnv(sockets[1], &variable);
+    if (envp == NULL) {
+        fprintf(stderr, "Error: allocating successor environment\n");
+        close(sockets[0]);
+        close(sockets[1]);
+        return -1;
+    }
+    *pid = fork();
+    if (*pid == 0) {
+        // Сокет передачи - единственный дескриптор, который новый процесс наследует
+        fcntl(sockets[1], F_SETFD, 0);
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigprocmask(SIG_SETMASK, &signals, NULL);
+        execvpe(argv[0], argv, envp);
+        _exit(127);
+    }
+    free(variable);
+    free(envp);
+    close(sockets[1]);
+    if (*pid == -1) {
+        perror("forking successor");
+        close(sockets[0]);
+        return -1;
+    }
+    setHandoffTimeout(sockets[0]);
+    return sockets[0];
+}
+
+// Сокет передачи от предыдущего процесса, -1 если сервер запущен обычным образом
+int takeHandoffSocket(void) {
+    char *value = getenv(HANDOFF_ENV);
+    if (value == NULL) {
+        return -1;
+    }
+    int socketfd = atoi(value);
+    // Оболочки и следующий процесс переменную наследовать не должны
+    unsetenv(HANDOFF_ENV);
+    if (socketfd < 0 || fcntl(socketfd, F_SETFD, FD_CLOEXEC) == -1) {
+        fprintf(stderr, "Error: wrong handoff socket %d\n", socketfd);
+        return -1;
+    }
+    setHandoffTimeout(socketfd);
+    return socketfd;
+}
+
+void initHandoffMessage(struct HandoffMessage *message, int type) {
+    memset(message, 0, sizeof(struct HandoffMessage));
+    message->version = HANDOFF_VERSION;
+    message->type = type;
+    message->shellPid = -1;
+}
+
+// Отправляем сообщение с дескрипторами, у нас остаются свои копии
+int sendHandoff(int socketfd, struct HandoffMessage *message, int *fds, int count) {
+    char control[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {message, sizeof(struct HandoffMessage)};
+    struct msghdr header = {0};
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    if (count > 0) {
+        header.msg_control = control;
+        header.msg_controllen = CMSG_SPACE(count * sizeof(int));
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+    }
+    ssize_t sent;
+    do {
+        sent = sendmsg(socketfd, &header, MSG_NOSIGNAL);
+    } while (sent == -1 && errno == EINTR);
+    if (sent == -1) {
+        perror("sending handoff");
+        return -1;
+    }
+    return 0;
+}
+
+// Получаем сообщение и его дескрипторы, -1 при ошибке или когда предыдущий процесс закрыл сокет
+int receiveHandoff(int socketfd, struct HandoffMessage *message, int *fds, int *count) {
+    char control[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))];
+    struct iovec iov = {message, sizeof(struct HandoffMessage)};
+    struct msghdr header = {0};
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+    ssize_t received;
+    do {
+        received = recvmsg(socketfd, &header, MSG_CMSG_CLOEXEC);
+    } while (received == -1 && errno == EINTR);
+    if (received == -1) {
+        perror("receiving handoff");
+        return -1;
+    }
+    *count = 0;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        *count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        memcpy(fds, CMSG_DATA(cmsg), *count * sizeof(int));
+    }
+    if (received == 0) {
+        return -1;
+    }
+    if (received != sizeof(struct HandoffMessage) || message->version != HANDOFF_VERSION
+            || (header.msg_flags & MSG_CTRUNC) != 0) {
+        fprintf(stderr, "Error: wrong handoff message\n");
+        for (int i = 0; i < *count; i++) {
+            close(fds[i]);
+        }
+        *count = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// Получаем слушающие сокеты предыдущего процесса, возвращаем их количество
+int receiveListeners(int socketfd, int **listeners) {
+    struct HandoffMessage message;
+    int fds[HANDOFF_MAX_FDS];
+    int count;
+    int listenersCount = 0;
+    *listeners = NULL;
+    while (receiveHandoff(socketfd, &message, fds, &count) == 0) {
+        if (message.type == HANDOFF_READY) {
+            return listenersCount;
+        }
+        if (message.type != HANDOFF_LISTENER || count != 1) {
+            for (int i = 0; i < count; i++) {
+                close(fds[i]);
+            }
+            continue;
+        }
+        int *grown = (int *)realloc(*listeners, (listenersCount + 1) * sizeof(int));
+        if (grown == NULL) {
+            close(fds[0]);
+            continue;
+        }
+        *listeners = grown;
+        (*listeners)[listenersCount++] = fds[0];
+    }
+    for (int i = 0; i < listenersCount; i++) {
+        close((*listeners)[i]);
+    }
+    free(*listeners);
+    *listeners = NULL;
+    return -1;
+}
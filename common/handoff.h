@@ -0,0 +1,42 @@
+#ifndef HANDOFF_H
+    #include <stdint.h>
+    #include <stddef.h>
+    #include <time.h>
+    #include <sys/types.h>
+
+    #include "pass_pair.h"
+
+    #define HANDOFF_ENV "SSHSERVER_HANDOFF_FD"   // Номер сокета передачи в окружении нового процесса
+    #define HANDOFF_VERSION 1
+    #define HANDOFF_TIMEOUT 5                    // Секунд ожидания на сокете передачи
+    #define HANDOFF_MAX_FDS 3
+
+    #define HANDOFF_LISTENER 0      // Слушающий сокет
+    #define HANDOFF_READY 1         // Слушающие сокеты переданы, дальше идут соединения
+    #define HANDOFF_CONNECTION 2    // Соединение: сокет, ptm и pidfd оболочки, если сессия запущена
+
+    // Состояние соединения, передаваемое новому процессу вместе с его дескрипторами
+    struct HandoffMessage {
+        uint32_t version;
+        int type;
+        int authStatus;
+        int attempts;
+        char login[MAX_LOGIN_LEN];
+        size_t loginLength;
+        int execRequested;          // Префиксы логина, введённого до передачи
+        int muxRequested;
+        int compressRequested;
+        int algorithm;
+        pid_t shellPid;
+        time_t createdAt;           // По CLOCK_MONOTONIC, общим для процессов
+        time_t lastRequest;
+    };
+
+    int startSuccessor(char *argv[], pid_t *pid);
+    int takeHandoffSocket(void);
+    void initHandoffMessage(struct HandoffMessage *message, int type);
+    int sendHandoff(int socketfd, struct HandoffMessage *message, int *fds, int count);
+    int receiveHandoff(int socketfd, struct HandoffMessage *message, int *fds, int *count);
+    int receiveListeners(int socketfd, int **listeners);
+    #define HANDOFF_H
+#endif
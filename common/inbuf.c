@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "inbuf.h"
+#include "common.h"
+
+// Инициализируем пустой буфер, память выделяется при первом чтении
+void initInputBuffer(struct InputBuffer *buffer) {
+    buffer->data = NULL;
+    buffer->start = 0;
+    buffer->length = 0;
+}
+
+// Читаем из дескриптора всё, что поместится в буфер
+// Возвращаем 0 если данные закончились, INPUT_FULL если буфер заполнен,
+// SOURCE_CLOSED если дескриптор закрыт, -1 при ошибке
+int readInput(struct InputBuffer *buffer, int fd) {
+    if (buffer->data == NULL) {
+        buffer->data = (char *)malloc(INPUT_BUFFER_SIZE);
+        if (buffer->data == NULL) {
+            fprintf(stderr, "Error: allocating input buffer\n");
+            return -1;
+        }
+    }
+    // Переносим необработанный хвост в начало
+    if (buffer->start > 0) {
+        memmove(buffer->data, buffer->data + buffer->start, buffer->length);
+        buffer->start = 0;
+    }
+    while (buffer->length < INPUT_BUFFER_SIZE) {
+        ssize_t count = read(fd, buffer->data + buffer->length, INPUT_BUFFER_SIZE - buffer->length);
+        if (count == 0) {
+            return SOURCE_CLOSED;
+        }
+        if (count == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                return 0;
+            perror("reading input");
+            return -1;
+        }
+        buffer->length += count;
+    }
+    return INPUT_FULL;
+}
+
+// Выделяем следующую полную строку без символов \r\n
+// Возвращаем 1 если строка найдена, 0 если строка ещё не пришла целиком
+int nextLine(struct InputBuffer *buffer, struct LineView *line) {
+    if (buffer->length == 0) {
+        return 0;
+    }
+    char *begin = buffer->data + buffer->start;
+    char *end = memchr(begin, '\n', buffer->length);
+    if (end == NULL) {
+        return 0;
+    }
+    size_t consumed = end - begin + 1;
+    line->data = begin;
+    line->length = end - begin;
+    if (line->length > 0 && begin[line->length - 1] == '\r') {
+        line->length--;
+    }
+    buffer->start += consumed;
+    buffer->length -= consumed;
+    return 1;
+}
+
+// Освобождаем буфер
+void destroyInputBuffer(struct InputBuffer *buffer) {
+    free(buffer->data);
+    initInputBuffer(buffer);
+}
@@ -0,0 +1,21 @@
+#ifndef INBUF_H
+    #include <stddef.h>
+    #define INPUT_BUFFER_SIZE 4096
+    #define INPUT_FULL 3
+    // Буфер входящих данных соединения, из которого по мере поступления выделяются строки
+    struct InputBuffer {
+        char *data;
+        size_t start;
+        size_t length;
+    };
+    // Строка, указывающая внутрь буфера, действительна до следующего чтения
+    struct LineView {
+        const char *data;
+        size_t length;
+    };
+    void initInputBuffer(struct InputBuffer *buffer);
+    int readInput(struct InputBuffer *buffer, int fd);
+    int nextLine(struct InputBuffer *buffer, struct LineView *line);
+    void destroyInputBuffer(struct InputBuffer *buffer);
+    #define INBUF_H
+#endif
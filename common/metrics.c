@@ -0,0 +1,90 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "metrics.h"
+
+__thread struct ThreadMetrics *threadMetrics = NULL;
+
+static struct MetricsSegment *segment = NULL;
+static char segmentName[METRICS_NAME_SIZE];
+
+// Имя сегмента сервера на порту port
+void getMetricsName(char *name, size_t size, const char *port) {
+    snprintf(name, size, "%s%s", METRICS_PREFIX, port);
+}
+
+// Создаём сегмент метрик, его читает sshtop
+// Сегмент под тем же именем (от упавшего сервера или от предыдущего процесса при передаче работы)
+// отвязываем: процесс, который ещё пишет в него, сохраняет своё отображение
+int openMetrics(const char *port) {
+    getMetricsName(segmentName, sizeof(segmentName), port);
+    shm_unlink(segmentName);
+    int fd = shm_open(segmentName, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("creating metrics segment");
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(struct MetricsSegment)) == -1) {
+        perror("resizing metrics segment");
+        close(fd);
+        shm_unlink(segmentName);
+        return -1;
+    }
+    struct MetricsSegment *mapping = mmap(NULL, sizeof(struct MetricsSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror("mapping metrics segment");
+        shm_unlink(segmentName);
+        return -1;
+    }
+    memset(mapping, 0, sizeof(struct MetricsSegment));
+    mapping->version = METRICS_VERSION;
+    mapping->pid = getpid();
+    mapping->startedAt = (int64_t)time(NULL);
+    atomic_init(&mapping->threadsCount, 0);
+    // Заголовок пишем последним: читатель не увидит сегмент наполовину заполненным
+    atomic_thread_fence(memory_order_release);
+    memcpy(mapping->magic, METRICS_MAGIC, sizeof(METRICS_MAGIC));
+    segment = mapping;
+    return 0;
+}
+
+// Выделяем вызывающему потоку слот в сегменте
+void registerMetricsThread(const char *name) {
+    if (segment == NULL || threadMetrics != NULL) {
+        return;
+    }
+    int index = atomic_fetch_add(&segment->threadsCount, 1);
+    if (index >= MAX_METRICS_THREADS) {
+        fprintf(stderr, "Error: no metrics slot for thread %s\n", name);
+        return;
+    }
+    struct ThreadMetrics *metrics = &segment->threads[index];
+    strncpy(metrics->name, name, METRICS_THREAD_NAME_SIZE - 1);
+    metrics->tid = gettid();
+    threadMetrics = metrics;
+}
+
+// Удаляем имя сегмента при завершении сервера
+// Отображение остаётся: потоки, которые ещё не остановились, продолжают в него писать
+// После передачи работы под именем уже сегмент нового процесса, его не трогаем
+void closeMetrics() {
+    if (segment == NULL) {
+        return;
+    }
+    int fd = shm_open(segmentName, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1) {
+        return;
+    }
+    pid_t pid = 0;
+    if (pread(fd, &pid, sizeof(pid), offsetof(struct MetricsSegment, pid)) == sizeof(pid) && pid == segment->pid) {
+        shm_unlink(segmentName);
+    }
+    close(fd);
+}
@@ -0,0 +1,89 @@
+#ifndef METRICS_H
+    #include <stdint.h>
+    #include <stdatomic.h>
+    #include <sys/types.h>
+
+    #define METRICS_MAGIC "SSHMETR"
+    #define METRICS_VERSION 3
+    #define METRICS_PREFIX "/sshserver-"    // Имя сегмента: префикс и порт сервера
+    #define METRICS_NAME_SIZE 64
+    #define MAX_METRICS_THREADS 64
+    #define METRICS_THREAD_NAME_SIZE 16
+    #define METRICS_CACHE_LINE 64
+
+    // Счётчики, только растут
+    #define METRIC_EVENTS 0             // Обработано событий
+    #define METRIC_ACCEPTED 1
+    #define METRIC_AUTH_SUCCESS 2
+    #define METRIC_AUTH_FAILURE 3       // Неверный логин или пароль
+    #define METRIC_SPAWNS 4             // Запущено оболочек
+    #define METRIC_TIMEOUTS 5
+    #define METRIC_BYTES_TO_PTY 6
+    #define METRIC_BYTES_TO_CLIENT 7
+    #define METRIC_RATE_LIMITED 8       // Соединений и проверок, отклонённых по частоте с адреса
+    #define METRIC_SHED_LOGINS 9        // Входов, отклонённых при перегрузке
+    #define METRIC_SHED_DEFERRED 10     // Событий массовой передачи, отложенных диспетчером при перегрузке
+    #define METRIC_COUNTERS 11
+
+    // Текущие значения
+    // Соединение может открыться в одном потоке, а закрыться в другом, поэтому
+    // значение отдельного потока бывает отрицательным, верна сумма по потокам
+    #define GAUGE_QUEUE_DEPTH 0         // Событий в очереди потока
+    #define GAUGE_SESSIONS 1            // Соединений с запущенной оболочкой
+    #define GAUGE_AUTHENTICATING 2      // Соединений до входа
+    #define GAUGE_QUEUE_DELAY 3         // Ожидание последней пачки событий в очереди рабочего потока, мкс
+    #define METRIC_GAUGES 4
+
+    // Значения одного потока, пишет только он сам
+    struct ThreadMetrics {
+        _Alignas(METRICS_CACHE_LINE) char name[METRICS_THREAD_NAME_SIZE];
+        pid_t tid;
+        atomic_ulong counters[METRIC_COUNTERS];
+        atomic_long gauges[METRIC_GAUGES];
+    };
+
+    // Сегмент разделяемой памяти: заголовок и слоты потоков
+    struct MetricsSegment {
+        char magic[8];
+        uint32_t version;
+        pid_t pid;
+        int64_t startedAt;
+        atomic_int threadsCount;
+        struct ThreadMetrics threads[MAX_METRICS_THREADS];
+    };
+
+    int openMetrics(const char *port);
+    void registerMetricsThread(const char *name);
+    void closeMetrics();
+    void getMetricsName(char *name, size_t size, const char *port);
+
+    // Слот потока, NULL если поток не зарегистрирован или сегмент не создан
+    extern __thread struct ThreadMetrics *threadMetrics;
+
+    // Обновляем значение своего потока: писатель один, атомарное сложение не нужно
+    static inline void addMetric(int metric, unsigned long value) {
+        struct ThreadMetrics *metrics = threadMetrics;
+        if (metrics != NULL) {
+            atomic_store_explicit(&metrics->counters[metric],
+                                  atomic_load_explicit(&metrics->counters[metric], memory_order_relaxed) + value,
+                                  memory_order_relaxed);
+        }
+    }
+
+    static inline void addGauge(int gauge, long delta) {
+        struct ThreadMetrics *metrics = threadMetrics;
+        if (metrics != NULL) {
+            atomic_store_explicit(&metrics->gauges[gauge],
+                                  atomic_load_explicit(&metrics->gauges[gauge], memory_order_relaxed) + delta,
+                                  memory_order_relaxed);
+        }
+    }
+
+    static inline void setGauge(int gauge, long value) {
+        struct ThreadMetrics *metrics = threadMetrics;
+        if (metrics != NULL) {
+            atomic_store_explicit(&metrics->gauges[gauge], value, memory_order_relaxed);
+        }
+    }
+    #define METRICS_H
+#endif
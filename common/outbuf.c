@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#include "outbuf.h"
+
+#define BEGIN_OUTPUT_SIZE 4096
+
+// Инициализируем пустой буфер
+void initOutputBuffer(struct OutputBuffer *buffer) {
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->start = 0;
+    buffer->length = 0;
+}
+
+// Увеличиваем буфер, данные переносятся в начало
+static int growOutput(struct OutputBuffer *buffer, size_t required) {
+    size_t size = buffer->size ? buffer->size : BEGIN_OUTPUT_SIZE;
+    while (size < required) {
+        size *= 2;
+    }
+    char *data = (char *)malloc(size);
+    if (data == NULL) {
+        fprintf(stderr, "Error: allocating output buffer\n");
+        return -1;
+    }
+    size_t first = buffer->length;
+    if (buffer->start + first > buffer->size) {
+        first = buffer->size - buffer->start;
+    }
+    if (buffer->length > 0) {
+        memcpy(data, buffer->data + buffer->start, first);
+        memcpy(data + first, buffer->data, buffer->length - first);
+    }
+    free(buffer->data);
+    buffer->data = data;
+    buffer->size = size;
+    buffer->start = 0;
+    return 0;
+}
+
+// Добавляем данные в конец буфера
+int appendOutput(struct OutputBuffer *buffer, const char *data, size_t length) {
+    // Пустой буфер ещё не выделен, делить на его размер нельзя
+    if (length == 0) {
+        return 0;
+    }
+    if (buffer->length + length > buffer->size && growOutput(buffer, buffer->length + length) == -1) {
+        return -1;
+    }
+    size_t end = (buffer->start + buffer->length) % buffer->size;
+    size_t first = length;
+    if (end + first > buffer->size) {
+        first = buffer->size - end;
+    }
+    memcpy(buffer->data + end, data, first);
+    memcpy(buffer->data, data + first, length - first);
+    buffer->length += length;
+    return 0;
+}
+
+// Записываем накопленные данные одним writev (кольцо даёт не больше двух кусков)
+// Возвращаем 0 если буфер опустел, 1 если дескриптор не принимает данные, -1 при ошибке
+int flushOutput(struct OutputBuffer *buffer, int fd) {
+    while (buffer->length > 0) {
+        struct iovec iov[2];
+        int iovcnt = 1;
+        iov[0].iov_base = buffer->data + buffer->start;
+        iov[0].iov_len = buffer->length;
+        if (buffer->start + buffer->length > buffer->size) {
+            iov[0].iov_len = buffer->size - buffer->start;
+            iov[1].iov_base = buffer->data;
+            iov[1].iov_len = buffer->length - iov[0].iov_len;
+            iovcnt = 2;
+        }
+        ssize_t count = writev(fd, iov, iovcnt);
+        if (count == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                return 1;
+            perror("flushing output buffer");
+            return -1;
+        }
+        buffer->start = (buffer->start + count) % buffer->size;
+        buffer->length -= count;
+    }
+    // Пустой буфер память не держит
+    destroyOutputBuffer(buffer);
+    return 0;
+}
+
+// Непрерывный кусок данных от начала буфера, для записи без копирования
+size_t peekOutput(struct OutputBuffer *buffer, char **data) {
+    *data = buffer->data + buffer->start;
+    if (buffer->start + buffer->length > buffer->size) {
+        return buffer->size - buffer->start;
+    }
+    return buffer->length;
+}
+
+// Отбрасываем записанные данные, пустой буфер освобождается
+void consumeOutput(struct OutputBuffer *buffer, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    buffer->start = (buffer->start + count) % buffer->size;
+    buffer->length -= count;
+    if (buffer->length == 0) {
+        destroyOutputBuffer(buffer);
+    }
+}
+
+// Освобождаем буфер
+void destroyOutputBuffer(struct OutputBuffer *buffer) {
+    free(buffer->data);
+    initOutputBuffer(buffer);
+}
@@ -0,0 +1,17 @@
+#ifndef OUTBUF_H
+    #include <stddef.h>
+    // Кольцевой буфер исходящих данных соединения, память выделяется только пока есть данные
+    struct OutputBuffer {
+        char *data;
+        size_t size;
+        size_t start;
+        size_t length;
+    };
+    void initOutputBuffer(struct OutputBuffer *buffer);
+    int appendOutput(struct OutputBuffer *buffer, const char *data, size_t length);
+    int flushOutput(struct OutputBuffer *buffer, int fd);
+    size_t peekOutput(struct OutputBuffer *buffer, char **data);
+    void consumeOutput(struct OutputBuffer *buffer, size_t count);
+    void destroyOutputBuffer(struct OutputBuffer *buffer);
+    #define OUTBUF_H
+#endif
@@ -0,0 +1,36 @@
+#include <time.h>
+
+#include "overload.h"
+
+unsigned int shedDelayMs = 0;
+
+// Рабочих потоков, у которых сейчас перегрузка
+atomic_int overloadedWorkers = 0;
+
+uint64_t getMonotonicNanoseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Учитываем задержку пачки в очереди рабочего потока, delay 0 - очередь опустела
+// Одна долгая пачка перегрузку не начинает, а пустая очередь сразу её заканчивает
+// Возвращаем 1, если состояние потока изменилось
+int reportQueueDelay(struct OverloadState *state, uint64_t delay) {
+    state->delay = delay == 0 ? 0 : (state->delay * (SHED_SMOOTHING - 1) + delay) / SHED_SMOOTHING;
+    if (shedDelayMs == 0) {
+        return 0;
+    }
+    uint64_t threshold = (uint64_t)shedDelayMs * 1000000;
+    if (!state->overloaded && state->delay > threshold) {
+        state->overloaded = 1;
+        atomic_fetch_add(&overloadedWorkers, 1);
+        return 1;
+    }
+    if (state->overloaded && state->delay < threshold / 2) {
+        state->overloaded = 0;
+        atomic_fetch_sub(&overloadedWorkers, 1);
+        return 1;
+    }
+    return 0;
+}
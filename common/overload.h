@@ -0,0 +1,29 @@
+#ifndef OVERLOAD_H
+    #include <stdint.h>
+    #include <stdatomic.h>
+
+    #define SHED_HOLD_MAX 1024              // Отложенных событий массовой передачи у диспетчера
+    #define SHED_HOLD_POLL_MS 1             // Пока события отложены, диспетчер проверяет очереди так часто
+    #define SHED_HOLD_LIMIT 50              // Событие откладывается не дольше стольких порогов
+    #define SHED_SMOOTHING 8                // Задержка сглаживается по стольким последним пачкам
+    #define SHED_BULK_BYTES 8192            // Вывод сессии сверх этого без ввода клиента - массовая передача
+
+    // Перегрузка по задержке в очередях рабочих потоков
+    // Начинается, когда сглаженная задержка превысила порог, кончается, когда она упала ниже половины
+    extern unsigned int shedDelayMs;    // Порог, 0 - перегрузка не отслеживается
+    extern atomic_int overloadedWorkers;
+
+    // Задержка очереди одного рабочего потока
+    struct OverloadState {
+        int overloaded;
+        uint64_t delay;                 // Сглаженная, нс
+    };
+
+    uint64_t getMonotonicNanoseconds(void);
+    int reportQueueDelay(struct OverloadState *state, uint64_t delay);
+
+    static inline int isOverloaded(void) {
+        return atomic_load_explicit(&overloadedWorkers, memory_order_relaxed) > 0;
+    }
+    #define OVERLOAD_H
+#endif
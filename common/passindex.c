@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "passindex.h"
+
+// FNV-1a: значение не зависит от платформы, индекс можно хранить в файле
+uint32_t hashLogin(const char *login, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)login[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Размер таблицы: степень двойки, заполненная не больше чем наполовину
+uint32_t getPassIndexSize(uint32_t count) {
+    uint32_t size = 16;
+    while (size < count * 2) {
+        size *= 2;
+    }
+    return size;
+}
+
+// Сравниваем логин пары с искомым по точной длине
+static int loginEquals(const struct PassPair *pair, const char *login, size_t length) {
+    return strnlen(pair->login, MAX_LOGIN_LEN) == length && memcmp(pair->login, login, length) == 0;
+}
+
+// Раскладываем пары по слотам таблицы, при повторе логина остаётся первая пара
+int fillPassIndexSlots(uint32_t *slots, uint32_t size, const struct PassPair *pairs, uint32_t count) {
+    if (size < count * 2 || (size & (size - 1)) != 0) {
+        fprintf(stderr, "Error: wrong password index size\n");
+        return -1;
+    }
+    memset(slots, 0, size * sizeof(uint32_t));
+    uint32_t mask = size - 1;
+    for (uint32_t i = 0; i < count; i++) {
+        size_t length = strnlen(pairs[i].login, MAX_LOGIN_LEN);
+        uint32_t slot = hashLogin(pairs[i].login, length) & mask;
+        while (slots[slot] != 0 && !loginEquals(&pairs[slots[slot] - 1], pairs[i].login, length)) {
+            slot = (slot + 1) & mask;
+        }
+        if (slots[slot] == 0) {
+            slots[slot] = i + 1;
+        }
+    }
+    return 0;
+}
+
+// Строим индекс по массиву пар
+int buildPassIndex(struct PassIndex *index, const struct PassPair *pairs, uint32_t count) {
+    uint32_t size = getPassIndexSize(count);
+    uint32_t *slots = (uint32_t *)malloc(size * sizeof(uint32_t));
+    if (slots == NULL) {
+        fprintf(stderr, "Error: allocating password index\n");
+        return -1;
+    }
+    if (fillPassIndexSlots(slots, size, pairs, count) == -1) {
+        free(slots);
+        return -1;
+    }
+    index->pairs = pairs;
+    index->count = count;
+    index->slots = slots;
+    index->mask = size - 1;
+    index->ownsSlots = 1;
+    return 0;
+}
+
+// Используем готовую таблицу слотов (например, из файла базы)
+int initPassIndex(struct PassIndex *index, const struct PassPair *pairs, uint32_t count, const uint32_t *slots, uint32_t size) {
+    if (size == 0 || (size & (size - 1)) != 0 || size <= count) {
+        fprintf(stderr, "Error: wrong password index size\n");
+        return -1;
+    }
+    index->pairs = pairs;
+    index->count = count;
+    index->slots = slots;
+    index->mask = size - 1;
+    index->ownsSlots = 0;
+    return 0;
+}
+
+// Ищем пару по логину
+const struct PassPair *findPassPair(const struct PassIndex *index, const char *login, size_t length) {
+    if (length > MAX_LOGIN_LEN || index->slots == NULL) {
+        return NULL;
+    }
+    uint32_t slot = hashLogin(login, length) & index->mask;
+    // Таблица из файла может быть повреждена: не выходим за массив пар и не зацикливаемся
+    for (uint32_t probes = 0; index->slots[slot] != 0 && probes <= index->mask; probes++) {
+        if (index->slots[slot] > index->count) {
+            return NULL;
+        }
+        const struct PassPair *pair = &index->pairs[index->slots[slot] - 1];
+        if (loginEquals(pair, login, length)) {
+            return pair;
+        }
+        slot = (slot + 1) & index->mask;
+    }
+    return NULL;
+}
+
+// Освобождаем таблицу индекса (сами пары индексу не принадлежат)
+void destroyPassIndex(struct PassIndex *index) {
+    if (index->ownsSlots) {
+        free((uint32_t *)index->slots);
+    }
+    index->slots = NULL;
+    index->count = 0;
+}
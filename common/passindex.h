@@ -0,0 +1,23 @@
+#ifndef PASSINDEX_H
+    #include <stddef.h>
+    #include <stdint.h>
+
+    #include "pass_pair.h"
+
+    // Хеш-индекс пар логин-пароль с открытой адресацией (линейное пробирование)
+    struct PassIndex {
+        const struct PassPair *pairs;
+        uint32_t count;
+        const uint32_t *slots;  // 0 - пустой слот, иначе номер пары + 1
+        uint32_t mask;
+        int ownsSlots;          // Таблица выделена индексом, а не лежит в файле
+    };
+    uint32_t hashLogin(const char *login, size_t length);
+    uint32_t getPassIndexSize(uint32_t count);
+    int buildPassIndex(struct PassIndex *index, const struct PassPair *pairs, uint32_t count);
+    int initPassIndex(struct PassIndex *index, const struct PassPair *pairs, uint32_t count, const uint32_t *slots, uint32_t size);
+    int fillPassIndexSlots(uint32_t *slots, uint32_t size, const struct PassPair *pairs, uint32_t count);
+    const struct PassPair *findPassPair(const struct PassIndex *index, const char *login, size_t length);
+    void destroyPassIndex(struct PassIndex *index);
+    #define PASSINDEX_H
+#endif
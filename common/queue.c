@@ -1,91 +1,166 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "queue.h"
 
-#define BEGIN_QUEUE_SIZE 128
+// Каждый слот кольца: номер последовательности и сам элемент
+#define SLOT_SEQUENCE(queue, pos) ((atomic_size_t *)((queue)->slots + ((pos) & (queue)->mask) * (queue)->slotSize))
+#define SLOT_DATA(queue, pos) ((queue)->slots + ((pos) & (queue)->mask) * (queue)->slotSize + sizeof(atomic_size_t))
 
 // Инициализируем очередь
 int initQueue(struct Queue *queue, size_t sizeOfElement) {
-    void **data = (void **)malloc(sizeof(void *) * BEGIN_QUEUE_SIZE);
-    if (data == NULL) {
+    return initQueueCapacity(queue, sizeOfElement, DEFAULT_QUEUE_CAPACITY);
+}
+
+// Инициализируем очередь заданной ёмкости (округляется до степени двойки)
+int initQueueCapacity(struct Queue *queue, size_t sizeOfElement, size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+        size *= 2;
+    }
+    size_t slotSize = sizeof(atomic_size_t) + sizeOfElement;
+    slotSize = (slotSize + sizeof(atomic_size_t) - 1) & ~(sizeof(atomic_size_t) - 1);
+    char *slots = NULL;
+    if (posix_memalign((void **)&slots, CACHE_LINE_SIZE, size * slotSize) != 0) {
         fprintf(stderr, "Error: initializing queue\n");
         return -1;
     }
-    memset(data, 0, sizeof(void *) * BEGIN_QUEUE_SIZE);
-    queue->data = data;
+    memset(slots, 0, size * slotSize);
+    queue->slots = slots;
+    queue->slotSize = slotSize;
+    queue->mask = size - 1;
     queue->sizeOfElement = sizeOfElement;
-    queue->maxSize = BEGIN_QUEUE_SIZE;
-    queue->head = 0;
-    queue->last = 0;
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(SLOT_SEQUENCE(queue, i), i);
+    }
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->futex, 0);
+    atomic_init(&queue->waiters, 0);
     return 0;
 }
 
 // Проверка на пустоту
 int isEmptyQueue(struct Queue *queue) {
-    if (queue->head == queue->last) {
+    if (atomic_load(&queue->tail) == atomic_load(&queue->head)) {
         return 1;
     }
     return 0;
 }
 
-// Добавляем элемент в очередь
-int pushQueue(struct Queue *queue, void *element) {
-    if (queue->last == queue->maxSize) {
-        queue->maxSize *= 2;
-        void **data = (void **)realloc(queue->data, queue->maxSize * sizeof(void *));
-        if (data == NULL) {
-            fprintf(stderr, "Error: increasing size of queue array\n");
+// Приблизительная длина очереди: позиции читаются не одновременно
+size_t getQueueLength(struct Queue *queue) {
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    return head > tail ? head - tail : 0;
+}
+
+// Занимаем слот и копируем в него элемент, -1 если очередь заполнена
+static int tryPush(struct Queue *queue, const void *element) {
+    size_t pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    for (;;) {
+        size_t sequence = atomic_load_explicit(SLOT_SEQUENCE(queue, pos), memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak(&queue->head, &pos, pos + 1)) {
+                break;
+            }
+        } else if (diff < 0) {
             return -1;
+        } else {
+            pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
         }
-        queue->data = data;
     }
-    void *newElement = (void *)malloc(queue->sizeOfElement);
-    if (newElement == NULL) {
-        fprintf(stderr, "Error: allocating memory for new element in queue\n");
+    memcpy(SLOT_DATA(queue, pos), element, queue->sizeOfElement);
+    atomic_store_explicit(SLOT_SEQUENCE(queue, pos), pos + 1, memory_order_release);
+    return 0;
+}
+
+// Забираем элемент из слота, -1 если очередь пуста
+static int tryPop(struct Queue *queue, void *element) {
+    size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    for (;;) {
+        size_t sequence = atomic_load_explicit(SLOT_SEQUENCE(queue, pos), memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak(&queue->tail, &pos, pos + 1)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        }
+    }
+    memcpy(element, SLOT_DATA(queue, pos), queue->sizeOfElement);
+    atomic_store_explicit(SLOT_SEQUENCE(queue, pos), pos + queue->mask + 1, memory_order_release);
+    return 0;
+}
+
+// Добавляем элемент в очередь, -1 если очередь заполнена
+int pushQueue(struct Queue *queue, void *element) {
+    if (tryPush(queue, element) == -1) {
         return -1;
     }
-    memcpy(newElement, element, queue->sizeOfElement);
-    queue->data[queue->last] = newElement;
-    queue->last += 1;
+    wakeQueue(queue, 1);
     return 0;
 }
 
-// Сдвигаем элементы в массиве в начало
-void moveElementsInQueue(struct Queue *queue) {
-    for (int i = 0; i < (queue->last-queue->head); i++) {
-        queue->data[i] = queue->data[i+queue->head];
-        queue->data[i+queue->head] = NULL;
+// Добавляем несколько элементов подряд, возвращаем количество добавленных
+int pushQueueBatch(struct Queue *queue, void *elements, int count) {
+    int pushed = 0;
+    while (pushed < count && tryPush(queue, (char *)elements + pushed * queue->sizeOfElement) == 0) {
+        pushed++;
     }
-    queue->last = queue->last-queue->head;
-    queue->head = 0;
+    if (pushed > 0) {
+        wakeQueue(queue, pushed);
+    }
+    return pushed;
 }
 
-// Достаём элемент из очереди
+// Достаём элемент из очереди, -1 если очередь пуста
 int popQueue(struct Queue *queue, void *element) {
-    if (queue->head == queue->last) {
-        fprintf(stderr, "Error: queue is empty\n");
+    if (element == NULL) {
+        fprintf(stderr, "Error: queue get pointer to null");
         return -1;
     }
-    if (queue->data[queue->head] == NULL) {
-        fprintf(stderr, "Error: queue element is null");
-        return -1;
+    return tryPop(queue, element);
+}
+
+// Достаём до count элементов, возвращаем количество извлечённых
+int popQueueBatch(struct Queue *queue, void *elements, int count) {
+    int popped = 0;
+    while (popped < count && tryPop(queue, (char *)elements + popped * queue->sizeOfElement) == 0) {
+        popped++;
     }
-    if (element == NULL) {
-        fprintf(stderr, "Error: queue get pointer to null");
+    return popped;
+}
+
+// Засыпаем на futex, пока очередь пуста
+void waitQueue(struct Queue *queue) {
+    unsigned int sequence = atomic_load(&queue->futex);
+    atomic_fetch_add(&queue->waiters, 1);
+    if (isEmptyQueue(queue)) {
+        syscall(SYS_futex, &queue->futex, FUTEX_WAIT_PRIVATE, sequence, NULL, NULL, 0);
     }
-    memcpy(element, queue->data[queue->head], queue->sizeOfElement);
-    free(queue->data[queue->head]);
-    queue->head += 1;
-    // Если 1/4 в начале очереди пустует, нужно сдвинуть элементы
-    if (queue->head >= (queue->maxSize / 4)) {
-        moveElementsInQueue(queue);
+    atomic_fetch_sub(&queue->waiters, 1);
+}
+
+// Будим до count ожидающих потоков, системный вызов только если кто-то спит
+void wakeQueue(struct Queue *queue, int count) {
+    atomic_fetch_add(&queue->futex, 1);
+    if (atomic_load(&queue->waiters) > 0) {
+        syscall(SYS_futex, &queue->futex, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
     }
-    return 0;
 }
 
 // Уничтожить очередь
 void destroyQueue(struct Queue *queue) {
-    free(queue->data);
+    free(queue->slots);
+    queue->slots = NULL;
 }
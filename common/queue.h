@@ -1,17 +1,30 @@
 #ifndef QUEUE_H
     #include <stdlib.h>
+    #include <stdint.h>
+    #include <stdatomic.h>
+    #define CACHE_LINE_SIZE 64
+    #define DEFAULT_QUEUE_CAPACITY 4096
+    // Ограниченная lock-free очередь (MPMC), элементы хранятся прямо в кольце
     struct Queue {
-        void **data;
-        int head;
-        int last;
-        int maxSize;
+        _Alignas(CACHE_LINE_SIZE) atomic_size_t head;   // Позиция записи
+        _Alignas(CACHE_LINE_SIZE) atomic_size_t tail;   // Позиция чтения
+        _Alignas(CACHE_LINE_SIZE) atomic_uint futex;    // Счётчик для пробуждения ожидающих
+        atomic_int waiters;
+        _Alignas(CACHE_LINE_SIZE) char *slots;
+        size_t slotSize;
+        size_t mask;
         size_t sizeOfElement;
     };
     int initQueue(struct Queue *queue, size_t sizeOfElement);
+    int initQueueCapacity(struct Queue *queue, size_t sizeOfElement, size_t capacity);
     int isEmptyQueue(struct Queue *queue);
+    size_t getQueueLength(struct Queue *queue);
     int pushQueue(struct Queue *queue, void *element);
-    void moveElementsInQueue(struct Queue *queue);
+    int pushQueueBatch(struct Queue *queue, void *elements, int count);
     int popQueue(struct Queue *queue, void *element);
+    int popQueueBatch(struct Queue *queue, void *elements, int count);
+    void waitQueue(struct Queue *queue);
+    void wakeQueue(struct Queue *queue, int count);
     void destroyQueue(struct Queue *queue);
     #define QUEUE_H
 #endif
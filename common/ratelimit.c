@@ -0,0 +1,161 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/random.h>
+
+#include "ratelimit.h"
+
+static struct RateSet *sets = NULL;
+static size_t setMask = 0;
+static struct RateLimit limits[RATE_KINDS];
+static uint64_t seed = 0;
+static struct timespec startedAt;
+
+// Миллисекунды от запуска, 0 не бывает: им отмечены свободные записи
+// Счётчик переполняется через 49 дней, разность двух отметок остаётся верной
+static uint32_t getMilliseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    uint64_t milliseconds = (uint64_t)(now.tv_sec - startedAt.tv_sec) * 1000
+                            + (now.tv_nsec - startedAt.tv_nsec) / 1000000;
+    uint32_t result = (uint32_t)milliseconds;
+    return result != 0 ? result : 1;
+}
+
+// Таблица и лимиты корзин, entries округляется вверх до степени двойки
+int initRateLimiter(size_t entries, const struct RateLimit *settings) {
+    size_t count = 1;
+    while (count * RATE_WAYS < entries) {
+        count *= 2;
+    }
+    sets = (struct RateSet *)aligned_alloc(_Alignof(struct RateSet), count * sizeof(struct RateSet));
+    if (sets == NULL) {
+        fprintf(stderr, "Error: allocating rate limit table\n");
+        return -1;
+    }
+    memset(sets, 0, count * sizeof(struct RateSet));
+    for (size_t i = 0; i < count; i++) {
+        atomic_flag_clear(&sets[i].lock);
+    }
+    setMask = count - 1;
+    for (int kind = 0; kind < RATE_KINDS; kind++) {
+        limits[kind] = settings[kind];
+        if (limits[kind].burst == 0) {
+            limits[kind].burst = limits[kind].rate;
+        }
+        // Полная корзина должна поместиться в счётчик
+        if (limits[kind].burst > UINT32_MAX / RATE_SCALE) {
+            limits[kind].burst = UINT32_MAX / RATE_SCALE;
+        }
+    }
+    // Случайная соль хеша: клиент не может подобрать адреса, вытесняющие чужие записи одного набора
+    if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) != sizeof(seed)) {
+        seed = (uint64_t)time(NULL) * 0x9E3779B97F4A7C15ULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &startedAt);
+    return 0;
+}
+
+int isRateLimited(int kind) {
+    return sets != NULL && limits[kind].rate > 0;
+}
+
+// Ключ по адресу клиента
+// Один хост IPv6 обычно владеет целой сетью /64, поэтому ограничиваем сеть, а не адрес
+void getRateKey(const struct sockaddr *addr, struct RateKey *key) {
+    memset(key, 0, sizeof(struct RateKey));
+    if (addr->sa_family == AF_INET) {
+        const struct sockaddr_in *ipv4 = (const struct sockaddr_in *)addr;
+        key->address[10] = 0xff;
+        key->address[11] = 0xff;
+        memcpy(key->address + 12, &ipv4->sin_addr, 4);
+        key->family = AF_INET;
+    } else if (addr->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *ipv6 = (const struct sockaddr_in6 *)addr;
+        memcpy(key->address, &ipv6->sin6_addr, 16);
+        // Адрес IPv4, принятый сокетом IPv6, ограничиваем целиком
+        if (!IN6_IS_ADDR_V4MAPPED(&ipv6->sin6_addr)) {
+            memset(key->address + 8, 0, 8);
+        }
+        key->family = AF_INET6;
+    }
+}
+
+// Ключ для сокета, принятого без адреса (io_uring, передача от предыдущего процесса)
+void getPeerRateKey(int fd, struct RateKey *key) {
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    if (getpeername(fd, (struct sockaddr *)&addr, &addrlen) == -1) {
+        memset(key, 0, sizeof(struct RateKey));
+        return;
+    }
+    getRateKey((struct sockaddr *)&addr, key);
+}
+
+static size_t hashAddress(const unsigned char *address) {
+    uint64_t words[2];
+    memcpy(words, address, sizeof(words));
+    uint64_t hash = (seed ^ words[0]) * 0x9E3779B97F4A7C15ULL;
+    hash = (hash ^ (hash >> 29) ^ words[1]) * 0xBF58476D1CE4E5B9ULL;
+    return (size_t)(hash ^ (hash >> 32));
+}
+
+// Запись адреса в наборе: найденная, свободная или дольше всех не использовавшаяся
+// Вытесненный адрес начнёт с полными корзинами, как новый
+static struct RateEntry *findEntry(struct RateSet *set, const unsigned char *address, uint32_t now) {
+    struct RateEntry *victim = &set->entries[0];
+    for (int i = 0; i < RATE_WAYS; i++) {
+        struct RateEntry *entry = &set->entries[i];
+        if (entry->updatedAt != 0 && memcmp(entry->address, address, 16) == 0) {
+            return entry;
+        }
+        if (victim->updatedAt != 0 && (entry->updatedAt == 0 || now - entry->updatedAt > now - victim->updatedAt)) {
+            victim = entry;
+        }
+    }
+    memcpy(victim->address, address, 16);
+    for (int kind = 0; kind < RATE_KINDS; kind++) {
+        victim->tokens[kind] = limits[kind].burst * RATE_SCALE;
+    }
+    victim->updatedAt = now;
+    return victim;
+}
+
+// Пополняем корзины записи за прошедшее время
+static void refillEntry(struct RateEntry *entry, uint32_t now) {
+    uint64_t elapsed = now - entry->updatedAt;
+    for (int kind = 0; kind < RATE_KINDS; kind++) {
+        uint64_t full = (uint64_t)limits[kind].burst * RATE_SCALE;
+        uint64_t tokens = entry->tokens[kind] + elapsed * limits[kind].rate * RATE_SCALE / 1000;
+        entry->tokens[kind] = (uint32_t)(tokens < full ? tokens : full);
+    }
+    entry->updatedAt = now;
+}
+
+// Забираем жетон корзины kind адреса key, 0 если корзина пуста
+// Набор блокируется на время нескольких сравнений, потоки разных наборов друг другу не мешают
+int takeRateToken(const struct RateKey *key, int kind) {
+    if (!isRateLimited(kind) || key->family == 0) {
+        return 1;
+    }
+    struct RateSet *set = &sets[hashAddress(key->address) & setMask];
+    uint32_t now = getMilliseconds();
+    while (atomic_flag_test_and_set_explicit(&set->lock, memory_order_acquire)) {
+    }
+    struct RateEntry *entry = findEntry(set, key->address, now);
+    refillEntry(entry, now);
+    int allowed = entry->tokens[kind] >= RATE_SCALE;
+    if (allowed) {
+        entry->tokens[kind] -= RATE_SCALE;
+    }
+    atomic_flag_clear_explicit(&set->lock, memory_order_release);
+    return allowed;
+}
+
+void destroyRateLimiter(void) {
+    free(sets);
+    sets = NULL;
+}
@@ -0,0 +1,48 @@
+#ifndef RATELIMIT_H
+    #include <stdint.h>
+    #include <stddef.h>
+    #include <stdatomic.h>
+    #include <sys/socket.h>
+
+    #define RATE_TABLE_SIZE 16384           // Адресов в таблице по умолчанию
+    #define RATE_WAYS 4                     // Адресов в одном наборе таблицы
+    #define RATE_SCALE 1000                 // Доли жетона в счётчике корзины
+
+    // Корзины адреса
+    #define RATE_CONNECT 0                  // Новые соединения
+    #define RATE_AUTH 1                     // Проверки логина и пароля
+    #define RATE_KINDS 2
+
+    // Адрес клиента: IPv4 хранится как ::ffff:a.b.c.d, у IPv6 - только префикс /64
+    // family 0 - адрес неизвестен, такие клиенты не ограничиваются
+    struct RateKey {
+        unsigned char address[16];
+        int family;
+    };
+
+    // Жетонов в секунду и размер корзины, rate 0 - без ограничения
+    struct RateLimit {
+        unsigned int rate;
+        unsigned int burst;
+    };
+
+    struct RateEntry {
+        unsigned char address[16];
+        uint32_t tokens[RATE_KINDS];        // В долях RATE_SCALE
+        uint32_t updatedAt;                 // Миллисекунды от запуска, 0 - запись свободна
+    };
+
+    // Набор таблицы занимает две строки кэша, адрес ищется только в своём наборе
+    struct RateSet {
+        _Alignas(128) atomic_flag lock;
+        struct RateEntry entries[RATE_WAYS];
+    };
+
+    int initRateLimiter(size_t entries, const struct RateLimit *limits);
+    int isRateLimited(int kind);
+    void getRateKey(const struct sockaddr *addr, struct RateKey *key);
+    void getPeerRateKey(int fd, struct RateKey *key);
+    int takeRateToken(const struct RateKey *key, int kind);
+    void destroyRateLimiter(void);
+    #define RATELIMIT_H
+#endif
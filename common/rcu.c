@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "rcu.h"
+
+// Эпоха писателя и эпохи входа читателей (0 - поток вне критической секции)
+static atomic_ulong globalEpoch = 1;
+static atomic_ulong readerEpochs[MAX_RCU_THREADS];
+static atomic_int slotsUsed[MAX_RCU_THREADS];
+// Слотов, которые когда-либо выдавались: дальше писатель не смотрит
+static atomic_int readersCount = 0;
+
+// Читатели, которым не хватило слота, держат блокировку на чтение, писатель ждёт их на записи
+static pthread_rwlock_t overflowLock = PTHREAD_RWLOCK_INITIALIZER;
+static atomic_int overflowReported = 0;
+
+// Слот освобождается при завершении потока: значение ключа - номер слота + 1
+static pthread_key_t slotKey;
+static pthread_once_t slotKeyOnce = PTHREAD_ONCE_INIT;
+
+// Слот читателя выделяется потоку при первом входе, -1 - слота нет
+static __thread int readerSlot = -1;
+
+static void releaseSlot(void *value) {
+    int slot = (int)(intptr_t)value - 1;
+    atomic_store(&readerEpochs[slot], 0);
+    atomic_store(&slotsUsed[slot], 0);
+}
+
+static void createSlotKey(void) {
+    if (pthread_key_create(&slotKey, releaseSlot) != 0) {
+        fprintf(stderr, "Error: creating rcu slot key\n");
+    }
+}
+
+// Занимаем свободный слот, -1 если все заняты
+static int acquireSlot(void) {
+    pthread_once(&slotKeyOnce, createSlotKey);
+    for (int slot = 0; slot < MAX_RCU_THREADS; slot++) {
+        int used = 0;
+        if (atomic_load_explicit(&slotsUsed[slot], memory_order_relaxed) == 0
+            && atomic_compare_exchange_strong(&slotsUsed[slot], &used, 1)) {
+            if (pthread_setspecific(slotKey, (void *)(intptr_t)(slot + 1)) != 0) {
+                atomic_store(&slotsUsed[slot], 0);
+                return -1;
+            }
+            int count = atomic_load(&readersCount);
+            while (slot >= count && !atomic_compare_exchange_weak(&readersCount, &count, slot + 1)) {
+            }
+            return slot;
+        }
+    }
+    return -1;
+}
+
+// Входим в критическую секцию чтения
+void rcuReadLock(void) {
+    if (readerSlot == -1) {
+        readerSlot = acquireSlot();
+        // Общий слот не годится: писатель не отличит вышедшего читателя от оставшегося
+        if (readerSlot == -1) {
+            if (atomic_exchange(&overflowReported, 1) == 0) {
+                fprintf(stderr, "Error: too many rcu readers, falling back to a lock\n");
+            }
+            pthread_rwlock_rdlock(&overflowLock);
+            return;
+        }
+    }
+    atomic_store(&readerEpochs[readerSlot], atomic_load(&globalEpoch));
+}
+
+// Выходим из критической секции чтения
+void rcuReadUnlock(void) {
+    if (readerSlot == -1) {
+        pthread_rwlock_unlock(&overflowLock);
+        return;
+    }
+    atomic_store(&readerEpochs[readerSlot], 0);
+}
+
+// Ждём выхода всех читателей, начавших чтение до вызова
+// Вызывается после публикации нового указателя и до освобождения старого
+void rcuSynchronize(void) {
+    unsigned long epoch = atomic_fetch_add(&globalEpoch, 1) + 1;
+    int count = atomic_load(&readersCount);
+    for (int i = 0; i < count; i++) {
+        for (;;) {
+            unsigned long readerEpoch = atomic_load(&readerEpochs[i]);
+            if (readerEpoch == 0 || readerEpoch >= epoch) {
+                break;
+            }
+            sched_yield();
+        }
+    }
+    pthread_rwlock_wrlock(&overflowLock);
+    pthread_rwlock_unlock(&overflowLock);
+}
@@ -0,0 +1,10 @@
+#ifndef RCU_H
+    #define MAX_RCU_THREADS 1024
+    // Упрощённый RCU: читатели отмечают эпоху входа, писатель после замены указателя
+    // ждёт, пока все читатели, вошедшие до замены, выйдут из критической секции
+    // Слот потока освобождается при его завершении, потоки сверх MAX_RCU_THREADS читают под блокировкой
+    void rcuReadLock(void);
+    void rcuReadUnlock(void);
+    void rcuSynchronize(void);
+    #define RCU_H
+#endif
@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "relay.h"
+#include "common.h"
+
+#define SPLICE_CHUNK_SIZE 65536
+
+// Буфер чтения сжимаемого вывода, один на поток
+static __thread char relayBuffer[SPLICE_CHUNK_SIZE];
+
+// splice включён, пока ядро его поддерживает для наших дескрипторов
+atomic_int spliceEnabled = 1;
+
+// Инициализируем направление без канала
+void initRelay(struct Relay *relay) {
+    relay->pending = 0;
+    relay->received = 0;
+    relay->pipefd[0] = -1;
+    relay->pipefd[1] = -1;
+    relay->coalescer = NULL;
+    initAuditTag(&relay->audit);
+    initOutputBuffer(&relay->buffer);
+}
+
+// Создаём канал сессии для splice
+int openRelayPipe(struct Relay *relay) {
+    if (!atomic_load(&spliceEnabled)) {
+        return 0;
+    }
+    if (pipe2(relay->pipefd, O_NONBLOCK | O_CLOEXEC) == -1) {
+        perror("creating relay pipe");
+        relay->pipefd[0] = -1;
+        relay->pipefd[1] = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// Записываем получателю данные, накопленные в канале
+// Возвращаем 0 если канал пуст, 1 если получатель не принимает данные, -1 при ошибке
+static int flushRelay(struct Relay *relay, int dest) {
+    while (relay->pending > 0) {
+        ssize_t count = splice(relay->pipefd[0], NULL, dest, NULL, relay->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (count > 0) {
+            relay->pending -= count;
+        } else if (count == -1 && errno == EINTR) {
+            continue;
+        } else if (count == -1 && errno == EAGAIN) {
+            return 1;
+        } else {
+            perror("splicing message to fd");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Перекачиваем данные из source в dest
+// Через канал сессии с помощью splice, если он недоступен - копированием через буфер
+// Пока dest не принимает данные, из source не читаем: они ждут в канале или буфере
+// Возвращаем 0, если данные закончились, SOURCE_CLOSED если source закрыт,
+// DEST_BLOCKED если dest не принял всё, -1 при ошибке
+int relayMessage(struct Relay *relay, int dest, int source) {
+    if (relay->pending == 0 && (relay->pipefd[0] == -1 || !atomic_load_explicit(&spliceEnabled, memory_order_relaxed))) {
+        return sendMessage(dest, source, &relay->buffer, &relay->received, &relay->audit);
+    }
+    // Сначала то, что было записано в буфер раньше (например, сообщения аутентификации)
+    int status = flushOutput(&relay->buffer, dest);
+    if (status != 0) {
+        return status == 1 ? DEST_BLOCKED : -1;
+    }
+    for (;;) {
+        status = flushRelay(relay, dest);
+        if (status != 0) {
+            return status == 1 ? DEST_BLOCKED : -1;
+        }
+        ssize_t count = splice(source, NULL, relay->pipefd[1], NULL, SPLICE_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (count > 0) {
+            relay->pending = count;
+            relay->received += count;
+            coalesceChunk(relay->coalescer, dest, (size_t)count);
+            continue;
+        }
+        if (count == 0) {
+            return SOURCE_CLOSED;
+        }
+        switch (errno) {
+            case EAGAIN:
+                return 0;
+            case EINTR:
+                continue;
+            case EIO:
+                // Терминал закрыт с другой стороны
+                return SOURCE_CLOSED;
+            case EINVAL:
+            case ENOSYS:
+                // Ядро не умеет splice для этого типа дескрипторов
+                fprintf(stderr, "splice isn't supported, falling back to copying\n");
+                atomic_store(&spliceEnabled, 0);
+                return sendMessage(dest, source, &relay->buffer, &relay->received, &relay->audit);
+            default:
+                perror("splicing message from fd");
+                return -1;
+        }
+    }
+}
+
+// Передаём данные из source в dest со сжатием, прочитанное сжимается сразу
+// Поток сжатия сбрасывается, когда source опустел: эхо ввода уходит без задержки,
+// а непрерывный вывод сжимается большими блоками
+// Возвращаемые значения как у relayMessage
+int relayCompressed(struct Relay *relay, struct Compressor *compressor, int dest, int source) {
+    for (;;) {
+        int status = flushOutput(&relay->buffer, dest);
+        if (status != 0) {
+            return status == 1 ? DEST_BLOCKED : -1;
+        }
+        ssize_t count = read(source, relayBuffer, SPLICE_CHUNK_SIZE);
+        if (count > 0) {
+            relay->received += count;
+            auditData(&relay->audit, relayBuffer, (size_t)count);
+            coalesceChunk(relay->coalescer, dest, (size_t)count);
+            if (compressData(compressor, relayBuffer, (size_t)count, 0, &relay->buffer) == -1) {
+                return -1;
+            }
+            continue;
+        }
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        // Терминал закрыт с другой стороны: дописываем то, что успели сжать
+        int closed = count == 0 || errno == EIO;
+        if (!closed && errno != EAGAIN) {
+            perror("reading message from fd");
+            return -1;
+        }
+        if (compressData(compressor, NULL, 0, 1, &relay->buffer) == -1) {
+            return -1;
+        }
+        status = flushOutput(&relay->buffer, dest);
+        if (closed) {
+            return SOURCE_CLOSED;
+        }
+        if (status == -1) {
+            return -1;
+        }
+        return status == 1 ? DEST_BLOCKED : 0;
+    }
+}
+
+// Закрываем канал сессии и освобождаем буфер
+void destroyRelay(struct Relay *relay) {
+    destroyOutputBuffer(&relay->buffer);
+    if (relay->pipefd[0] != -1) {
+        close(relay->pipefd[0]);
+        close(relay->pipefd[1]);
+    }
+    relay->pipefd[0] = -1;
+    relay->pipefd[1] = -1;
+    relay->pending = 0;
+}
@@ -0,0 +1,26 @@
+#ifndef RELAY_H
+    #include <stddef.h>
+    #include <stdatomic.h>
+
+    #include "outbuf.h"
+    #include "compress.h"
+    #include "coalesce.h"
+    #include "audit.h"
+    // Направление передачи данных сессии: канал для splice() без копирования в пространство пользователя
+    // и буфер для данных, которые получатель ещё не принял
+    struct Relay {
+        int pipefd[2];
+        size_t pending;     // Байт в канале, ещё не записанных получателю
+        size_t received;    // Прочитано из источника за всё время
+        struct OutputBuffer buffer;
+        struct Coalescer *coalescer;    // Пробка получателя-сокета, NULL для записи в pty
+        struct AuditTag audit;          // Запись прочитанного в журнал аудита
+    };
+    extern atomic_int spliceEnabled;
+    void initRelay(struct Relay *relay);
+    int openRelayPipe(struct Relay *relay);
+    int relayMessage(struct Relay *relay, int dest, int source);
+    int relayCompressed(struct Relay *relay, struct Compressor *compressor, int dest, int source);
+    void destroyRelay(struct Relay *relay);
+    #define RELAY_H
+#endif
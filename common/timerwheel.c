@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "timerwheel.h"
+
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+
+// Грубые часы: обновляются раз в тик, чтение не требует системного вызова
+static atomic_long coarseNow = 0;
+
+// Обновляем грубые часы (монотонные секунды)
+time_t updateCoarseTime(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    atomic_store_explicit(&coarseNow, now.tv_sec, memory_order_relaxed);
+    return now.tv_sec;
+}
+
+// Текущее значение грубых часов
+time_t getCoarseTime(void) {
+    time_t now = atomic_load_explicit(&coarseNow, memory_order_relaxed);
+    if (now == 0) {
+        now = updateCoarseTime();
+    }
+    return now;
+}
+
+// Узел не стоит ни в одном списке
+void initTimerNode(struct TimerNode *node) {
+    node->next = NULL;
+    node->prev = NULL;
+    node->expires = 0;
+}
+
+// Проверяем, запланирован ли таймер
+int isTimerScheduled(struct TimerNode *node) {
+    return node->next != NULL;
+}
+
+// Инициализируем колесо, каждый слот - пустой кольцевой список
+int initTimerWheel(struct TimerWheel *wheel, time_t now) {
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        for (int i = 0; i < WHEEL_SIZE; i++) {
+            wheel->slots[level][i].next = &wheel->slots[level][i];
+            wheel->slots[level][i].prev = &wheel->slots[level][i];
+        }
+    }
+    wheel->current = now;
+    wheel->count = 0;
+    if (pthread_mutex_init(&wheel->mutex, NULL) != 0) {
+        fprintf(stderr, "Error: initializing timer wheel mutex\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void linkNode(struct TimerNode *head, struct TimerNode *node) {
+    node->next = head;
+    node->prev = head->prev;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+static void unlinkNode(struct TimerNode *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = NULL;
+    node->prev = NULL;
+}
+
+// Кладём узел в слот по времени срабатывания
+// Отсчёт от первой ещё не обработанной секунды, просроченные таймеры сработают в ней
+static void placeNode(struct TimerWheel *wheel, struct TimerNode *node) {
+    time_t base = wheel->current + 1;
+    time_t expires = node->expires < base ? base : node->expires;
+    time_t blocks = (expires >> WHEEL_BITS) - (base >> WHEEL_BITS);
+    struct TimerNode *head;
+    if (expires - base < WHEEL_SIZE) {
+        head = &wheel->slots[0][expires & WHEEL_MASK];
+    } else if (blocks < WHEEL_SIZE) {
+        head = &wheel->slots[1][(expires >> WHEEL_BITS) & WHEEL_MASK];
+    } else {
+        // Дальше горизонта колеса: ставим в последний блок, при переносе узел займёт своё место
+        head = &wheel->slots[1][((base >> WHEEL_BITS) + WHEEL_MASK) & WHEEL_MASK];
+    }
+    linkNode(head, node);
+}
+
+// Планируем (или переносим) срабатывание таймера
+void scheduleTimer(struct TimerWheel *wheel, struct TimerNode *node, time_t expires) {
+    pthread_mutex_lock(&wheel->mutex);
+    if (isTimerScheduled(node)) {
+        unlinkNode(node);
+        wheel->count--;
+    }
+    node->expires = expires;
+    placeNode(wheel, node);
+    wheel->count++;
+    pthread_mutex_unlock(&wheel->mutex);
+}
+
+// Отменяем таймер
+void cancelTimer(struct TimerWheel *wheel, struct TimerNode *node) {
+    pthread_mutex_lock(&wheel->mutex);
+    if (isTimerScheduled(node)) {
+        unlinkNode(node);
+        wheel->count--;
+    }
+    pthread_mutex_unlock(&wheel->mutex);
+}
+
+// Прокручиваем колесо до секунды now, для сработавших таймеров вызываем callback
+// callback вызывается под блокировкой колеса и не должен менять таймеры
+// Возвращаем количество сработавших таймеров
+int advanceTimerWheel(struct TimerWheel *wheel, time_t now, void (*callback)(struct TimerNode *, void *), void *arg) {
+    int fired = 0;
+    pthread_mutex_lock(&wheel->mutex);
+    while (wheel->current < now) {
+        time_t next = wheel->current + 1;
+        // Начинается новый блок - переносим его таймеры со второго уровня на первый
+        if ((next & WHEEL_MASK) == 0) {
+            struct TimerNode *head = &wheel->slots[1][(next >> WHEEL_BITS) & WHEEL_MASK];
+            while (head->next != head) {
+                struct TimerNode *node = head->next;
+                unlinkNode(node);
+                placeNode(wheel, node);
+            }
+        }
+        wheel->current = next;
+        struct TimerNode *head = &wheel->slots[0][wheel->current & WHEEL_MASK];
+        while (head->next != head) {
+            struct TimerNode *node = head->next;
+            unlinkNode(node);
+            wheel->count--;
+            fired++;
+            callback(node, arg);
+        }
+    }
+    pthread_mutex_unlock(&wheel->mutex);
+    return fired;
+}
+
+// Уничтожаем колесо
+void destroyTimerWheel(struct TimerWheel *wheel) {
+    pthread_mutex_destroy(&wheel->mutex);
+}
@@ -0,0 +1,35 @@
+#ifndef TIMERWHEEL_H
+    #include <time.h>
+    #include <pthread.h>
+
+    #define WHEEL_BITS 8
+    #define WHEEL_SIZE (1 << WHEEL_BITS)
+    #define WHEEL_LEVELS 2
+
+    // Узел таймера, встраивается в структуру владельца
+    struct TimerNode {
+        struct TimerNode *next;
+        struct TimerNode *prev;
+        time_t expires;
+    };
+
+    // Двухуровневое колесо таймеров с шагом в секунду:
+    // первый уровень - ближайшие 256 секунд, второй - блоки по 256 секунд
+    struct TimerWheel {
+        struct TimerNode slots[WHEEL_LEVELS][WHEEL_SIZE];
+        time_t current;
+        int count;
+        pthread_mutex_t mutex;
+    };
+
+    time_t updateCoarseTime(void);
+    time_t getCoarseTime(void);
+    void initTimerNode(struct TimerNode *node);
+    int isTimerScheduled(struct TimerNode *node);
+    int initTimerWheel(struct TimerWheel *wheel, time_t now);
+    void scheduleTimer(struct TimerWheel *wheel, struct TimerNode *node, time_t expires);
+    void cancelTimer(struct TimerWheel *wheel, struct TimerNode *node);
+    int advanceTimerWheel(struct TimerWheel *wheel, time_t now, void (*callback)(struct TimerNode *, void *), void *arg);
+    void destroyTimerWheel(struct TimerWheel *wheel);
+    #define TIMERWHEEL_H
+#endif
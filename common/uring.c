@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+#include "common.h"
+
+// Создаём кольца io_uring и регистрируем кольцо буферов для приёма,
+// -1 если ядро не поддерживает нужные возможности
+int initUring(struct Uring *uring, unsigned int entries) {
+    memset(uring, 0, sizeof(struct Uring));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // Кольцо принадлежит одному потоку реактора, завершения разбираются только в io_uring_enter.
+    // При COOP_TASKRUN ядро отмечает поток реактора флагом TIF_NOTIFY_SIGNAL, и запись в ptm,
+    // повторяемая в task_work, видит его как сигнал и завершается с EINTR
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    uring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (uring->fd == -1 && errno == EINVAL) {
+        // DEFER_TASKRUN появился в 6.1
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+        uring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    }
+    if (uring->fd == -1 && errno == EINVAL) {
+        memset(&params, 0, sizeof(params));
+        uring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    }
+    if (uring->fd == -1) {
+        perror("creating io_uring");
+        return -1;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        fprintf(stderr, "Error: io_uring is too old\n");
+        close(uring->fd);
+        return -1;
+    }
+
+    uring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    uring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (uring->cqRingSize > uring->sqRingSize) {
+        uring->sqRingSize = uring->cqRingSize;
+    }
+    uring->sqRing = mmap(NULL, uring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         uring->fd, IORING_OFF_SQ_RING);
+    if (uring->sqRing == MAP_FAILED) {
+        perror("mapping io_uring rings");
+        close(uring->fd);
+        return -1;
+    }
+    // Кольца отправки и завершения в одном отображении
+    uring->cqRing = uring->sqRing;
+    uring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(NULL, uring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       uring->fd, IORING_OFF_SQES);
+    if (uring->sqes == MAP_FAILED) {
+        perror("mapping io_uring entries");
+        munmap(uring->sqRing, uring->sqRingSize);
+        close(uring->fd);
+        return -1;
+    }
+    char *sq = uring->sqRing;
+    uring->sqHead = (unsigned int *)(sq + params.sq_off.head);
+    uring->sqTail = (unsigned int *)(sq + params.sq_off.tail);
+    uring->sqMask = *(unsigned int *)(sq + params.sq_off.ring_mask);
+    uring->sqEntries = *(unsigned int *)(sq + params.sq_off.ring_entries);
+    uring->sqArray = (unsigned int *)(sq + params.sq_off.array);
+    char *cq = uring->cqRing;
+    uring->cqHead = (unsigned int *)(cq + params.cq_off.head);
+    uring->cqTail = (unsigned int *)(cq + params.cq_off.tail);
+    uring->cqMask = *(unsigned int *)(cq + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // Кольцо буферов: ядро само выбирает буфер, когда данные пришли, а не когда поставлено чтение
+    uring->bufferRingSize = URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    uring->bufferRing = mmap(NULL, uring->bufferRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    uring->buffers = mmap(NULL, (size_t)URING_BUFFER_COUNT * URING_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (uring->bufferRing == MAP_FAILED || uring->buffers == MAP_FAILED) {
+        perror("allocating io_uring buffers");
+        uring->bufferRing = uring->bufferRing == MAP_FAILED ? NULL : uring->bufferRing;
+        uring->buffers = uring->buffers == MAP_FAILED ? NULL : uring->buffers;
+        destroyUring(uring);
+        return -1;
+    }
+    struct io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = (uint64_t)(uintptr_t)uring->bufferRing;
+    registration.ring_entries = URING_BUFFER_COUNT;
+    registration.bgid = URING_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PBUF_RING, &registration, 1) == -1) {
+        perror("registering io_uring buffer ring");
+        destroyUring(uring);
+        return -1;
+    }
+    for (unsigned int i = 0; i < URING_BUFFER_COUNT; i++) {
+        recycleUringBuffer(uring, i);
+    }
+    return 0;
+}
+
+// Свободный элемент очереди отправки, при заполненной очереди отправляем накопленное
+struct io_uring_sqe *getUringSqe(struct Uring *uring) {
+    unsigned int tail = *uring->sqTail;
+    while (tail - atomic_load_explicit((_Atomic unsigned int *)uring->sqHead, memory_order_acquire) >= uring->sqEntries) {
+        submitUring(uring, 0);
+    }
+    unsigned int index = tail & uring->sqMask;
+    struct io_uring_sqe *sqe = &uring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    uring->sqArray[index] = index;
+    atomic_store_explicit((_Atomic unsigned int *)uring->sqTail, tail + 1, memory_order_release);
+    uring->pending++;
+    return sqe;
+}
+
+// Отправляем запросы и ждём waitCount завершений одним системным вызовом
+int submitUring(struct Uring *uring, unsigned int waitCount) {
+    unsigned int flags = waitCount > 0 ? IORING_ENTER_GETEVENTS : 0;
+    long submitted = syscall(__NR_io_uring_enter, uring->fd, uring->pending, waitCount, flags, NULL, 0);
+    if (submitted == -1) {
+        // Переполнено кольцо завершений или пришёл сигнал: сначала разбираем завершения
+        if (errno == EINTR || errno == EBUSY || errno == EAGAIN) {
+            return 0;
+        }
+        perror("submitting io_uring requests");
+        return -1;
+    }
+    uring->pending -= submitted;
+    return 0;
+}
+
+// Очередное завершение, NULL если завершений нет
+struct io_uring_cqe *peekUringCqe(struct Uring *uring) {
+    unsigned int head = *uring->cqHead;
+    if (head == atomic_load_explicit((_Atomic unsigned int *)uring->cqTail, memory_order_acquire)) {
+        return NULL;
+    }
+    return &uring->cqes[head & uring->cqMask];
+}
+
+// Завершение разобрано, место в кольце можно отдать ядру
+void seenUringCqe(struct Uring *uring) {
+    atomic_store_explicit((_Atomic unsigned int *)uring->cqHead, *uring->cqHead + 1, memory_order_release);
+}
+
+// Возвращаем буфер в кольцо для следующего приёма
+void recycleUringBuffer(struct Uring *uring, unsigned short bid) {
+    struct io_uring_buf *buffer = &uring->bufferRing->bufs[uring->bufferTail & (URING_BUFFER_COUNT - 1)];
+    buffer->addr = (uint64_t)(uintptr_t)(uring->buffers + (size_t)bid * URING_BUFFER_SIZE);
+    buffer->len = URING_BUFFER_SIZE;
+    buffer->bid = bid;
+    uring->bufferTail++;
+    atomic_store_explicit((_Atomic unsigned short *)&uring->bufferRing->tail, uring->bufferTail, memory_order_release);
+}
+
+// Многократное ожидание готовности дескриптора
+void prepUringPoll(struct Uring *uring, int fd, uint32_t events, uint64_t userData) {
+    struct io_uring_sqe *sqe = getUringSqe(uring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = userData;
+}
+
+// Многократный приём соединений: одно завершение на каждое соединение
+void prepUringAccept(struct Uring *uring, int fd, uint64_t userData) {
+    struct io_uring_sqe *sqe = getUringSqe(uring);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = userData;
+}
+
+// Отменяем все операции с дескриптором
+void prepUringCancel(struct Uring *uring, int fd, uint64_t userData) {
+    struct io_uring_sqe *sqe = getUringSqe(uring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = userData;
+}
+
+// Таймер внутри кольца, время копируется ядром при отправке
+void prepUringTimeout(struct Uring *uring, struct __kernel_timespec *timeout, uint64_t userData) {
+    struct io_uring_sqe *sqe = getUringSqe(uring);
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)timeout;
+    sqe->len = 1;
+    sqe->user_data = userData;
+}
+
+// Закрываем кольца и освобождаем буферы
+void destroyUring(struct Uring *uring) {
+    if (uring->buffers != NULL) {
+        munmap(uring->buffers, (size_t)URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+    }
+    if (uring->bufferRing != NULL) {
+        munmap(uring->bufferRing, uring->bufferRingSize);
+    }
+    munmap(uring->sqes, uring->sqesSize);
+    munmap(uring->sqRing, uring->sqRingSize);
+    close(uring->fd);
+}
+
+// Инициализируем направление сессии
+void initUringStream(struct UringStream *stream, int source, int sourceIsSocket, int dest, int destIsSocket,
+                     int readOp, int writeOp, struct OutputBuffer *pending) {
+    memset(stream, 0, sizeof(struct UringStream));
+    stream->source = source;
+    stream->sourceIsSocket = sourceIsSocket;
+    stream->dest = dest;
+    stream->destIsSocket = destIsSocket;
+    stream->readOp = readOp;
+    stream->writeOp = writeOp;
+    stream->pending = pending;
+}
+
+// Ставим запись первого куска и чтение следующего, если для него есть место
+void pumpUringStream(struct Uring *uring, struct UringSession *session, struct UringStream *stream, uint64_t base) {
+    if (!stream->writing && !stream->delayed) {
+        char *data = NULL;
+        size_t length = 0;
+        if (stream->pending != NULL && stream->pending->length > 0) {
+            length = peekOutput(stream->pending, &data);
+        } else if (stream->count > 0) {
+            data = uring->buffers + (size_t)stream->buffers[stream->head] * URING_BUFFER_SIZE + stream->offset;
+            length = stream->lengths[stream->head] - stream->offset;
+        }
+        if (length > 0) {
+            struct io_uring_sqe *sqe = getUringSqe(uring);
+            if (stream->destIsSocket) {
+                sqe->opcode = IORING_OP_SEND;
+                sqe->msg_flags = MSG_NOSIGNAL;
+            } else {
+                sqe->opcode = IORING_OP_WRITE;
+                sqe->off = (uint64_t)-1;
+            }
+            sqe->fd = stream->dest;
+            sqe->addr = (uint64_t)(uintptr_t)data;
+            sqe->len = length;
+            sqe->user_data = base | stream->writeOp;
+            stream->writing = 1;
+            session->ops++;
+        }
+    }
+    if (!stream->reading && !session->retrying && stream->count < URING_STREAM_CHUNKS) {
+        struct io_uring_sqe *sqe = getUringSqe(uring);
+        if (stream->sourceIsSocket) {
+            sqe->opcode = IORING_OP_RECV;
+        } else {
+            sqe->opcode = IORING_OP_READ;
+            sqe->off = (uint64_t)-1;
+        }
+        sqe->fd = stream->source;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUFFER_GROUP;
+        sqe->len = URING_BUFFER_SIZE;
+        sqe->user_data = base | stream->readOp;
+        stream->reading = 1;
+        session->ops++;
+    }
+}
+
+// Чтение завершилось: кусок встаёт в очередь на запись и записывается в журнал аудита по audit
+// Возвращаем 0, SOURCE_CLOSED, URING_NO_BUFFERS или -1 при ошибке
+int completeUringRead(struct Uring *uring, struct UringStream *stream, int result, uint32_t flags,
+                      const struct AuditTag *audit) {
+    stream->reading = 0;
+    if (result == -ENOBUFS) {
+        return URING_NO_BUFFERS;
+    }
+    // ptm после завершения оболочки возвращает EIO
+    if (result == 0 || result == -EIO || result == -ECONNRESET) {
+        return SOURCE_CLOSED;
+    }
+    if (result < 0) {
+        if (result != -ECANCELED) {
+            fprintf(stderr, "Error: io_uring read: %s\n", strerror(-result));
+        }
+        return -1;
+    }
+    if (!(flags & IORING_CQE_F_BUFFER)) {
+        return -1;
+    }
+    int tail = (stream->head + stream->count) % URING_STREAM_CHUNKS;
+    stream->buffers[tail] = flags >> IORING_CQE_BUFFER_SHIFT;
+    stream->lengths[tail] = result;
+    auditData(audit, uring->buffers + (size_t)stream->buffers[tail] * URING_BUFFER_SIZE, (size_t)result);
+    stream->count++;
+    return 0;
+}
+
+// Запись завершилась: отбрасываем записанное, опустевший буфер возвращаем в кольцо
+// Возвращаем 0, URING_WRITE_DELAYED или -1 при ошибке
+int completeUringWrite(struct Uring *uring, struct UringStream *stream, int result) {
+    stream->writing = 0;
+    // Запись прервана до передачи данных: так бывает на ядрах без DEFER_TASKRUN, см. initUring.
+    // Повторяем по таймеру, а не сразу, и не бесконечно
+    if (result == -EINTR && stream->interrupted < URING_WRITE_RETRIES) {
+        stream->interrupted++;
+        stream->delayed = 1;
+        return URING_WRITE_DELAYED;
+    }
+    if (result < 0) {
+        if (result != -ECANCELED && result != -EPIPE && result != -ECONNRESET) {
+            fprintf(stderr, "Error: io_uring write: %s\n", strerror(-result));
+        }
+        return -1;
+    }
+    stream->interrupted = 0;
+    // Накопленное до перехода записывается первым, пока оно не кончится
+    if (stream->pending != NULL && stream->pending->length > 0) {
+        consumeOutput(stream->pending, result);
+        return 0;
+    }
+    stream->offset += result;
+    if (stream->count > 0 && stream->offset == stream->lengths[stream->head]) {
+        recycleUringBuffer(uring, stream->buffers[stream->head]);
+        stream->head = (stream->head + 1) % URING_STREAM_CHUNKS;
+        stream->count--;
+        stream->offset = 0;
+    }
+    return 0;
+}
+
+// Всё прочитанное направлением записано получателю и запись не выполняется
+int isUringStreamIdle(struct UringStream *stream) {
+    return stream->count == 0 && !stream->writing && (stream->pending == NULL || stream->pending->length == 0);
+}
+
+// Возвращаем в кольцо буферы, которые направление не успело записать
+void releaseUringStream(struct Uring *uring, struct UringStream *stream) {
+    while (stream->count > 0) {
+        recycleUringBuffer(uring, stream->buffers[stream->head]);
+        stream->head = (stream->head + 1) % URING_STREAM_CHUNKS;
+        stream->count--;
+    }
+    if (stream->pending != NULL) {
+        destroyOutputBuffer(stream->pending);
+    }
+}
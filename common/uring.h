@@ -0,0 +1,95 @@
+#ifndef URING_H
+    #include <stdint.h>
+    #include <stddef.h>
+    #include <linux/io_uring.h>
+
+    #include "outbuf.h"
+    #include "audit.h"
+
+    #define URING_ENTRIES 1024
+    #define URING_BUFFER_COUNT 1024        // Буферов в кольце для приёма (степень двойки)
+    #define URING_BUFFER_SIZE 16384
+    #define URING_BUFFER_GROUP 0
+    #define URING_STREAM_CHUNKS 4          // Принятых, но не записанных кусков на направление
+    #define URING_NO_BUFFERS 3
+    #define URING_WRITE_DELAYED 4          // Запись прервана и будет повторена по таймеру
+    #define URING_WRITE_RETRIES 8          // Прерванных записей подряд, после которых сессия закрывается
+
+    // Кольца io_uring реактора и кольцо буферов, из которых ядро берёт память для приёма
+    struct Uring {
+        int fd;
+        unsigned int *sqHead;
+        unsigned int *sqTail;
+        unsigned int sqMask;
+        unsigned int sqEntries;
+        unsigned int *sqArray;
+        struct io_uring_sqe *sqes;
+        unsigned int *cqHead;
+        unsigned int *cqTail;
+        unsigned int cqMask;
+        struct io_uring_cqe *cqes;
+        unsigned int pending;          // Заполненных, но не отправленных в ядро запросов
+        void *sqRing;
+        size_t sqRingSize;
+        void *cqRing;
+        size_t cqRingSize;
+        size_t sqesSize;
+        struct io_uring_buf_ring *bufferRing;
+        size_t bufferRingSize;
+        char *buffers;
+        unsigned short bufferTail;
+    };
+
+    // Одно направление сессии: чтение в буфер из кольца и запись его получателю,
+    // следующее чтение ставится, пока очередь кусков не заполнена
+    struct UringStream {
+        int source;
+        int dest;
+        int sourceIsSocket;
+        int destIsSocket;
+        int readOp;                    // Коды операций для user_data
+        int writeOp;
+        struct OutputBuffer *pending;  // Данные, накопленные до перехода на io_uring
+        unsigned short buffers[URING_STREAM_CHUNKS];
+        unsigned int lengths[URING_STREAM_CHUNKS];
+        int head;
+        int count;
+        unsigned int offset;           // Уже записано из первого куска
+        int reading;
+        int writing;
+        int delayed;                   // Запись ждёт таймера повтора
+        int interrupted;               // Прерванных записей подряд
+    };
+
+    // Сессия соединения на io_uring
+    struct UringSession {
+        struct UringStream toPty;
+        struct UringStream toClient;
+        int active;
+        int ops;                       // Операций в ядре, структура соединения занята до их завершения
+        int closing;
+        int retrying;                  // Ждём таймера повтора: освобождения буферов кольца или прерванной записи
+    };
+
+    int initUring(struct Uring *uring, unsigned int entries);
+    struct io_uring_sqe *getUringSqe(struct Uring *uring);
+    int submitUring(struct Uring *uring, unsigned int waitCount);
+    struct io_uring_cqe *peekUringCqe(struct Uring *uring);
+    void seenUringCqe(struct Uring *uring);
+    void recycleUringBuffer(struct Uring *uring, unsigned short bid);
+    void prepUringPoll(struct Uring *uring, int fd, uint32_t events, uint64_t userData);
+    void prepUringAccept(struct Uring *uring, int fd, uint64_t userData);
+    void prepUringCancel(struct Uring *uring, int fd, uint64_t userData);
+    void prepUringTimeout(struct Uring *uring, struct __kernel_timespec *timeout, uint64_t userData);
+    void destroyUring(struct Uring *uring);
+
+    void initUringStream(struct UringStream *stream, int source, int sourceIsSocket, int dest, int destIsSocket,
+                         int readOp, int writeOp, struct OutputBuffer *pending);
+    void pumpUringStream(struct Uring *uring, struct UringSession *session, struct UringStream *stream, uint64_t base);
+    int completeUringRead(struct Uring *uring, struct UringStream *stream, int result, uint32_t flags,
+                          const struct AuditTag *audit);
+    int completeUringWrite(struct Uring *uring, struct UringStream *stream, int result);
+    int isUringStreamIdle(struct UringStream *stream);
+    void releaseUringStream(struct Uring *uring, struct UringStream *stream);
+    #define URING_H
+#endif
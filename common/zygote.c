@@ -0,0 +1,290 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "zygote.h"
+#include "common.h"
+
+// Сокет связи с заготовщиком, -1 если пул не запущен или заготовщик завершился
+static atomic_int zygotefd = -1;
+
+// Открываем псевдотерминал и запускаем на нём оболочку, возвращаем pid оболочки
+pid_t spawnShell(int *ptm) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (master == -1) {
+        perror("creating new plm");
+        return -1;
+    }
+    if (grantpt(master) == -1 || unlockpt(master) == -1) {
+        perror("unlocking pt");
+        close(master);
+        return -1;
+    }
+    int pts = open(ptsname(master), O_RDWR | O_NOCTTY);
+    if (pts == -1) {
+        perror("opening pts");
+        close(master);
+        return -1;
+    }
+    if (setNonBlock(master) == -1 || setNonBlock(pts) == -1) {
+        fprintf(stderr, "Error: making pty non-block\n");
+        close(master);
+        close(pts);
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("forking shell");
+        close(master);
+        close(pts);
+        return -1;
+    }
+    if (pid == 0) {
+        struct termios settings;
+        if (tcgetattr(pts, &settings) == -1) {
+            perror("getting old terminal settings");
+            _exit(EXIT_FAILURE);
+        }
+        cfmakeraw(&settings);
+        if (tcsetattr(pts, TCSANOW, &settings) == -1) {
+            perror("setting new terminal settings");
+            _exit(EXIT_FAILURE);
+        }
+        dup2(pts, 0);
+        dup2(pts, 1);
+        dup2(pts, 2);
+        if (pts > 2) {
+            close(pts);
+        }
+
+        setsid();
+        ioctl(0, TIOCSCTTY, 1);
+
+        // Оболочка не должна унаследовать игнорирование сигналов и маску сигналов сервера
+        signal(SIGPIPE, SIG_DFL);
+        signal(SIGCHLD, SIG_DFL);
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigprocmask(SIG_SETMASK, &signals, NULL);
+        char *argv[] = {"/bin/bash", NULL};
+        execv(argv[0], argv);
+        _exit(EXIT_FAILURE);
+    }
+    close(pts);
+    *ptm = master;
+    return pid;
+}
+
+// Запускаем оболочку и передаём серверу её ptm и pidfd вместе с pid
+// pidfd открываем здесь: пока оболочка - наш потомок, её pid не может достаться другому процессу
+static int sendShell(int socketfd) {
+    int fds[2];
+    pid_t pid = spawnShell(&fds[0]);
+    if (pid == -1) {
+        return 0;
+    }
+    fds[1] = (int)syscall(SYS_pidfd_open, pid, 0);
+    int count = fds[1] == -1 ? 1 : 2;
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {&pid, sizeof(pid)};
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+    message.msg_controllen = CMSG_SPACE(count * sizeof(int));
+    int status = sendmsg(socketfd, &message, MSG_NOSIGNAL) == -1 ? -1 : 0;
+    // У сервера свои копии дескрипторов, а при ошибке оболочка завершится по SIGHUP
+    for (int i = 0; i < count; i++) {
+        close(fds[i]);
+    }
+    return status;
+}
+
+// Цикл заготовщика: держим в сокете poolSize готовых оболочек,
+// каждый байт от сервера означает, что одну забрали и нужно запустить следующую
+static void runZygote(int socketfd, int poolSize) {
+    // Завершившиеся оболочки забирает ядро
+    signal(SIGCHLD, SIG_IGN);
+    for (int i = 0; i < poolSize; i++) {
+        if (sendShell(socketfd) == -1) {
+            _exit(EXIT_SUCCESS);
+        }
+    }
+    char credits[64];
+    for (;;) {
+        ssize_t count = read(socketfd, credits, sizeof(credits));
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        // Сервер завершился
+        if (count <= 0) {
+            _exit(EXIT_SUCCESS);
+        }
+        for (ssize_t i = 0; i < count; i++) {
+            if (sendShell(socketfd) == -1) {
+                _exit(EXIT_SUCCESS);
+            }
+        }
+    }
+}
+
+// Запускаем заготовщика, пока в процессе нет других потоков
+int startZygote(int poolSize) {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) == -1) {
+        perror("creating zygote socket");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("forking zygote");
+        close(sockets[0]);
+        close(sockets[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(sockets[0]);
+        runZygote(sockets[1], poolSize);
+    }
+    close(sockets[1]);
+    atomic_store(&zygotefd, sockets[0]);
+    return 0;
+}
+
+// Забираем готовую оболочку, -1 если пул пуст или не запущен
+int takeShell(struct Shell *shell, int *ptm) {
+    int socketfd = atomic_load(&zygotefd);
+    if (socketfd == -1) {
+        return -1;
+    }
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct iovec iov = {&shell->pid, sizeof(shell->pid)};
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t received = recvmsg(socketfd, &message, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (received == -1 && (errno == EAGAIN || errno == EINTR)) {
+        return -1;
+    }
+    struct cmsghdr *cmsg = received > 0 ? CMSG_FIRSTHDR(&message) : NULL;
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS) {
+        // Заготовщик завершился, дальше оболочки запускаем сами
+        fprintf(stderr, "Error: shell pool stopped\n");
+        atomic_compare_exchange_strong(&zygotefd, &socketfd, -1);
+        return -1;
+    }
+    memcpy(ptm, CMSG_DATA(cmsg), sizeof(int));
+    shell->pidfd = -1;
+    if (cmsg->cmsg_len >= CMSG_LEN(2 * sizeof(int))) {
+        memcpy(&shell->pidfd, CMSG_DATA(cmsg) + sizeof(int), sizeof(int));
+    }
+    shell->adopted = 1;
+    // Просим заготовить замену
+    char credit = 1;
+    if (send(socketfd, &credit, 1, MSG_DONTWAIT | MSG_NOSIGNAL) == -1) {
+        perror("requesting new shell");
+    }
+    return 0;
+}
+
+// Останавливаем заготовщика: закрытие сокета завершает его цикл
+void stopZygote() {
+    int socketfd = atomic_exchange(&zygotefd, -1);
+    if (socketfd != -1) {
+        close(socketfd);
+    }
+}
+
+// Оболочки нет
+void initShell(struct Shell *shell) {
+    shell->pid = -1;
+    shell->pidfd = -1;
+    shell->adopted = 0;
+}
+
+// Берём оболочку: готовую из пула заготовщика или запущенную сейчас
+// pidfd открывается, если ядро его поддерживает, завершение оболочки можно ждать в epoll
+int startShell(struct Shell *shell, int *ptm) {
+    if (takeShell(shell, ptm) == -1) {
+        shell->pid = spawnShell(ptm);
+        if (shell->pid == -1) {
+            return -1;
+        }
+        shell->adopted = 0;
+        shell->pidfd = (int)syscall(SYS_pidfd_open, shell->pid, 0);
+    }
+    if (setNonBlock(*ptm) == -1) {
+        fprintf(stderr, "Error: making ptm non-block\n");
+        close(*ptm);
+        killShell(shell);
+        return -1;
+    }
+    return 0;
+}
+
+// Забираем завершившуюся оболочку, 0 если она ещё работает
+// Оболочки из пула - потомки заготовщика, их забирает он, а переданные предыдущим процессом - init
+int reapShell(struct Shell *shell, int block) {
+    if (shell->pid == -1) {
+        return 1;
+    }
+    if (!shell->adopted) {
+        siginfo_t info;
+        info.si_pid = 0;
+        int options = WEXITED | (block ? 0 : WNOHANG);
+        int result;
+        do {
+            result = shell->pidfd != -1 ? waitid(P_PIDFD, (id_t)shell->pidfd, &info, options)
+                                        : waitid(P_PID, (id_t)shell->pid, &info, options);
+        } while (result == -1 && errno == EINTR);
+        if (result == 0 && info.si_pid == 0) {
+            return 0;
+        }
+        if (result == -1) {
+            perror("waiting for shell");
+        }
+    }
+    shell->pid = -1;
+    if (shell->pidfd != -1) {
+        close(shell->pidfd);
+        shell->pidfd = -1;
+    }
+    return 1;
+}
+
+// Сессия закрывается раньше, чем завершилась оболочка: завершаем её и забираем
+// Свою оболочку убиваем вместе с группой, её pid занят, пока мы её не забрали;
+// чужой оболочке сигнал отправляем через pidfd, pid мог уже достаться другому процессу.
+// Чужую оболочку без pidfd (ядро без pidfd_open) завершает SIGHUP при закрытии ptm,
+// поэтому такие сессии не передаются новому процессу
+void killShell(struct Shell *shell) {
+    if (shell->pid == -1) {
+        return;
+    }
+    if (!shell->adopted) {
+        kill(-shell->pid, SIGKILL);
+    } else if (shell->pidfd != -1) {
+        syscall(SYS_pidfd_send_signal, shell->pidfd, SIGKILL, NULL, 0);
+    }
+    reapShell(shell, 1);
+}
@@ -0,0 +1,24 @@
+#ifndef ZYGOTE_H
+    #include <sys/types.h>
+
+    #define DEFAULT_SHELL_POOL 4
+
+    // Процесс оболочки сессии или канала
+    struct Shell {
+        pid_t pid;      // -1 если оболочка не запущена или уже завершилась
+        int pidfd;      // Становится читаемым при завершении оболочки, -1 без pidfd
+        int adopted;    // Не наш потомок (из пула или от предыдущего процесса): забирает её не сервер
+    };
+
+    // Запуск оболочки на новом псевдотерминале
+    pid_t spawnShell(int *ptm);
+    // Процесс-заготовщик держит наготове poolSize запущенных оболочек
+    int startZygote(int poolSize);
+    int takeShell(struct Shell *shell, int *ptm);
+    void stopZygote();
+    void initShell(struct Shell *shell);
+    int startShell(struct Shell *shell, int *ptm);
+    int reapShell(struct Shell *shell, int block);
+    void killShell(struct Shell *shell);
+    #define ZYGOTE_H
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #define _XOPEN_SOURCE 600
 #define _BSD_SOURCE
 #include <unistd.h>
@@ -8,91 +9,202 @@
 #include <signal.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/epoll.h>
 #include <unistd.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <fcntl.h>
-#include <termios.h>
-#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <libgen.h>
 
 #include "common.h"
 #include "queue.h"
 #include "pass_pair.h"
+#include "connection.h"
+#include "timerwheel.h"
+#include "relay.h"
+#include "inbuf.h"
+#include "passindex.h"
+#include "credentials.h"
+#include "rcu.h"
+#include "authpool.h"
+#include "zygote.h"
+#include "uring.h"
+#include "metrics.h"
+#include "coalesce.h"
+#include "handoff.h"
+#include "overload.h"
 
 
-#define MAX_CONNECTIONS 256
 #define CONNECTION_TIMEOUT 300
+#define AUTHENTICATION_TIMEOUT 60
+#define SESSION_TIMEOUT 0
 #define MAX_PASSWORD_ATTEMPTS 5
-#define TIMEOUT_WATCHER_FREQUENCY 15
-
-#define LOGIN_REQUEST 0
-#define LOGIN_CHECK 1
-#define PASSWORD_REQUEST 2
-#define PASSWORD_CHECK 3
-#define AUTHENTICATED 4
-
-// Структура содержащая информацию об аутентификации
-struct Authentication {
-    int status;  // 0 - Запрос логина 1 - Проверка логина 2 - Запрос пароля 3 - Проверка пароля 4 - Аутентифицирован
-    int attempts;
+#define AUTH_THREADS 2
+#define DEFAULT_EVENT_BATCH 64
+#define ACCEPT_BUDGET 64
+#define ACCEPT_HISTOGRAM_SIZE 8
+#define HANDOFF_ROUNDS 10           // Попыток передать соединения, в которых были данные в пути
+#define HANDOFF_RETRY_US 100000
+
+#define EVENT_IO 0
+#define EVENT_TIMEOUT 1
+#define EVENT_AUTH 2
+#define EVENT_FLUSH 3
+#define EVENT_HANDOFF 4     // Передать соединение новому процессу, для слушающего сокета - перестать принимать
+#define EVENT_ADOPT 5       // Продолжить соединение, полученное от предыдущего процесса
+#define EVENT_STOP 6        // Завершить рабочий поток, события за ним в очереди не обрабатываются
+
+// Передача работы новому процессу
+#define UPGRADE_IDLE 0
+#define UPGRADE_RUNNING 1
+#define UPGRADE_DRAINING 2  // Работа передана, ждём закрытия оставшихся соединений
+
+// Операции io_uring: код в младших битах user_data, в остальных - указатель на соединение
+#define URING_OP_ACCEPT 0
+#define URING_OP_EPOLL 1
+#define URING_OP_CANCEL 2
+#define URING_OP_READ_CLIENT 3
+#define URING_OP_READ_PTM 4
+#define URING_OP_WRITE_PTM 5
+#define URING_OP_WRITE_CLIENT 6
+#define URING_OP_RETRY 7
+#define URING_OP_MASK 7
+
+// Событие для обработки: готовность дескриптора из epoll или внутреннее
+struct Event {
+    int fd;
+    uint32_t events;
+    int type;
+    unsigned int generation;    // Поколение соединения для событий из других потоков
+    int status;                 // Результат проверки пароля для EVENT_AUTH
+    uint64_t enqueuedAt;        // Время постановки в очередь рабочего потока, нс
 };
 
-// Структура содержащая информацию о соединении
-struct Connection {
-    int connectionfd;
-    int ptm;
-    struct Authentication auth;
-    struct PassPair *pair;
-    time_t lastRequest;
+// Таймауты соединения в секундах, 0 - таймаут отключён
+struct Timeouts {
+    int idle;           // Без активности
+    int authentication; // На ввод логина и пароля
+    int session;        // Общая длительность сессии
+};
+
+// Структура цикла обработки событий: свой epoll, слушающий сокет и колесо таймеров
+struct Reactor {
+    int epollfd;
+    int socketfd;
+    int sharedSocket;       // Слушающий сокет общий для всех реакторов (EPOLLEXCLUSIVE)
+    int listening;          // Реактор принимает соединения, после передачи работы новому процессу - нет
+    atomic_int acceptsPaused;   // Приём остановлен диспетчером на время перегрузки
+    int timerfd;
+    int batchSize;
+    struct TimerWheel timers;
+    struct Queue *queues;   // Очереди рабочих потоков, по одной на поток; NULL если события обрабатывает сам реактор
+    int queueCount;
+    struct Queue mailbox;   // События от других потоков для реактора без очереди
+    int mailboxfd;          // eventfd для пробуждения реактора
+    atomic_int mailboxSignaled;
+    struct Uring *uring;    // Кольцо io_uring потока реактора, NULL при работе на epoll
+    int *expired;           // Дескрипторы соединений с сработавшим таймером
+    int expiredCount;
+    int expiredSize;
+    int flushTimerfd;       // Однократный таймер сброса пробок TCP_CORK
+    struct Event *flushing; // Соединения, поставившие пробку после последнего сброса
+    int flushingCount;
+    int flushingSize;
+    pthread_mutex_t flushMutex;
+    pthread_mutex_t acceptMutex;    // Остановка приёма и перевзвод слушающего сокета: иначе перевзвод отменит остановку
+    pthread_t thread;
+};
+
+// Статистика приёма соединений
+struct AcceptStats {
+    atomic_ulong wakeups;                               // Событий слушающего сокета
+    atomic_ulong accepted;                              // Принятых соединений
+    atomic_ulong perWakeup[ACCEPT_HISTOGRAM_SIZE];      // Принято за событие: 0, 1, 2-3, 4-7, ...
+    atomic_ulong budgetExhausted;                       // Очередь не разобрана за одно событие
+    atomic_ulong maxBacklog;                            // Наибольшая замеченная очередь accept
+    atomic_ulong pauses;                                // Остановок приёма при перегрузке
+    atomic_ulong errors;
 };
 
 // Структура для передачи аргументов в функции при создании потока
 struct WorkerArgs {
     struct Queue *queue;
-    pthread_mutex_t *mutex;
-    pthread_cond_t *condition;
+    struct Reactor *reactor;
+    struct OverloadState overload;  // Задержка событий в очереди потока
+};
+
+// Реакторы, между которыми делятся соединения при передаче работы
+struct HandoffArgs {
+    struct Reactor *reactors;
+    int count;
+    int socketfd;
 };
 
 // Глобальная переменная для завершения работы по сигналу
 volatile sig_atomic_t done = 0;
 
-// Глобальные переменные для струтуры со списком дескрипторов соединений и мьютексом для синхронизации доступа к ним
-struct Connection connections[MAX_CONNECTIONS];
-pthread_mutex_t connectionsMutex;
+// Перезапуск новой версии сервера по SIGUSR2 с передачей ему сокетов
+volatile sig_atomic_t upgradeRequested = 0;
+atomic_int upgradeState = UPGRADE_IDLE;
+atomic_int handoffSocket = -1;      // Сокет передачи соединений, -1 вне передачи
+atomic_int handoffPending;          // Запросов передачи, ещё не обработанных потоками соединений
+atomic_int handedOver;
+char **serverArgv;
 
-// Глобальная переменная с парами логин-пароль;
-struct PassPair *passPairs;
-intmax_t lengthPassPairs;
+// Слушающие сокеты, полученные от предыдущего процесса
+int *inheritedListeners = NULL;
+int inheritedCount = 0;
+int inheritedTaken = 0;
 
-// Глобальные переменные дескрипторов socketfd и epoll
-int socketfd = -1;
-int epollfd = -1;
+// Таймауты соединений
+struct Timeouts timeouts = {CONNECTION_TIMEOUT, AUTHENTICATION_TIMEOUT, SESSION_TIMEOUT};
 
-void setSocketFd(int _socketfd) {
-    if (socketfd == -1) {
-        socketfd = _socketfd;
-    }
-}
+// Глобальная переменная с текущей версией базы паролей
+// Читается под rcuReadLock, при перезагрузке заменяется целиком
+_Atomic(struct Credentials *) credentials = NULL;
+char *credentialsPath = NULL;
+// eventfd остановки потока перезагрузки базы паролей
+int watcherStopfd = -1;
 
-void setEpollFd(int _epollfd) {
-    if (epollfd == -1) {
-        epollfd = _epollfd;
-    }
-}
+struct AcceptStats acceptStats;
+
+// Пул проверки паролей, при 0 потоков пароль проверяется прямо в потоке соединения
+struct AuthPool authPool;
+int authThreads = AUTH_THREADS;
+
+// Реакторы -r передают данные сессий через io_uring, epoll остаётся запасным вариантом
+int useUring = 0;
+
+// Код операции io_uring помещается в младшие биты указателя на соединение
+_Static_assert(_Alignof(struct Connection) > URING_OP_MASK, "connection pointer has no room for io_uring op");
 
 // Перехватчик сигнала
 void handleSigInt(int signum) {
     done = 1;
 }
 
+// Передачу работы запускает главный поток
+void handleSigUsr2(int signum) {
+    upgradeRequested = 1;
+}
+
 
 // Инициализируем структуру аргументов
-void initWorkerArgs(struct WorkerArgs *workerArgs, struct Queue *queue, pthread_mutex_t *mutex,
-                    pthread_cond_t *condition) {
+void initWorkerArgs(struct WorkerArgs *workerArgs, struct Queue *queue, struct Reactor *reactor) {
     workerArgs->queue = queue;
-    workerArgs->mutex = mutex;
-    workerArgs->condition = condition;
+    workerArgs->reactor = reactor;
+    memset(&workerArgs->overload, 0, sizeof(workerArgs->overload));
 }
 
 // Получение доступных адресов
@@ -116,14 +228,15 @@ struct addrinfo*getAvailableAddresses(char *port) {
 }
 
 //  Получаем дескриптор сокета привязанный к адресу
-int getSocket(struct addrinfo* addresses) {
+//  reusePort позволяет нескольким сокетам слушать один порт (SO_REUSEPORT)
+int getSocket(struct addrinfo* addresses, int reusePort) {
     int yes = 1;
     int socketfd = 0;
 
     // Перебор списка подходящих адрессов
     for (struct addrinfo *address = addresses; address != NULL; address = address->ai_next) {
         // Создание неблокирующегося сокета
-        socketfd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK, address->ai_protocol);
+        socketfd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
         if (socketfd == -1) {
             perror("creating socket error\n");
             continue;
@@ -131,6 +244,13 @@ int getSocket(struct addrinfo* addresses) {
         // Установка опции SO_REUSEADDR
         if (setsockopt(socketfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == -1) {
             perror("setsockopt error");
+            close(socketfd);
+            continue;
+        }
+        // Установка опции SO_REUSEPORT, ядро само распределит соединения между сокетами
+        if (reusePort && setsockopt(socketfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1) {
+            perror("setsockopt SO_REUSEPORT error");
+            close(socketfd);
             continue;
         }
         // Привязка сокета к адресу
@@ -146,100 +266,230 @@ int getSocket(struct addrinfo* addresses) {
 }
 
 
-// Добавляем соединение в список
-void addConnectionIntoList(int connectionfd) {
-    struct Connection connection;
-    memset(&connection, 0, sizeof(struct Connection));
-    connection.connectionfd = connectionfd;
-    connection.ptm = -1;
-    struct Authentication auth;
-    memset(&auth, 0, sizeof(struct Authentication));
-    connection.auth = auth;
-    connection.lastRequest = time(NULL);
-    connection.pair = NULL;
-    pthread_mutex_lock(&connectionsMutex);
-    for (int i = 0; i < sizeof(connections)/sizeof(connections[0]); i++) {
-        if (connections[i].connectionfd == 0) {
-            connections[i] = connection;
-            break;
-        }
+// Ближайший момент, когда соединение нужно закрыть по таймауту, 0 - никогда
+time_t getConnectionDeadline(struct Connection *connection) {
+    time_t deadline = 0;
+    if (timeouts.idle > 0) {
+        deadline = connection->lastRequest + timeouts.idle;
+    }
+    if (timeouts.authentication > 0 && connection->auth.status < AUTHENTICATED) {
+        time_t authDeadline = connection->createdAt + timeouts.authentication;
+        if (deadline == 0 || authDeadline < deadline)
+            deadline = authDeadline;
     }
-    pthread_mutex_unlock(&connectionsMutex);
+    if (timeouts.session > 0) {
+        time_t sessionDeadline = connection->createdAt + timeouts.session;
+        if (deadline == 0 || sessionDeadline < deadline)
+            deadline = sessionDeadline;
+    }
+    return deadline;
 }
 
-// Удаляем соединения из списка
-void removeConnectionFromList(struct Connection *connection) {
-    pthread_mutex_lock(&connectionsMutex);
-    for (int i = 0; i < sizeof(connections)/sizeof(connections[0]); i++) {
-        if (connection == &connections[i]) {
-            memset(&connections[i], 0, sizeof(connections[i]));
-            break;
-        }
+// Ставим таймер соединения на ближайший дедлайн
+// Активность соединения таймер не двигает: при срабатывании дедлайн пересчитывается
+void scheduleConnectionTimeout(struct Connection *connection) {
+    time_t deadline = getConnectionDeadline(connection);
+    if (deadline == 0) {
+        cancelTimer(connection->timers, &connection->timer);
+    } else {
+        scheduleTimer(connection->timers, &connection->timer, deadline);
+    }
+}
+
+// Соединение обрабатывает реактор reactor
+void assignReactor(struct Reactor *reactor, struct Connection *connection) {
+    connection->timers = &reactor->timers;
+    connection->epollfd = reactor->epollfd;
+    connection->reactor = reactor;
+    // Все события соединения обрабатывает один рабочий поток: по очереди и с состоянием в его кэше
+    connection->worker = reactor->queues != NULL ? connection->connectionfd % reactor->queueCount : 0;
+}
+
+// Заводим соединение для принятого сокета, -2 если его пришлось закрыть, -3 если адрес превысил лимит соединений
+// addr - адрес клиента, NULL если сокет принят без него
+int addAcceptedConnection(struct Reactor *reactor, int connectionfd, const struct sockaddr *addr) {
+    // Лимит проверяем до записи в таблице соединений: лишнее соединение обходится в accept и close
+    struct RateKey source;
+    if (addr != NULL) {
+        getRateKey(addr, &source);
+    } else if (isRateLimited(RATE_CONNECT) || isRateLimited(RATE_AUTH)) {
+        getPeerRateKey(connectionfd, &source);
+    } else {
+        memset(&source, 0, sizeof(source));
+    }
+    if (!takeRateToken(&source, RATE_CONNECT)) {
+        addMetric(METRIC_RATE_LIMITED, 1);
+        // Сбрасываем соединение: у сервера не остаётся сокетов в TIME_WAIT
+        struct linger reset = {1, 0};
+        setsockopt(connectionfd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+        close(connectionfd);
+        return -3;
+    }
+    // Соединение регистрируется до добавления в epoll, чтобы первое событие его уже нашло
+    struct Connection *connection = addConnectionIntoList(connectionfd);
+    if (connection == NULL) {
+        fprintf(stderr, "Adding connection %d into list\n", connectionfd);
+        close(connectionfd);
+        return -2;
+    }
+    connection->source = source;
+    assignReactor(reactor, connection);
+    scheduleConnectionTimeout(connection);
+    enableNoDelay(connectionfd);
+    if (addToEpoll(reactor->epollfd, connectionfd, EPOLLET | EPOLLIN) == -1) {
+        fprintf(stderr, "Adding connection to epoll\n");
+        removeConnectionFromList(connection);
+        close(connectionfd);
+        return -2;
     }
-    pthread_mutex_unlock(&connectionsMutex);
+    addGauge(GAUGE_AUTHENTICATING, 1);
+    return connectionfd;
 }
 
 // Добавляем новое соединение в epoll
-int acceptConnection() {
-    struct sockaddr addr;
+int acceptConnection(struct Reactor *reactor) {
+    struct sockaddr_storage addr;
     socklen_t addrlen = sizeof(addr);
-    int connectionfd = accept(socketfd, &addr, &addrlen);
-
+    // Дескриптор сразу неблокирующийся, отдельный fcntl не нужен
+    int connectionfd = accept4(reactor->socketfd, (struct sockaddr *)&addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
     if (connectionfd == -1) {
-        perror("acception connection error");
         return -1;
     }
-    if (setNonBlock(connectionfd) == -1) {
-        fprintf(stderr, "Making connection descriptor %d non-block error\n", connectionfd);
-        return -1;
+    return addAcceptedConnection(reactor, connectionfd, (struct sockaddr *)&addr);
+}
+
+
+// Закрываем канал или pidfd команды
+void closeCommandFd(int *fd) {
+    unregisterConnectionFd(*fd);
+    close(*fd);
+    *fd = -1;
+}
+
+// Закрываем дескрипторы канала, у оболочки ввод и вывод - один ptm
+void closeChannelFds(struct Channel *channel) {
+    struct ExecSession *exec = &channel->exec;
+    if (exec->in == exec->out) {
+        exec->in = -1;
     }
-    if (addToEpoll(epollfd, connectionfd, EPOLLET | EPOLLIN) == -1) {
-        fprintf(stderr, "Adding connection to epoll\n");
-        return -1;
+    int *fds[] = {&exec->in, &exec->out, &exec->err, &exec->pidfd};
+    for (int i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (*fds[i] != -1) {
+            closeCommandFd(fds[i]);
+        }
     }
-    addConnectionIntoList(connectionfd);
-    return connectionfd;
 }
 
+// Закрываем каналы отключившегося клиента
+void destroyChannels(struct Connection *connection) {
+    struct ChannelTable *table = &connection->channels;
+    for (int id = 0; id < table->size; id++) {
+        struct Channel *channel = table->items[id];
+        if (channel == NULL) {
+            continue;
+        }
+        if (!channel->shell) {
+            killCommand(&channel->exec);
+        } else {
+            killShell(&channel->process);
+        }
+        closeChannelFds(channel);
+        releaseChannel(table, channel);
+    }
+    destroyChannelTable(table);
+}
+
+// Выводим степень сжатия и процессорное время сжатия сессии
+void reportCompression(struct Connection *connection) {
+    struct Compressor *compressor = &connection->compressor;
+    if (compressor->bytesIn == 0) {
+        return;
+    }
+    double milliseconds = compressor->nanoseconds / 1e6;
+    fprintf(stderr, "Connection %d %s compression: %lu -> %lu bytes, ratio %.2f, cpu %.3f ms, %.1f MB/s\n",
+            connection->connectionfd, getCompressionName(compressor->algorithm), compressor->bytesIn,
+            compressor->bytesOut, (double)compressor->bytesIn / (compressor->bytesOut > 0 ? compressor->bytesOut : 1),
+            milliseconds, milliseconds > 0 ? compressor->bytesIn / 1e3 / milliseconds : 0);
+}
 
 // Закрываем соединение
 int closeConnection(struct Connection *connection) {
-    if (close(connection->connectionfd) == -1) {
+    if (connection->timers != NULL) {
+        cancelTimer(connection->timers, &connection->timer);
+    }
+    // Пока в кольце есть операции соединения, структуру и дескрипторы освобождать нельзя:
+    // отменяем операции, а закроем соединение по последнему завершению
+    struct UringSession *session = &connection->uring;
+    if (session->active) {
+        struct Uring *uring = connection->reactor->uring;
+        if (session->ops > 0) {
+            if (!session->closing) {
+                session->closing = 1;
+                prepUringCancel(uring, connection->connectionfd, URING_OP_CANCEL);
+                prepUringCancel(uring, connection->ptm, URING_OP_CANCEL);
+            }
+            return 0;
+        }
+        releaseUringStream(uring, &session->toPty);
+        releaseUringStream(uring, &session->toClient);
+        session->active = 0;
+    }
+    int connectionfd = connection->connectionfd;
+    int ptm = connection->ptm;
+    if (connection->auth.status < AUTHENTICATED) {
+        addGauge(GAUGE_AUTHENTICATING, -1);
+    }
+    if (ptm != -1 || connection->exec.active || connection->channels.active) {
+        addGauge(GAUGE_SESSIONS, -1);
+    }
+    // Команды и оболочки каналов без клиента не нужны
+    struct ExecSession *exec = &connection->exec;
+    killCommand(exec);
+    destroyChannels(connection);
+    reportCompression(connection);
+    closeAuditSession(connection->auditSession);
+    int commandFds[] = {exec->out, exec->err, exec->pidfd};
+    struct Shell shell = connection->shell;
+    // Сначала убираем дескрипторы из таблицы, потом закрываем: номер может сразу переиспользоваться
+    removeConnectionFromList(connection);
+    // Оболочка ещё работает: клиент отключился или сработал таймаут
+    killShell(&shell);
+    if (ptm != -1 && close(ptm) == -1) {
+        perror("closing ptm");
+    }
+    for (int i = 0; i < sizeof(commandFds) / sizeof(commandFds[0]); i++) {
+        if (commandFds[i] != -1) {
+            close(commandFds[i]);
+        }
+    }
+    initExecSession(exec);
+    destroyCompressor(&connection->compressor);
+    destroyRelay(&connection->toPty);
+    destroyRelay(&connection->toClient);
+    destroyInputBuffer(&connection->input);
+    if (close(connectionfd) == -1) {
         perror("closing connection");
         return -1;
     }
-    removeConnectionFromList(connection);
     return 0;
 }
 
 // Проверяем не наступил ли таймаут соединения
-// Обновляем если не наступил
-// Возвращаем 0, если таймаут не наступил и был обновлен
-// Возвращаем 1, если таймаут наступил
+// Возвращаем 0, если таймаут не наступил и таймер перенесён
+// Возвращаем 1, если таймаут наступил и соединение закрыто
 int checkConnectionTimeout(struct Connection *connection) {
-    if (difftime(time(NULL), connection->lastRequest) > CONNECTION_TIMEOUT) {
+    time_t deadline = getConnectionDeadline(connection);
+    if (deadline != 0 && getCoarseTime() >= deadline) {
         fprintf(stderr, "Connection %d closed on timeout\n", connection->connectionfd);
+        addMetric(METRIC_TIMEOUTS, 1);
         if (closeConnection(connection) == -1) {
             fprintf(stderr, "Error: closing connection on timeout\n");
             return -1;
         }
         return 1;
-    } else {
-        connection->lastRequest = time(NULL);
-        return 0;
-    }
-}
-
-// Ищем и соединение в массиве
-struct Connection *getConnection(int fd) {
-    struct Connection *result = NULL;
-    pthread_mutex_lock(&connectionsMutex);
-    for (int i = 0; i < sizeof(connections)/sizeof(connections[0]); i++) {
-        if (fd == connections[i].connectionfd || fd == connections[i].ptm)
-            result = &connections[i];
     }
-    pthread_mutex_unlock(&connectionsMutex);
-    return result;
+    scheduleConnectionTimeout(connection);
+    return 0;
 }
 
 // Проверяем аутентификацию
@@ -250,40 +500,81 @@ int checkAuthentication(struct Connection *connection) {
     return 0;
 }
 
-// Посылаем сообщение
-int sendMsg(int fd, char *msg) {
-    intmax_t count = write(fd, msg, strlen(msg));
-    if (count != strlen(msg)) {
-        return -1;
+// Включаем или выключаем ожидание EPOLLOUT для сокета или ptm соединения
+void watchWritable(struct Connection *connection, int fd, int flag, int enable) {
+    if (((connection->writeWatched & flag) != 0) == (enable != 0)) {
+        return;
+    }
+    if (changeEpoll(connection->epollfd, fd, EPOLLET | EPOLLIN | (enable ? EPOLLOUT : 0)) == -1) {
+        return;
+    }
+    if (enable) {
+        connection->writeWatched |= flag;
+    } else {
+        connection->writeWatched &= ~flag;
+    }
+}
+
+// Посылаем данные клиенту
+// Если сокет не принимает данные, остаток уходит в буфер соединения и досылается по EPOLLOUT
+int sendData(struct Connection *connection, const char *data, size_t length) {
+    struct OutputBuffer *output = &connection->toClient.buffer;
+    ssize_t count = 0;
+    if (output->length == 0) {
+        count = write(connection->connectionfd, data, length);
+        if (count == -1) {
+            if (errno != EAGAIN && errno != EINTR) {
+                return -1;
+            }
+            count = 0;
+        }
+    }
+    if (count < length) {
+        if (appendOutput(output, data + count, length - count) == -1) {
+            return -1;
+        }
+        watchWritable(connection, connection->connectionfd, WATCH_SOCKET, 1);
     }
     return 0;
 }
 
+// Посылаем сообщение
+int sendMsg(struct Connection *connection, char *msg) {
+    return sendData(connection, msg, strlen(msg));
+}
+
 // Получаем пару логин-пароль по логину
-struct PassPair *getPair(char *login) {
-    char *result = cleanString(login);
-    for (int i = 0; i < lengthPassPairs; i++) {
-        if (strncmp(passPairs[i].login, result, strlen(passPairs[i].login)) == 0) {
-            return &passPairs[i];
-        }
+// Пара лежит в текущей версии базы и действительна только до rcuReadUnlock
+const struct PassPair *getPair(const char *login, size_t length) {
+    return findPassPair(&atomic_load(&credentials)->index, login, length);
+}
+
+// Сверяем пароль, пара ищется в актуальной версии базы
+int verifyPassword(const char *login, size_t loginLength, const char *password, size_t length) {
+    int result = -1;
+    rcuReadLock();
+    const struct PassPair *pair = getPair(login, loginLength);
+    if (pair != NULL && strnlen(pair->pass, MAX_PASS_LEN) == length && memcmp(pair->pass, password, length) == 0) {
+        result = 0;
     }
-    fprintf(stderr, "Wrong login: %s\n", result);
-    return NULL;
+    rcuReadUnlock();
+    if (result == -1) {
+        fprintf(stderr, "Login: %.*s\nWrong password\n", (int)loginLength, login);
+    }
+    return result;
 }
 
-// Сверяем пароль
-int verifyPassword(struct PassPair *pair, char *password) {
-    char *result = cleanString(password);
-    if (strncmp(pair->pass, result, strlen(pair->pass)) != 0) {
-        fprintf(stderr, "Login: %s\nWrong password: %s\n", pair->login, result);
+// Проверка пароля в потоке пула аутентификации
+int verifyAuthRequest(struct AuthRequest *request) {
+    if (request->passwordLength > MAX_PASS_LEN) {
         return -1;
     }
-    return 0;
+    return verifyPassword(request->login, request->loginLength, request->password, request->passwordLength);
 }
 
 // Запрашиваем логин
 int requestLogin(struct Connection *connection) {
-    if (sendMsg(connection->connectionfd, "Enter login: ") == -1) {
+    if (sendMsg(connection, "Enter login: ") == -1) {
         fprintf(stderr, "Error: sending login msg\n");
         return -1;
     }
@@ -293,7 +584,7 @@ int requestLogin(struct Connection *connection) {
 
 // Запрашиваем пароль
 int requestPassword(struct Connection *connection) {
-    if (sendMsg(connection->connectionfd, "Enter password: ") == -1) {
+    if (sendMsg(connection, "Enter password: ") == -1) {
         fprintf(stderr, "Error: sending password msg\n");
         return -1;
     }
@@ -301,375 +592,2473 @@ int requestPassword(struct Connection *connection) {
     return 0;
 }
 
+// Отрезаем от логина префикс режима, 1 если префикс был
+int cutLoginPrefix(struct LineView *login, const char *prefix) {
+    size_t prefixLength = strlen(prefix);
+    if (login->length <= prefixLength || memcmp(login->data, prefix, prefixLength) != 0) {
+        return 0;
+    }
+    login->data += prefixLength;
+    login->length -= prefixLength;
+    return 1;
+}
+
+// Отрезаем от логина запрос сжатия "compress <алгоритм> " и выбираем алгоритм
+// Неизвестный или не собранный алгоритм не ошибка: клиент получит ответ "none"
+void cutCompressionPrefix(struct Compressor *compressor, struct LineView *login) {
+    compressor->algorithm = COMPRESS_NONE;
+    compressor->requested = cutLoginPrefix(login, COMPRESS_PREFIX);
+    if (!compressor->requested) {
+        return;
+    }
+    const char *space = memchr(login->data, ' ', login->length);
+    size_t length = space != NULL ? space - login->data + 1 : login->length;
+    compressor->algorithm = parseCompression(login->data, space != NULL ? length - 1 : length);
+    login->data += length;
+    login->length -= length;
+}
+
 // Проверяем логин
-int checkLogin(struct Connection *connection) {
-    char *login = NULL;
-    if (readNonBlock(connection->connectionfd, &login, 0) == -1) {
-        fprintf(stderr, "Error: receiving login from connection %d\n", connection->connectionfd);
-        return -1;
+// Логин с префиксом EXEC_PREFIX выбирает режим выполнения команд без терминала,
+// с префиксом MUX_PREFIX - режим каналов, перед ними может стоять запрос сжатия COMPRESS_PREFIX
+int checkLogin(struct Connection *connection, struct LineView *line) {
+    struct LineView name = *line;
+    struct LineView *login = &name;
+    cutCompressionPrefix(&connection->compressor, login);
+    connection->exec.requested = cutLoginPrefix(login, EXEC_PREFIX);
+    connection->channels.requested = !connection->exec.requested && cutLoginPrefix(login, MUX_PREFIX);
+    // Сжимается только вывод оболочки, у режимов команд и каналов свои кадры
+    if (connection->exec.requested || connection->channels.requested) {
+        connection->compressor.algorithm = COMPRESS_NONE;
     }
-    connection->pair = getPair(login);
-    if (connection->pair == NULL) {
-        if (sendMsg(connection->connectionfd, "Wrong login, try again\n") == -1) {
+    rcuReadLock();
+    int found = getPair(login->data, login->length) != NULL;
+    rcuReadUnlock();
+    if (!found) {
+        fprintf(stderr, "Wrong login: %.*s\n", (int)login->length, login->data);
+        addMetric(METRIC_AUTH_FAILURE, 1);
+        if (sendMsg(connection, "Wrong login, try again\n") == -1) {
             fprintf(stderr, "Error: sending wrong login msg\n");
             return -1;
         }
-        requestLogin(connection);
-    } else {
-        connection->auth.status = PASSWORD_REQUEST;
-        requestPassword(connection);
+        return requestLogin(connection);
     }
-    free(login);
-    return 0;
+    memcpy(connection->login, login->data, login->length);
+    connection->loginLength = login->length;
+    connection->auth.status = PASSWORD_REQUEST;
+    return requestPassword(connection);
 }
 
-// Проверяем пароль
-int checkPassword(struct Connection *connection) {
-    char *password = NULL;
-    if (readNonBlock(connection->connectionfd, &password, 0) == -1) {
-        fprintf(stderr, "Error: receiving password from connection %d\n", connection->connectionfd);
-        return -1;
+// Разбираем лимит "<в секунду>[:<корзина>]"
+int parseRateLimit(const char *text, struct RateLimit *limit) {
+    char *end;
+    limit->rate = (unsigned int)strtoul(text, &end, 10);
+    limit->burst = 0;
+    if (*end == ':') {
+        limit->burst = (unsigned int)strtoul(end + 1, &end, 10);
     }
-    if (verifyPassword(connection->pair, password) == -1) {
+    return end == text || *end != '\0' ? -1 : 0;
+}
+
+// Начинаем запись сессии в журнал аудита: ввод клиента и вывод оболочки
+void startAuditSession(struct Connection *connection) {
+    connection->auditSession = openAuditSession(connection->login, connection->loginLength);
+    connection->toPty.audit = (struct AuditTag){connection->auditSession, AUDIT_INPUT, 0};
+    connection->toClient.audit = (struct AuditTag){connection->auditSession, AUDIT_OUTPUT, 0};
+}
+
+// Записываем в журнал аудита данные потока stream сессии
+void auditConnection(struct Connection *connection, char kind, int stream, const char *data, size_t length) {
+    struct AuditTag tag = {connection->auditSession, kind, stream};
+    auditData(&tag, data, length);
+}
+
+// Продолжаем аутентификацию по результату проверки пароля
+int completePassword(struct Connection *connection, int result) {
+    if (result == -1) {
+        addMetric(METRIC_AUTH_FAILURE, 1);
         if (connection->auth.attempts == MAX_PASSWORD_ATTEMPTS) {
-            fprintf(stderr, "Many password enter attempts for user: %s\n", connection->pair->login);
-            if (sendMsg(connection->connectionfd, "Too many password enter attempts\n") == -1) {
+            fprintf(stderr, "Many password enter attempts for user: %.*s\n", (int)connection->loginLength, connection->login);
+            if (sendMsg(connection, "Too many password enter attempts\n") == -1) {
                 fprintf(stderr, "Error: sending wrong too many attempts msg\n");
-                return -1;
             }
-            closeConnection(connection);
             return -1;
         }
-        if (sendMsg(connection->connectionfd, "Wrong password, try again\n\n") == -1) {
+        if (sendMsg(connection, "Wrong password, try again\n\n") == -1) {
             fprintf(stderr, "Error: sending wrong password msg\n");
             return -1;
         }
         connection->auth.attempts++;
-        requestPassword(connection);
-    } else {
-        if (sendMsg(connection->connectionfd, "Authentication complete!\n") == -1) {
-            fprintf(stderr, "Error: sending password msg\n");
+        return requestPassword(connection);
+    }
+    if (sendMsg(connection, "Authentication complete!\n") == -1) {
+        fprintf(stderr, "Error: sending password msg\n");
+        return -1;
+    }
+    // Ответ на запрос сжатия: после этой строки вывод сессии идёт сжатым потоком
+    if (connection->compressor.requested) {
+        char reply[32];
+        snprintf(reply, sizeof(reply), "Compression: %s\n", getCompressionName(connection->compressor.algorithm));
+        if (sendMsg(connection, reply) == -1) {
             return -1;
         }
-        connection->auth.status = AUTHENTICATED;
     }
-    free(password);
+    connection->auth.status = AUTHENTICATED;
+    startAuditSession(connection);
+    addMetric(METRIC_AUTH_SUCCESS, 1);
+    addGauge(GAUGE_AUTHENTICATING, -1);
     return 0;
 }
 
-// Пройти аутентификацию
-int passAuthentication(struct Connection *connection) {
+// Отправляем пароль на проверку в пул аутентификации, ответ придёт событием EVENT_AUTH
+int submitPassword(struct Connection *connection, struct LineView *password) {
+    struct AuthRequest request;
+    memset(&request, 0, sizeof(request));
+    request.fd = connection->connectionfd;
+    request.generation = connection->generation;
+    request.owner = connection->reactor;
+    memcpy(request.login, connection->login, connection->loginLength);
+    request.loginLength = connection->loginLength;
+    memcpy(request.password, password->data, password->length < MAX_PASS_LEN ? password->length : MAX_PASS_LEN);
+    request.passwordLength = password->length;
+    // Статус меняем до отправки: ответ может прийти раньше, чем submitAuth вернёт управление
+    connection->auth.status = PASSWORD_VERIFYING;
+    int status = submitAuth(&authPool, &request);
+    memset(request.password, 0, sizeof(request.password));
+    if (status == -1) {
+        if (sendMsg(connection, "Server is busy, try again\n") == -1) {
+            return -1;
+        }
+        return requestPassword(connection);
+    }
+    return 0;
+}
+
+// Проверяем пароль
+int checkPassword(struct Connection *connection, struct LineView *password) {
+    if (authThreads > 0) {
+        return submitPassword(connection, password);
+    }
+    return completePassword(connection, verifyPassword(connection->login, connection->loginLength, password->data, password->length));
+}
+
+// Обрабатываем одну строку, введённую при аутентификации
+// Каждая проверка логина или пароля забирает жетон адреса клиента: перебор через много соединений
+// упирается в общий лимит адреса, а не в MAX_PASSWORD_ATTEMPTS каждого соединения
+int checkAuthenticationLine(struct Connection *connection, struct LineView *line) {
+    // При перегрузке новых входов не начинаем: проверка пароля и запуск оболочки отняли бы время у открытых сессий
+    if (connection->auth.status == LOGIN_CHECK && isOverloaded()) {
+        addMetric(METRIC_SHED_LOGINS, 1);
+        if (sendMsg(connection, "Server is overloaded, try again later\n") == -1) {
+            fprintf(stderr, "Error: sending overload msg\n");
+        }
+        return -1;
+    }
+    if (!takeRateToken(&connection->source, RATE_AUTH)) {
+        addMetric(METRIC_RATE_LIMITED, 1);
+        if (sendMsg(connection, "Too many attempts, try again later\n") == -1) {
+            fprintf(stderr, "Error: sending rate limit msg\n");
+        }
+        return -1;
+    }
     switch (connection->auth.status) {
-        case LOGIN_REQUEST:
-            requestLogin(connection);
-            break;
         case LOGIN_CHECK:
-            checkLogin(connection);
-            break;
-        case PASSWORD_REQUEST:
-            requestPassword(connection);
-            break;
+            return checkLogin(connection, line);
         case PASSWORD_CHECK:
-            checkPassword(connection);
-            break;
+            return checkPassword(connection, line);
         default:
             fprintf(stderr, "Error: wrong authentication status of connectionfd %d\n", connection->connectionfd);
             return -1;
     }
-    return 0;
 }
 
-int createPty(struct Connection *connection) {
-    int ptm, pts;
-    ptm = posix_openpt(O_RDWR);
-    if (ptm == -1) {
-        perror("creating new plm");
-        return -1;
+// Пройти аутентификацию
+// Читаем сокет большими порциями и разбираем пришедшие целиком строки,
+// строка, разорванная между TCP сегментами, дожидается продолжения в буфере
+// Возвращаем -1, если соединение нужно закрыть
+int passAuthentication(struct Connection *connection) {
+    if (connection->auth.status == LOGIN_REQUEST) {
+        return requestLogin(connection);
     }
-    if (grantpt(ptm) == -1) {
-        perror("granting pt access");
-        return -1;
+    if (connection->auth.status == PASSWORD_REQUEST) {
+        return requestPassword(connection);
+    }
+    for (;;) {
+        int status = readInput(&connection->input, connection->connectionfd);
+        if (status == -1 || status == SOURCE_CLOSED) {
+            return -1;
+        }
+        struct LineView line;
+        int lines = 0;
+        // Пока пароль проверяется, ввод копится в буфере
+        while ((connection->auth.status == LOGIN_CHECK || connection->auth.status == PASSWORD_CHECK)
+                && nextLine(&connection->input, &line)) {
+            lines++;
+            if (checkAuthenticationLine(connection, &line) == -1) {
+                return -1;
+            }
+        }
+        // Остаток ввода после аутентификации уйдёт в оболочку
+        if (connection->auth.status >= PASSWORD_VERIFYING || status == 0) {
+            return 0;
+        }
+        if (lines == 0) {
+            fprintf(stderr, "Error: too long line from connection %d\n", connection->connectionfd);
+            return -1;
+        }
     }
-    if (unlockpt(ptm) == -1) {
-        perror("unlocking pt");
+}
+
+// Сессия передаёт данные через io_uring реактора
+// Сжатый вывод идёт через epoll: его нужно прочитать и сжать до записи в сокет
+int usesUring(struct Reactor *reactor, struct Connection *connection) {
+    return reactor->uring != NULL && connection->compressor.algorithm == COMPRESS_NONE;
+}
+
+// Подключаем ptm оболочки к соединению: каналы передачи, таблица соединений и epoll
+// При ошибке ptm и оболочку освобождает closeConnection
+int attachPty(struct Reactor *reactor, struct Connection *connection, int ptm) {
+    connection->ptm = ptm;
+    addGauge(GAUGE_SESSIONS, 1);
+    // Каналы для splice между сокетом и ptm, на io_uring они не нужны, сжатому выводу - тоже
+    int compressed = connection->compressor.algorithm != COMPRESS_NONE;
+    if (reactor->uring == NULL
+            && (openRelayPipe(&connection->toPty) == -1 || (!compressed && openRelayPipe(&connection->toClient) == -1))) {
+        fprintf(stderr, "Error: creating relay pipes\n");
         return -1;
     }
-    pts = open(ptsname(ptm), O_RDWR);
-    if (pts == -1) {
-        perror("opening pts");
+    if (registerConnectionFd(connection, ptm) == -1) {
+        fprintf(stderr, "Error: adding ptm into connection table\n");
         return -1;
     }
-    if (setNonBlock(ptm) == -1) {
-        fprintf(stderr, "Error: making ptm non-block\n");
+    // Завершение оболочки ждём в epoll и на реакторах io_uring: их кольцо опрашивает epoll
+    int pidfd = connection->shell.pidfd;
+    if (pidfd != -1 && (registerConnectionFd(connection, pidfd) == -1
+                        || addToEpoll(reactor->epollfd, pidfd, EPOLLET | EPOLLIN) == -1)) {
+        fprintf(stderr, "Error: watching shell exit\n");
         return -1;
     }
-    if (setNonBlock(pts) == -1) {
-        fprintf(stderr, "Error: making pts non-block\n");
+    // На io_uring ptm читает кольцо реактора
+    if (usesUring(reactor, connection)) {
+        return 0;
+    }
+    if (addToEpoll(reactor->epollfd, ptm, EPOLLET | EPOLLIN) == -1) {
+        fprintf(stderr, "Error: adding ptm to epoll\n");
         return -1;
     }
+    return 0;
+}
 
-    connection->ptm = ptm;
-    if (addToEpoll(epollfd, ptm, EPOLLET | EPOLLIN) == -1) {
-        fprintf(stderr, "Error: adding ptm to epoll\n");
+// Подключаем соединение к оболочке
+int createPty(struct Reactor *reactor, struct Connection *connection) {
+    int ptm;
+    if (startShell(&connection->shell, &ptm) == -1) {
+        return -1;
+    }
+    if (connection->compressor.algorithm != COMPRESS_NONE && startCompressor(&connection->compressor) == -1) {
+        killShell(&connection->shell);
+        close(ptm);
         return -1;
     }
+    addMetric(METRIC_SPAWNS, 1);
+    return attachPty(reactor, connection, ptm);
+}
 
-    if (fork()) {
-        if (close(pts) == -1) {
-            perror("closing pts in parent process");
-            return -1;
-        }
-    } else {
-        if (close(ptm) == -1) {
-            perror("closing ptm in child process");
-            return -1;
+// Ставим соединение в список сброса пробок реактора, первое - заводит таймер сброса
+// Список общий для рабочих потоков, поэтому под мьютексом: в него попадает только начало массового вывода
+void scheduleFlush(struct Connection *connection) {
+    struct Reactor *reactor = connection->reactor;
+    pthread_mutex_lock(&reactor->flushMutex);
+    if (reactor->flushingCount == reactor->flushingSize) {
+        int size = reactor->flushingSize ? reactor->flushingSize * 2 : 64;
+        struct Event *flushing = (struct Event *)realloc(reactor->flushing, size * sizeof(struct Event));
+        if (flushing == NULL) {
+            pthread_mutex_unlock(&reactor->flushMutex);
+            fprintf(stderr, "Error: allocating flush list\n");
+            flushCoalesced(&connection->coalescer, connection->connectionfd);
+            return;
         }
-        struct termios oldSettings, newSettings;
-        if (tcgetattr(pts, &oldSettings) == -1) {
-            perror("getting old terminal settings\n");
-            return -1;
-        }
-        newSettings = oldSettings;
-        cfmakeraw(&newSettings);
-        if (tcsetattr(pts, TCSANOW, &newSettings) == -1) {
-            perror("setting new terminal settings\n");
-            return -1;
+        reactor->flushing = flushing;
+        reactor->flushingSize = size;
+    }
+    struct Event event = {connection->connectionfd, 0, EVENT_FLUSH, connection->generation};
+    reactor->flushing[reactor->flushingCount++] = event;
+    if (reactor->flushingCount == 1) {
+        struct itimerspec delay;
+        memset(&delay, 0, sizeof(delay));
+        delay.it_value.tv_nsec = COALESCE_FLUSH_DELAY_US * 1000L;
+        if (timerfd_settime(reactor->flushTimerfd, 0, &delay, NULL) == -1) {
+            perror("arming flush timer");
         }
-        close(0);
-        close(1);
-        close(2);
-
-        dup(pts);
-        dup(pts);
-        dup(pts);
+    }
+    pthread_mutex_unlock(&reactor->flushMutex);
+}
 
-        close(pts);
+// Передаём данные сессии в одну сторону
+// Если получатель переполнен, ждём от него EPOLLOUT, а источник не читаем до освобождения
+int relaySession(struct Connection *connection, int toClient) {
+    struct Relay *relay = toClient ? &connection->toClient : &connection->toPty;
+    int dest = toClient ? connection->connectionfd : connection->ptm;
+    int source = toClient ? connection->ptm : connection->connectionfd;
+    size_t received = relay->received;
+    int status = toClient && connection->compressor.algorithm != COMPRESS_NONE
+                 ? relayCompressed(relay, &connection->compressor, dest, source)
+                 : relayMessage(relay, dest, source);
+    addMetric(toClient ? METRIC_BYTES_TO_CLIENT : METRIC_BYTES_TO_PTY, relay->received - received);
+    if (toClient && (relay->pipefd[0] == -1 || !atomic_load(&spliceEnabled)) && connection->compressor.algorithm == COMPRESS_NONE) {
+        // Копирование через буфер: проход учитывается целиком после записи
+        coalesceChunk(&connection->coalescer, dest, relay->received - received);
+    }
+    if (toClient && finishCoalescing(&connection->coalescer, dest, status == DEST_BLOCKED)) {
+        scheduleFlush(connection);
+    }
+    // Вывод в ответ на ввод - интерактивный, долгий вывод без ввода - массовый
+    size_t moved = relay->received - received;
+    if (moved > 0) {
+        connection->outputSinceInput = toClient ? connection->outputSinceInput + moved : 0;
+        atomic_store_explicit(&connection->bulk, connection->outputSinceInput >= SHED_BULK_BYTES, memory_order_relaxed);
+    }
+    if (status == 0 || status == DEST_BLOCKED) {
+        watchWritable(connection, dest, toClient ? WATCH_SOCKET : WATCH_PTM, status == DEST_BLOCKED);
+    }
+    return status;
+}
 
-        setsid();
+// Ставим в кольцо чтение и запись обоих направлений сессии
+void pumpUringSession(struct Connection *connection) {
+    struct Uring *uring = connection->reactor->uring;
+    uint64_t base = (uint64_t)(uintptr_t)connection;
+    pumpUringStream(uring, &connection->uring, &connection->uring.toPty, base);
+    pumpUringStream(uring, &connection->uring, &connection->uring.toClient, base);
+}
 
-        ioctl(0, TIOCSCTTY, 1);
-        execvp("/bin/bash", NULL);
+// Переводим сессию на io_uring: сокет уходит из epoll, данные передаются без системных вызовов на каждый кусок
+int startUringSession(struct Reactor *reactor, struct Connection *connection) {
+    int connectionfd = connection->connectionfd;
+    // Кольцо само ждёт данных, на неблокирующемся дескрипторе чтение вернёт EAGAIN
+    if (epoll_ctl(reactor->epollfd, EPOLL_CTL_DEL, connectionfd, NULL) == -1
+            || setBlock(connectionfd) == -1 || setBlock(connection->ptm) == -1) {
+        perror("moving session to io_uring");
+        closeConnection(connection);
+        return -1;
     }
+    struct UringSession *session = &connection->uring;
+    // Накопленные ввод и сообщения сервера записываются первыми
+    initUringStream(&session->toPty, connectionfd, 1, connection->ptm, 0,
+                    URING_OP_READ_CLIENT, URING_OP_WRITE_PTM, &connection->toPty.buffer);
+    initUringStream(&session->toClient, connection->ptm, 0, connectionfd, 1,
+                    URING_OP_READ_PTM, URING_OP_WRITE_CLIENT, &connection->toClient.buffer);
+    session->active = 1;
+    pumpUringSession(connection);
     return 0;
 }
 
-// Обрабатываем новое сообщение
-int handleEvent(int fd) {
-    struct Connection *connection = getConnection(fd);
-    if (connection == NULL) {
-        fprintf(stderr, "Error: connection from epoll wasn't found in list\n");
-        return -1;
-    }
-    if (checkConnectionTimeout(connection) == 1) {
-        return 0;
-    }
-    if (checkAuthentication(connection) > 0) {
-        passAuthentication(connection);
-    } else {
-        if (connection->ptm == -1) {
-            if (createPty(connection) == -1) {
-                fprintf(stderr, "Error: creating new pty\n");
+// Буфер чтения вывода команд, один на поток
+// Вывод читается в COMMAND_OUTPUT, перед ним остаётся место для заголовка кадра
+static __thread char commandBuffer[CHANNEL_HEADER_SIZE + EXEC_CHUNK_SIZE];
+#define COMMAND_OUTPUT (commandBuffer + CHANNEL_HEADER_SIZE)
+
+// Отправляем кадр с выводом из COMMAND_OUTPUT: заголовок кладём прямо перед данными
+// и пишем кадр одним вызовом, при TCP_NODELAY заголовок не уходит отдельным сегментом
+int sendOutputFrame(struct Connection *connection, const char *header, int headerLength, size_t length) {
+    char *frame = COMMAND_OUTPUT - headerLength;
+    memcpy(frame, header, (size_t)headerLength);
+    return sendData(connection, frame, (size_t)headerLength + length);
+}
+
+// Передаём вывод команды из канала кадрами типа type
+// Пока клиент не принял OUTPUT_HIGH_WATER байт, канал не читаем и команда ждёт на записи
+int readCommandPipe(struct Connection *connection, int *fd, char type) {
+    while (*fd != -1 && connection->toClient.buffer.length < OUTPUT_HIGH_WATER) {
+        ssize_t count = read(*fd, COMMAND_OUTPUT, EXEC_CHUNK_SIZE);
+        if (count > 0) {
+            addMetric(METRIC_BYTES_TO_CLIENT, count);
+            auditConnection(connection, AUDIT_OUTPUT, 0, COMMAND_OUTPUT, (size_t)count);
+            char header[EXEC_FRAME_HEADER_SIZE];
+            if (sendOutputFrame(connection, header, formatFrameHeader(header, type, count), (size_t)count) == -1) {
                 return -1;
             }
+            continue;
         }
-        if (fd == connection->connectionfd) {
-            sendMessage(connection->ptm, connection->connectionfd);
-        } else {
-            sendMessage(connection->connectionfd, connection->ptm);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count == -1 && errno == EAGAIN) {
+            return 0;
+        }
+        if (count == -1) {
+            perror("reading command output");
         }
+        closeCommandFd(fd);
     }
     return 0;
 }
 
-// Обрабатываем событие
-void *worker(void *args) {
-    // Получаем аргументы в новом потоке
-    struct WorkerArgs *workerArgs = args;
-    while (!done) {
-        // Ожидание поступления события в очередь
-        pthread_mutex_lock(workerArgs->mutex);
-        while (isEmptyQueue(workerArgs->queue)) {
-            pthread_cond_wait(workerArgs->condition, workerArgs->mutex);
-        }
-        struct epoll_event event;
-        popQueue(workerArgs->queue, &event);
-        pthread_mutex_unlock(workerArgs->mutex);
-        if (event.data.fd == socketfd) {
-            int connectionfd = acceptConnection();
-            if (connectionfd == -1) {
-                fprintf(stderr, "Error: accepting new connection\n");
-                continue;
-            }
-            if (handleEvent(connectionfd) == -1) {
-                fprintf(stderr, "Error: handling event\n");
-                continue;
-            }
-        } else {
-            if (handleEvent(event.data.fd) == -1) {
-                fprintf(stderr, "Error: handling event\n");
-                continue;
-            }
+// Запускаем команду, её каналы и pidfd обрабатываются событиями epoll соединения
+int runCommand(struct Connection *connection, struct LineView *line) {
+    struct ExecSession *exec = &connection->exec;
+    auditConnection(connection, AUDIT_INPUT, 0, line->data, line->length);
+    if (spawnCommand(exec, line->data, line->length, 0) == -1) {
+        char header[EXEC_FRAME_HEADER_SIZE];
+        int length = formatFrameHeader(header, EXEC_FRAME_EXIT, EXEC_SPAWN_FAILED);
+        return sendData(connection, header, (size_t)length);
+    }
+    addMetric(METRIC_SPAWNS, 1);
+    // Готовность, наступившая до добавления в epoll, придёт первым событием
+    int fds[] = {exec->out, exec->err, exec->pidfd};
+    for (int i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (fds[i] != -1 && (registerConnectionFd(connection, fds[i]) == -1
+                             || addToEpoll(connection->epollfd, fds[i], EPOLLET | EPOLLIN) == -1)) {
+            return -1;
         }
     }
-    return NULL;
+    return 0;
 }
 
-// Читаем пароли из файла
-int readPasswordsFromFile(char *path) {
-    struct PassPair *passwords;
-    int size = 8;
-    passwords = (struct PassPair *)malloc(size * sizeof(struct PassPair));
-    FILE *ptr;
-    ptr = fopen(path, "r");
-    if (ptr == NULL) {
-        perror("opening passwords file");
-        return -1;
-    }
-    intmax_t count;
-    size_t length = 0;
-    do {
-        count = fread(passwords, sizeof(struct PassPair), 1, ptr);
-        length += count;
-        if (size == length) {
-            size *= 2;
-            passwords = (struct PassPair *)realloc(passwords, size * sizeof(struct PassPair));
-        }
-    } while (count == sizeof(struct PassPair));
-    passPairs = (struct PassPair *)malloc(length * sizeof(struct PassPair));
-    memcpy(passPairs, passwords, length * sizeof(struct PassPair));
-    lengthPassPairs = length;
-    free(passwords);
-    fclose(ptr);
-    return 0;
+// Есть ли в буфере целая строка
+int hasLine(struct InputBuffer *input) {
+    return input->length > 0 && memchr(input->data + input->start, '\n', input->length) != NULL;
 }
 
-void *watchTimeout(void *args) {
-    while (!done) {
-        sleep(TIMEOUT_WATCHER_FREQUENCY);
-        pthread_mutex_lock(&connectionsMutex);
-        for (int i = 0; i < sizeof(connections)/sizeof(connections[0]); i++) {
-            if (connections[i].connectionfd != 0) {
-                checkConnectionTimeout(&connections[i]);
+// Запускаем следующую команду из ввода клиента: одна строка - одна команда,
+// пока команда выполняется, следующие ждут в буфере и в сокете
+// Возвращаем -1, если соединение нужно закрыть
+int serveCommands(struct Connection *connection) {
+    struct ExecSession *exec = &connection->exec;
+    struct InputBuffer *input = &connection->input;
+    while (exec->pid == -1) {
+        struct LineView line;
+        if (nextLine(input, &line)) {
+            if (line.length > 0 && runCommand(connection, &line) == -1) {
+                return -1;
+            }
+            continue;
+        }
+        // Клиент закрыл передачу: закрываем соединение, когда он получит весь вывод
+        if (exec->inputClosed) {
+            return connection->toClient.buffer.length == 0 ? -1 : 0;
+        }
+        int status = readInput(input, connection->connectionfd);
+        if (status == -1) {
+            return -1;
+        }
+        if (status == SOURCE_CLOSED) {
+            exec->inputClosed = 1;
+        } else if (!hasLine(input)) {
+            if (status == INPUT_FULL) {
+                fprintf(stderr, "Error: too long command from connection %d\n", connection->connectionfd);
+                return -1;
             }
+            return 0;
         }
-        pthread_mutex_unlock(&connectionsMutex);
     }
-    return NULL;
+    return 0;
 }
 
-///////////////////////////////////////////////////////////////////////////////
-//
-// MAIN
-//
-///////////////////////////////////////////////////////////////////////////////
-int main(int argc, char *argv[]) {
-    // Обработка сигнала
-    struct sigaction act;
-    memset(&act, 0, sizeof(act));
-    act.sa_handler = handleSigInt;
-    sigaction(SIGINT, &act, 0);
+// Передаём клиенту вывод команды, после конца вывода и завершения - код завершения
+int pumpCommand(struct Connection *connection) {
+    struct ExecSession *exec = &connection->exec;
+    if (exec->pid == -1) {
+        return 0;
+    }
+    if (readCommandPipe(connection, &exec->out, EXEC_FRAME_STDOUT) == -1
+            || readCommandPipe(connection, &exec->err, EXEC_FRAME_STDERR) == -1) {
+        return -1;
+    }
+    if (exec->out != -1 || exec->err != -1) {
+        return 0;
+    }
+    // Без pidfd ждём завершения сразу: вывод закрыт, команда заканчивает работу
+    if (exec->pidfd == -1 && exec->status == -1) {
+        reapCommand(exec, 1);
+    }
+    if (exec->status == -1) {
+        return 0;
+    }
+    char header[EXEC_FRAME_HEADER_SIZE];
+    int length = formatFrameHeader(header, EXEC_FRAME_EXIT, exec->status);
+    initExecSession(exec);
+    if (sendData(connection, header, (size_t)length) == -1) {
+        return -1;
+    }
+    return serveCommands(connection);
+}
+
+// Событие соединения в режиме команд: сокет клиента, канал вывода или pidfd команды
+int handleExecEvent(struct Connection *connection, int fd, uint32_t events) {
+    struct ExecSession *exec = &connection->exec;
+    if (fd == exec->pidfd) {
+        if (reapCommand(exec, 0)) {
+            closeCommandFd(&exec->pidfd);
+        }
+        return pumpCommand(connection);
+    }
+    if (fd == exec->out || fd == exec->err) {
+        return pumpCommand(connection);
+    }
+    // Разрыв соединения, в отличие от закрытия передачи клиентом, прерывает команду
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        return -1;
+    }
+    if (events & EPOLLOUT) {
+        int status = flushOutput(&connection->toClient.buffer, connection->connectionfd);
+        if (status == -1) {
+            return -1;
+        }
+        watchWritable(connection, connection->connectionfd, WATCH_SOCKET, status == 1);
+        // Клиент принял вывод: продолжаем читать каналы команды
+        if (status == 0 && pumpCommand(connection) == -1) {
+            return -1;
+        }
+    }
+    return serveCommands(connection);
+}
+
+// Переводим соединение в режим команд: ввод, пришедший вместе с паролем, - уже команды
+int startExecSession(struct Connection *connection) {
+    connection->exec.active = 1;
+    addGauge(GAUGE_SESSIONS, 1);
+    if (serveCommands(connection) == -1) {
+        closeConnection(connection);
+    }
+    return 0;
+}
+
+// Отправляем кадр канала без данных: тип, номер канала и окно или код завершения
+int sendChannelFrame(struct Connection *connection, char type, int id, long value) {
+    char header[CHANNEL_HEADER_SIZE];
+    int headerLength = formatChannelHeader(header, type, id, value);
+    return sendData(connection, header, (size_t)headerLength);
+}
+
+// Все ли каналы завершены и клиент получил вывод после закрытия им передачи
+int isMuxFinished(struct Connection *connection) {
+    struct ChannelTable *table = &connection->channels;
+    return table->inputClosed && table->count == 0 && connection->toClient.buffer.length == 0;
+}
+
+// Закрываем канал и сообщаем клиенту код завершения, номер канала освобождается
+// Выполняющаяся команда или оболочка завершается и забирается
+// Возвращаем -1, если соединение нужно закрыть
+int closeChannel(struct Connection *connection, struct Channel *channel) {
+    struct ExecSession *exec = &channel->exec;
+    int status = CHANNEL_EXIT_UNKNOWN;
+    if (!channel->shell) {
+        killCommand(exec);
+        status = exec->status;
+    } else {
+        killShell(&channel->process);
+    }
+    int id = channel->id;
+    closeChannelFds(channel);
+    releaseChannel(&connection->channels, channel);
+    if (sendChannelFrame(connection, EXEC_FRAME_EXIT, id, status) == -1) {
+        return -1;
+    }
+    return isMuxFinished(connection) ? -1 : 0;
+}
+
+// Передаём вывод канала кадрами типа type, пока клиент готов его принять
+// При исчерпании окна канала или буфера соединения процесс канала ждёт на записи
+int readChannelPipe(struct Connection *connection, struct Channel *channel, int *fd, char type) {
+    while (*fd != -1 && channel->sendWindow > 0 && connection->toClient.buffer.length < OUTPUT_HIGH_WATER) {
+        size_t size = channel->sendWindow < EXEC_CHUNK_SIZE ? (size_t)channel->sendWindow : EXEC_CHUNK_SIZE;
+        ssize_t count = read(*fd, COMMAND_OUTPUT, size);
+        if (count > 0) {
+            channel->sendWindow -= count;
+            addMetric(METRIC_BYTES_TO_CLIENT, count);
+            auditConnection(connection, AUDIT_OUTPUT, channel->id, COMMAND_OUTPUT, (size_t)count);
+            char header[CHANNEL_HEADER_SIZE];
+            int headerLength = formatChannelHeader(header, type, channel->id, count);
+            if (sendOutputFrame(connection, header, headerLength, (size_t)count) == -1) {
+                return -1;
+            }
+            continue;
+        }
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count == -1 && errno == EAGAIN) {
+            return 0;
+        }
+        // Оболочка завершилась: чтение ptm возвращает EIO
+        if (count == -1 && !(channel->shell && errno == EIO)) {
+            perror("reading channel output");
+        }
+        if (*fd == channel->exec.in) {
+            channel->exec.in = -1;
+        }
+        closeCommandFd(fd);
+    }
+    return 0;
+}
+
+// Передаём клиенту вывод канала, после конца вывода и завершения процесса закрываем канал
+int pumpChannel(struct Connection *connection, struct Channel *channel) {
+    struct ExecSession *exec = &channel->exec;
+    if (readChannelPipe(connection, channel, &exec->out, EXEC_FRAME_STDOUT) == -1
+            || readChannelPipe(connection, channel, &exec->err, EXEC_FRAME_STDERR) == -1) {
+        return -1;
+    }
+    if (exec->out != -1 || exec->err != -1) {
+        return 0;
+    }
+    if (!channel->shell) {
+        if (exec->pidfd == -1 && exec->status == -1) {
+            reapCommand(exec, 1);
+        }
+        if (exec->status == -1) {
+            return 0;
+        }
+    }
+    return closeChannel(connection, channel);
+}
+
+// Клиент принял вывод: продолжаем читать все каналы
+int pumpChannels(struct Connection *connection) {
+    struct ChannelTable *table = &connection->channels;
+    for (int id = 0; id < table->size; id++) {
+        struct Channel *channel = table->items[id];
+        if (channel != NULL && pumpChannel(connection, channel) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Записываем ввод клиента в команду или оболочку канала
+// Записанное возвращаем клиенту кадром окна, когда набирается половина окна
+int writeChannelInput(struct Connection *connection, struct Channel *channel) {
+    struct ExecSession *exec = &channel->exec;
+    struct OutputBuffer *input = &channel->input;
+    size_t length = input->length;
+    int status = exec->in == -1 ? -1 : flushOutput(input, exec->in);
+    addMetric(METRIC_BYTES_TO_PTY, length - input->length);
+    // Команда закрыла ввод или оболочка завершилась: остаток ввода некому читать
+    if (status == -1) {
+        destroyOutputBuffer(input);
+    }
+    channel->consumed += length - input->length;
+    if (!channel->shell && exec->in != -1 && (status == -1 || (status == 0 && channel->inputClosed))) {
+        closeCommandFd(&exec->in);
+    }
+    if (channel->consumed < CHANNEL_WINDOW / 2) {
+        return 0;
+    }
+    long consumed = channel->consumed;
+    channel->receiveWindow += consumed;
+    channel->consumed = 0;
+    return sendChannelFrame(connection, CHANNEL_WINDOW_ADJUST, channel->id, consumed);
+}
+
+// Запускаем в канале оболочку на псевдотерминале
+int startChannelShell(struct Channel *channel) {
+    int ptm;
+    if (startShell(&channel->process, &ptm) == -1) {
+        return -1;
+    }
+    channel->shell = 1;
+    channel->exec.out = ptm;
+    channel->exec.in = ptm;
+    return 0;
+}
+
+// Открываем канал с командой или оболочкой
+// Если процесс не запустился, канал сразу закрывается кадром с кодом EXEC_SPAWN_FAILED
+int openSessionChannel(struct Connection *connection, struct Frame *frame) {
+    struct Channel *channel = openChannel(&connection->channels, frame->channel);
+    if (channel == NULL) {
+        fprintf(stderr, "Error: can't open channel %d of connection %d\n", frame->channel, connection->connectionfd);
+        return -1;
+    }
+    struct ExecSession *exec = &channel->exec;
+    auditConnection(connection, AUDIT_INPUT, frame->channel, frame->data, frame->length);
+    int result = frame->type == CHANNEL_OPEN_SHELL ? startChannelShell(channel)
+                                                  : spawnCommand(exec, frame->data, frame->length, 1);
+    if (result == -1) {
+        releaseChannel(&connection->channels, channel);
+        return sendChannelFrame(connection, EXEC_FRAME_EXIT, frame->channel, EXEC_SPAWN_FAILED);
+    }
+    addMetric(METRIC_SPAWNS, 1);
+    // Ввод ждём по EPOLLOUT, вывод и завершение - по EPOLLIN
+    int fds[] = {exec->out, exec->err, exec->pidfd, channel->shell ? -1 : exec->in};
+    uint32_t events[] = {channel->shell ? EPOLLIN | EPOLLOUT : EPOLLIN, EPOLLIN, EPOLLIN, EPOLLOUT};
+    for (int i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (fds[i] != -1 && (registerChannelFd(connection, fds[i], channel->id) == -1
+                             || addToEpoll(connection->epollfd, fds[i], EPOLLET | events[i]) == -1)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Ввод клиента для канала: сверх окна клиент присылать не должен
+int receiveChannelData(struct Connection *connection, struct Channel *channel, struct Frame *frame) {
+    // Пустой кадр данных ничего не передаёт: не пишем его в журнал и не трогаем буфер ввода
+    if (frame->length == 0) {
+        return 0;
+    }
+    if ((long)frame->length > channel->receiveWindow) {
+        fprintf(stderr, "Error: channel %d of connection %d exceeded its window\n", channel->id, connection->connectionfd);
+        return -1;
+    }
+    channel->receiveWindow -= frame->length;
+    auditConnection(connection, AUDIT_INPUT, channel->id, frame->data, frame->length);
+    if (appendOutput(&channel->input, frame->data, frame->length) == -1) {
+        return -1;
+    }
+    return writeChannelInput(connection, channel);
+}
+
+// Выполняем кадр клиента
+int handleFrame(struct Connection *connection, struct Frame *frame) {
+    if (frame->type == CHANNEL_OPEN_COMMAND || frame->type == CHANNEL_OPEN_SHELL) {
+        return openSessionChannel(connection, frame);
+    }
+    struct Channel *channel = getChannel(&connection->channels, frame->channel);
+    switch (frame->type) {
+    case CHANNEL_DATA:
+    case CHANNEL_EOF:
+    case CHANNEL_WINDOW_ADJUST:
+    case CHANNEL_CLOSE:
+        break;
+    default:
+        fprintf(stderr, "Error: unknown frame '%c' from connection %d\n", frame->type, connection->connectionfd);
+        return -1;
+    }
+    // Канал мог завершиться, пока кадр клиента был в пути
+    if (channel == NULL) {
+        return 0;
+    }
+    switch (frame->type) {
+    case CHANNEL_DATA:
+        return receiveChannelData(connection, channel, frame);
+    case CHANNEL_EOF:
+        channel->inputClosed = 1;
+        return writeChannelInput(connection, channel);
+    case CHANNEL_WINDOW_ADJUST:
+        channel->sendWindow = frame->value > CHANNEL_MAX_WINDOW - channel->sendWindow
+                              ? CHANNEL_MAX_WINDOW : channel->sendWindow + frame->value;
+        return pumpChannel(connection, channel);
+    default:
+        return closeChannel(connection, channel);
+    }
+}
+
+// Выполняем все пришедшие кадры клиента, каналы работают одновременно
+// Память на ввод каналов ограничена их окнами, поэтому сокет читается всегда
+// Возвращаем -1, если соединение нужно закрыть
+int serveFrames(struct Connection *connection) {
+    struct ChannelTable *table = &connection->channels;
+    struct InputBuffer *input = &connection->input;
+    int status = INPUT_FULL;
+    for (;;) {
+        struct Frame frame;
+        int parsed;
+        while ((parsed = nextFrame(input, &frame)) == 1) {
+            if (handleFrame(connection, &frame) == -1) {
+                return -1;
+            }
+        }
+        if (parsed == -1) {
+            fprintf(stderr, "Error: wrong frame from connection %d\n", connection->connectionfd);
+            return -1;
+        }
+        // Клиент закрыл передачу: закрываем соединение, когда каналы завершатся и он получит весь вывод
+        if (table->inputClosed) {
+            return isMuxFinished(connection) ? -1 : 0;
+        }
+        if (status == 0) {
+            return 0;
+        }
+        status = readInput(input, connection->connectionfd);
+        if (status == -1) {
+            return -1;
+        }
+        if (status == SOURCE_CLOSED) {
+            table->inputClosed = 1;
+        }
+    }
+}
+
+// Событие соединения в режиме каналов: сокет клиента или дескриптор канала id
+int handleMuxEvent(struct Connection *connection, int id, int fd, uint32_t events) {
+    struct Channel *channel = getChannel(&connection->channels, id);
+    if (channel != NULL) {
+        struct ExecSession *exec = &channel->exec;
+        if (fd == exec->pidfd) {
+            if (reapCommand(exec, 0)) {
+                closeCommandFd(&exec->pidfd);
+            }
+            return pumpChannel(connection, channel);
+        }
+        if (fd == exec->in && (events & (EPOLLOUT | EPOLLERR)) && writeChannelInput(connection, channel) == -1) {
+            return -1;
+        }
+        if (fd == exec->out || fd == exec->err) {
+            return pumpChannel(connection, channel);
+        }
+        return 0;
+    }
+    // Разрыв соединения завершает все каналы
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        return -1;
+    }
+    if (events & EPOLLOUT) {
+        int status = flushOutput(&connection->toClient.buffer, connection->connectionfd);
+        if (status == -1) {
+            return -1;
+        }
+        watchWritable(connection, connection->connectionfd, WATCH_SOCKET, status == 1);
+        if (status == 0 && pumpChannels(connection) == -1) {
+            return -1;
+        }
+    }
+    return serveFrames(connection);
+}
+
+// Переводим соединение в режим каналов: ввод, пришедший вместе с паролем, - уже кадры
+int startMuxSession(struct Connection *connection) {
+    connection->channels.active = 1;
+    addGauge(GAUGE_SESSIONS, 1);
+    if (serveFrames(connection) == -1) {
+        closeConnection(connection);
+    }
+    return 0;
+}
+
+// Запускаем оболочку и передаём ей ввод, пришедший вместе с паролем
+// В режимах команд и каналов оболочка не нужна: ввод разбирается на команды или кадры
+int startSession(struct Reactor *reactor, struct Connection *connection) {
+    if (connection->exec.requested) {
+        return startExecSession(connection);
+    }
+    if (connection->channels.requested) {
+        return startMuxSession(connection);
+    }
+    if (createPty(reactor, connection) == -1) {
+        fprintf(stderr, "Error: creating new pty\n");
+        closeConnection(connection);
+        return -1;
+    }
+    struct InputBuffer *input = &connection->input;
+    if (input->length > 0 && appendOutput(&connection->toPty.buffer, input->data + input->start, input->length) == -1) {
+        closeConnection(connection);
+        return -1;
+    }
+    auditData(&connection->toPty.audit, input->data + input->start, input->length);
+    destroyInputBuffer(input);
+    if (usesUring(reactor, connection)) {
+        return startUringSession(reactor, connection);
+    }
+    // Сокет может хранить ещё не прочитанные данные, а новых событий по фронту не будет
+    if (relaySession(connection, 0) == SOURCE_CLOSED) {
+        closeConnection(connection);
+    }
+    return 0;
+}
+
+// Оболочка сессии завершилась: забираем её, досылаем клиенту оставшийся вывод и закрываем соединение,
+// не дожидаясь EIO на ptm (его не будет, пока pts держат фоновые процессы) или таймаута бездействия
+// Если клиент не принимает вывод, соединение закроется по EPOLLOUT, когда вывод будет передан
+void handleShellExit(struct Connection *connection) {
+    if (connection->shell.pid != -1) {
+        unregisterConnectionFd(connection->shell.pidfd);
+        reapShell(&connection->shell, 1);
+    }
+    // Вывод в кольце io_uring досылает само кольцо, соединение закроется после последней записи клиенту
+    if (usesUring(connection->reactor, connection)) {
+        if (isUringStreamIdle(&connection->uring.toClient)) {
+            closeConnection(connection);
+        }
+        return;
+    }
+    if (relaySession(connection, 1) != DEST_BLOCKED) {
+        closeConnection(connection);
+    }
+}
+
+// Обрабатываем новое сообщение
+int handleEvent(struct Reactor *reactor, int fd, uint32_t events) {
+    int channel;
+    struct Connection *connection = getConnectionChannel(fd, &channel);
+    if (connection == NULL) {
+        fprintf(stderr, "Error: connection from epoll wasn't found in list\n");
+        return -1;
+    }
+    connection->lastRequest = getCoarseTime();
+    int writable = (events & EPOLLOUT) != 0;
+    int readable = (events & ~EPOLLOUT) != 0;
+    if (checkAuthentication(connection) > 0) {
+        // Досылаем сообщения аутентификации
+        if (writable) {
+            int status = flushOutput(&connection->toClient.buffer, connection->connectionfd);
+            if (status != -1) {
+                watchWritable(connection, connection->connectionfd, WATCH_SOCKET, status == 1);
+            }
+        }
+        if (readable && passAuthentication(connection) == -1) {
+            closeConnection(connection);
+            return 0;
+        }
+        // Оболочку запускаем сразу после аутентификации,
+        // при проверке в пуле её запускает обработчик EVENT_AUTH
+        if (authThreads == 0 && checkAuthentication(connection) == 0) {
+            return startSession(reactor, connection);
+        }
+    } else if (connection->exec.active) {
+        if (handleExecEvent(connection, fd, events) == -1) {
+            closeConnection(connection);
+        }
+    } else if (connection->channels.active) {
+        if (handleMuxEvent(connection, channel, fd, events) == -1) {
+            closeConnection(connection);
+        }
+    } else {
+        if (connection->ptm == -1) {
+            return startSession(reactor, connection);
+        }
+        // Оболочка завершилась: ввод клиента ей уже не нужен, передаём только остаток вывода
+        if (fd == connection->shell.pidfd || connection->shell.pid == -1) {
+            handleShellExit(connection);
+            return 0;
+        }
+        // Получатель освободился - продолжаем передачу в его сторону
+        int fromClient = fd == connection->connectionfd;
+        int status = 0;
+        if (writable) {
+            status = relaySession(connection, fromClient);
+        }
+        if (readable && status != SOURCE_CLOSED) {
+            status = relaySession(connection, !fromClient);
+        }
+        // Клиент отключился, соединение сброшено или оболочка завершилась
+        if (status == SOURCE_CLOSED || status == -1) {
+            closeConnection(connection);
+        }
+    }
+    return 0;
+}
+
+// Длина очереди ещё не принятых соединений слушающего сокета
+unsigned long getAcceptBacklog(int socketfd) {
+    struct tcp_info info;
+    socklen_t length = sizeof(info);
+    if (getsockopt(socketfd, IPPROTO_TCP, TCP_INFO, &info, &length) == -1) {
+        return 0;
+    }
+    return info.tcpi_unacked;
+}
+
+// Учитываем, сколько соединений принято за одно пробуждение
+void recordAcceptWakeup(int accepted) {
+    atomic_fetch_add(&acceptStats.wakeups, 1);
+    atomic_fetch_add(&acceptStats.accepted, accepted);
+    addMetric(METRIC_ACCEPTED, accepted);
+    int bucket = 0;
+    while (bucket < ACCEPT_HISTOGRAM_SIZE - 1 && (1 << bucket) <= accepted) {
+        bucket++;
+    }
+    atomic_fetch_add(&acceptStats.perWakeup[bucket], 1);
+}
+
+void postEvent(struct Reactor *reactor, struct Event *event);
+
+// Первое событие соединения, как и все следующие, обрабатывает его рабочий поток: приём только принимает
+// Иначе поток слушающего сокета и владелец соединения обработали бы его одновременно
+void postAcceptedConnection(struct Reactor *reactor, int connectionfd) {
+    struct Connection *connection = getConnection(connectionfd);
+    struct Event event = {connectionfd, EPOLLIN, EVENT_IO, connection->generation};
+    postEvent(reactor, &event);
+}
+
+// Принимаем соединения, пока очередь не опустеет или не кончится бюджет одного события
+void acceptConnections(struct Reactor *reactor) {
+    int accepted = 0;
+    // В бюджет идёт каждый принятый дескриптор, в том числе закрытый сразу: иначе поток отклонённых
+    // соединений удержит рабочий поток в цикле приёма. accepted - только для статистики
+    int attempts = 0;
+    // Приём остановлен: оставшиеся в очереди accept соединения сообщит epoll при возобновлении
+    while (attempts < ACCEPT_BUDGET && !atomic_load(&reactor->acceptsPaused)) {
+        int connectionfd = acceptConnection(reactor);
+        if (connectionfd != -1) {
+            attempts++;
+        }
+        if (connectionfd == -2) {
+            atomic_fetch_add(&acceptStats.errors, 1);
+            continue;
+        }
+        if (connectionfd == -3) {
+            continue;
+        }
+        if (connectionfd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                // Например EMFILE: соединения остаются в очереди до следующего события
+                perror("acception connection error");
+                atomic_fetch_add(&acceptStats.errors, 1);
+            }
+            break;
+        }
+        accepted++;
+        postAcceptedConnection(reactor, connectionfd);
+    }
+
+    recordAcceptWakeup(accepted);
+    if (attempts == ACCEPT_BUDGET) {
+        atomic_fetch_add(&acceptStats.budgetExhausted, 1);
+        unsigned long backlog = getAcceptBacklog(reactor->socketfd);
+        unsigned long max = atomic_load(&acceptStats.maxBacklog);
+        while (backlog > max && !atomic_compare_exchange_weak(&acceptStats.maxBacklog, &max, backlog)) {
+        }
+        // По фронту нового события не будет: перевзводим сокет, остаток очереди разберём на следующей итерации.
+        // Общий сокет зарегистрирован по уровню и разбудит реактор сам
+        if (!reactor->sharedSocket && reactor->listening) {
+            pthread_mutex_lock(&reactor->acceptMutex);
+            if (!atomic_load(&reactor->acceptsPaused)) {
+                changeEpoll(reactor->epollfd, reactor->socketfd, EPOLLET | EPOLLIN);
+            }
+            pthread_mutex_unlock(&reactor->acceptMutex);
+        }
+    }
+}
+
+// Переполнения очередей accept во всей системе из /proc/net/netstat
+unsigned long getListenOverflows() {
+    FILE *file = fopen("/proc/net/netstat", "r");
+    if (file == NULL) {
+        return 0;
+    }
+    char names[4096], values[4096];
+    unsigned long overflows = 0;
+    while (fgets(names, sizeof(names), file) != NULL && fgets(values, sizeof(values), file) != NULL) {
+        if (strncmp(names, "TcpExt:", 7) != 0) {
+            continue;
+        }
+        char *nameSave, *valueSave;
+        char *name = strtok_r(names, " \n", &nameSave);
+        char *value = strtok_r(values, " \n", &valueSave);
+        while (name != NULL && value != NULL) {
+            if (strcmp(name, "ListenOverflows") == 0) {
+                overflows = strtoul(value, NULL, 10);
+            }
+            name = strtok_r(NULL, " \n", &nameSave);
+            value = strtok_r(NULL, " \n", &valueSave);
+        }
+    }
+    fclose(file);
+    return overflows;
+}
+
+// Выводим статистику приёма соединений
+void printAcceptStats() {
+    fprintf(stderr, "Accept: %lu connections in %lu wakeups, budget exhausted %lu times, max backlog %lu,"
+                    " errors %lu, listen overflows %lu, paused on overload %lu times\n",
+            atomic_load(&acceptStats.accepted), atomic_load(&acceptStats.wakeups),
+            atomic_load(&acceptStats.budgetExhausted), atomic_load(&acceptStats.maxBacklog),
+            atomic_load(&acceptStats.errors), getListenOverflows(), atomic_load(&acceptStats.pauses));
+    fprintf(stderr, "Accepted per wakeup:");
+    for (int i = 0; i < ACCEPT_HISTOGRAM_SIZE; i++) {
+        fprintf(stderr, " %d%s:%lu", i == 0 ? 0 : 1 << (i - 1), i == ACCEPT_HISTOGRAM_SIZE - 1 ? "+" : "",
+                atomic_load(&acceptStats.perWakeup[i]));
+    }
+    fprintf(stderr, "\n");
+}
+
+// Результат проверки пароля из пула аутентификации
+void completeAuthEvent(struct Reactor *reactor, struct Event *event) {
+    struct Connection *connection = getConnection(event->fd);
+    // Соединение могло закрыться по таймауту, а дескриптор - достаться новому
+    if (connection == NULL || connection->connectionfd != event->fd || connection->generation != event->generation
+            || connection->auth.status != PASSWORD_VERIFYING) {
+        return;
+    }
+    if (completePassword(connection, event->status) == -1) {
+        closeConnection(connection);
+        return;
+    }
+    if (checkAuthentication(connection) == 0) {
+        startSession(reactor, connection);
+        return;
+    }
+    // Разбираем ввод, накопившийся во время проверки
+    if (passAuthentication(connection) == -1) {
+        closeConnection(connection);
+    }
+}
+
+// Запоминаем сработавший таймер, обработка после освобождения колеса
+void collectExpired(struct TimerNode *node, void *arg) {
+    struct Reactor *reactor = arg;
+    struct Connection *connection = (struct Connection *)((char *)node - offsetof(struct Connection, timer));
+    if (reactor->expiredCount == reactor->expiredSize) {
+        int size = reactor->expiredSize ? reactor->expiredSize * 2 : 64;
+        int *expired = (int *)realloc(reactor->expired, size * sizeof(int));
+        if (expired == NULL) {
+            fprintf(stderr, "Error: allocating expired timers list\n");
+            return;
+        }
+        reactor->expired = expired;
+        reactor->expiredSize = size;
+    }
+    reactor->expired[reactor->expiredCount++] = connection->connectionfd;
+}
+
+// Тик таймера реактора: обновляем грубые часы и прокручиваем колесо
+void tickReactor(struct Reactor *reactor) {
+    uint64_t expirations;
+    if (read(reactor->timerfd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+        perror("reading timerfd");
+    }
+    time_t now = updateCoarseTime();
+    // Длину очереди событий потока замеряем раз в тик
+    size_t length = getQueueLength(&reactor->mailbox);
+    for (int i = 0; i < reactor->queueCount; i++) {
+        length += getQueueLength(&reactor->queues[i]);
+    }
+    setGauge(GAUGE_QUEUE_DEPTH, length);
+    reactor->expiredCount = 0;
+    advanceTimerWheel(&reactor->timers, now, collectExpired, reactor);
+    for (int i = 0; i < reactor->expiredCount; i++) {
+        struct Event event = {reactor->expired[i], 0, EVENT_TIMEOUT};
+        postEvent(reactor, &event);
+    }
+}
+
+// Таймер сброса сработал: снимаем пробки соединений, поставленные с прошлого сброса
+// Если массовый вывод продолжается, следующий проход передачи поставит пробку снова
+void flushReactor(struct Reactor *reactor) {
+    uint64_t expirations;
+    if (read(reactor->flushTimerfd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+        perror("reading flush timer");
+    }
+    // Список забираем целиком: событие может уйти в заполненную очередь, а под мьютексом ждать нельзя
+    pthread_mutex_lock(&reactor->flushMutex);
+    struct Event *flushing = reactor->flushing;
+    int count = reactor->flushingCount;
+    reactor->flushing = NULL;
+    reactor->flushingCount = 0;
+    reactor->flushingSize = 0;
+    pthread_mutex_unlock(&reactor->flushMutex);
+    for (int i = 0; i < count; i++) {
+        postEvent(reactor, &flushing[i]);
+    }
+    free(flushing);
+}
+
+// Реактор перестаёт принимать соединения: слушающие сокеты уже у нового процесса
+// Сокет не закрываем, новый процесс принимает соединения из той же очереди
+void stopListening(struct Reactor *reactor) {
+    reactor->listening = 0;
+    if (reactor->uring != NULL) {
+        prepUringCancel(reactor->uring, reactor->socketfd, URING_OP_CANCEL);
+    } else if (epoll_ctl(reactor->epollfd, EPOLL_CTL_DEL, reactor->socketfd, NULL) == -1) {
+        perror("removing listening socket from epoll");
+    }
+}
+
+// Соединение можно передать, только пока у него нет данных в пути: аутентификация ждёт строки
+// или запущена обычная оболочка, а буферы и каналы передачи пусты.
+// Команды, каналы, сжатые сессии и сессии на io_uring держат непереносимое состояние и дорабатывают здесь
+int canHandOver(struct Connection *connection) {
+    if (connection->uring.active || connection->exec.active || connection->channels.active
+            || connection->writeWatched != 0 || connection->input.length > 0
+            || connection->toPty.pending > 0 || connection->toPty.buffer.length > 0
+            || connection->toClient.pending > 0 || connection->toClient.buffer.length > 0) {
+        return 0;
+    }
+    int status = connection->auth.status;
+    if (status == LOGIN_CHECK || status == PASSWORD_CHECK) {
+        return 1;
+    }
+    // Без pidfd новый процесс не сможет завершить оболочку при закрытии сессии: такая сессия дорабатывает здесь
+    return status == AUTHENTICATED && connection->ptm != -1 && connection->shell.pid != -1
+           && connection->shell.pidfd != -1 && connection->compressor.algorithm == COMPRESS_NONE;
+}
+
+// Убираем дескрипторы соединения из epoll или возвращаем обратно
+// Копии у нового процесса держат регистрации в epoll, закрытие дескрипторов их не снимет
+void watchHandedFds(struct Connection *connection, int watch) {
+    int fds[] = {connection->connectionfd, connection->ptm, connection->shell.pidfd};
+    for (int i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (fds[i] == -1) {
+            continue;
+        }
+        if (watch) {
+            addToEpoll(connection->epollfd, fds[i], EPOLLET | EPOLLIN);
+        } else if (epoll_ctl(connection->epollfd, EPOLL_CTL_DEL, fds[i], NULL) == -1) {
+            perror("removing handed fd from epoll");
+        }
+    }
+}
+
+// Передаём соединение новому процессу и закрываем свои копии дескрипторов
+// Оболочка продолжает работать: её ptm и pidfd теперь у нового процесса
+void handOverConnection(struct Event *event) {
+    struct Connection *connection = getConnection(event->fd);
+    int socketfd = atomic_load(&handoffSocket);
+    if (socketfd != -1 && connection != NULL && connection->connectionfd == event->fd
+            && connection->generation == event->generation && canHandOver(connection)) {
+        struct HandoffMessage message;
+        initHandoffMessage(&message, HANDOFF_CONNECTION);
+        message.authStatus = connection->auth.status;
+        message.attempts = connection->auth.attempts;
+        memcpy(message.login, connection->login, connection->loginLength);
+        message.loginLength = connection->loginLength;
+        message.execRequested = connection->exec.requested;
+        message.muxRequested = connection->channels.requested;
+        message.compressRequested = connection->compressor.requested;
+        message.algorithm = connection->compressor.algorithm;
+        message.shellPid = connection->shell.pid;
+        message.createdAt = connection->createdAt;
+        message.lastRequest = connection->lastRequest;
+        int fds[] = {connection->connectionfd, connection->ptm, connection->shell.pidfd};
+        int count = connection->ptm == -1 ? 1 : connection->shell.pidfd == -1 ? 2 : 3;
+        flushCoalesced(&connection->coalescer, connection->connectionfd);
+        // Пока сообщение в пути, события соединения не должен получить ни один процесс:
+        // новый добавит дескрипторы в свой epoll и сразу узнает о пришедших данных
+        watchHandedFds(connection, 0);
+        if (sendHandoff(socketfd, &message, fds, count) == -1) {
+            watchHandedFds(connection, 1);
+        } else {
+            if (connection->shell.pidfd != -1) {
+                closeCommandFd(&connection->shell.pidfd);
+            }
+            initShell(&connection->shell);
+            closeConnection(connection);
+            atomic_fetch_add(&handedOver, 1);
+        }
+    }
+    atomic_fetch_sub(&handoffPending, 1);
+}
+
+// Продолжаем соединение, полученное от предыдущего процесса
+void resumeConnection(struct Reactor *reactor, struct Event *event) {
+    struct Connection *connection = getConnection(event->fd);
+    if (connection == NULL || connection->connectionfd != event->fd || connection->generation != event->generation) {
+        return;
+    }
+    // Журнал аудита у каждого процесса свой: переданная сессия записывается под новым номером
+    if (connection->auth.status == AUTHENTICATED) {
+        startAuditSession(connection);
+    }
+    if (connection->ptm == -1) {
+        addGauge(GAUGE_AUTHENTICATING, 1);
+    } else if (attachPty(reactor, connection, connection->ptm) == -1) {
+        closeConnection(connection);
+        return;
+    }
+    scheduleConnectionTimeout(connection);
+    // Данные, пришедшие во время передачи, epoll сообщит сразу после добавления
+    if (addToEpoll(reactor->epollfd, connection->connectionfd, EPOLLET | EPOLLIN) == -1) {
+        closeConnection(connection);
+        return;
+    }
+    if (connection->ptm != -1 && usesUring(reactor, connection)) {
+        startUringSession(reactor, connection);
+    }
+}
+
+// Обрабатываем событие
+void processEvent(struct Reactor *reactor, struct Event *event) {
+    addMetric(METRIC_EVENTS, 1);
+    if (event->type == EVENT_TIMEOUT) {
+        struct Connection *connection = getConnection(event->fd);
+        if (connection != NULL && connection->connectionfd == event->fd) {
+            checkConnectionTimeout(connection);
+        }
+    } else if (event->type == EVENT_FLUSH) {
+        struct Connection *connection = getConnection(event->fd);
+        if (connection != NULL && connection->connectionfd == event->fd && connection->generation == event->generation) {
+            if (pushCoalesced(&connection->coalescer, event->fd)) {
+                scheduleFlush(connection);
+            }
+        }
+    } else if (event->type == EVENT_AUTH) {
+        completeAuthEvent(reactor, event);
+    } else if (event->type == EVENT_HANDOFF) {
+        if (event->fd == reactor->socketfd) {
+            stopListening(reactor);
+        } else {
+            handOverConnection(event);
+        }
+    } else if (event->type == EVENT_ADOPT) {
+        resumeConnection(reactor, event);
+    } else if (event->fd == reactor->socketfd) {
+        acceptConnections(reactor);
+    } else {
+        if (handleEvent(reactor, event->fd, event->events) == -1) {
+            fprintf(stderr, "Error: handling event\n");
+        }
+    }
+}
+
+// Очередь текущего рабочего потока, в остальных потоках NULL
+static __thread struct Queue *workerQueue = NULL;
+
+// Номер рабочего потока для события: поток соединения, которому принадлежит дескриптор
+// Дескрипторы без соединения (слушающий сокет) распределяются по номеру
+int getEventWorker(struct Reactor *reactor, int fd) {
+    struct Connection *connection = getConnection(fd);
+    return connection != NULL ? connection->worker : fd % reactor->queueCount;
+}
+
+// Передаём событие на обработку: в очередь рабочих потоков или обрабатываем сами
+void postEvent(struct Reactor *reactor, struct Event *event) {
+    if (reactor->queues == NULL) {
+        processEvent(reactor, event);
+        return;
+    }
+    // Очередь ограничена: если она заполнена, ждём пока рабочий поток её разгрузит
+    struct Queue *queue = &reactor->queues[getEventWorker(reactor, event->fd)];
+    event->enqueuedAt = getMonotonicNanoseconds();
+    while (pushQueue(queue, event) == -1) {
+        // Своя очередь заполнена: разгрузить её некому, а владелец соединения - этот же поток
+        if (queue == workerQueue) {
+            processEvent(reactor, event);
+            return;
+        }
+        // При завершении владелец мог уже выйти и очередь больше не разбирают
+        if (done) {
+            return;
+        }
+        sched_yield();
+    }
+}
+
+// Передаём событие реактору из другого потока
+void sendToReactor(struct Reactor *reactor, struct Event *event) {
+    struct Queue *queue = reactor->queues != NULL
+                          ? &reactor->queues[getEventWorker(reactor, event->fd)] : &reactor->mailbox;
+    event->enqueuedAt = getMonotonicNanoseconds();
+    while (pushQueue(queue, event) == -1) {
+        // При завершении получатель мог уже выйти, результат никому не нужен
+        if (done) {
+            return;
+        }
+        sched_yield();
+    }
+    // Будим реактор, только если он ещё не разбудили
+    if (queue == &reactor->mailbox && atomic_exchange(&reactor->mailboxSignaled, 1) == 0) {
+        uint64_t value = 1;
+        if (write(reactor->mailboxfd, &value, sizeof(value)) == -1) {
+            perror("waking reactor");
+        }
+    }
+}
+
+// Обрабатываем события, пришедшие реактору от других потоков
+void drainMailbox(struct Reactor *reactor) {
+    uint64_t value;
+    if (read(reactor->mailboxfd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        perror("reading reactor eventfd");
+    }
+    atomic_store(&reactor->mailboxSignaled, 0);
+    struct Event event;
+    while (popQueue(&reactor->mailbox, &event) == 0) {
+        postEvent(reactor, &event);
+    }
+}
+
+// Результат проверки пароля возвращается реактору соединения
+void postAuthResult(struct AuthRequest *request) {
+    struct Event event;
+    memset(&event, 0, sizeof(event));
+    event.fd = request->fd;
+    event.type = EVENT_AUTH;
+    event.generation = request->generation;
+    event.status = request->result;
+    sendToReactor(request->owner, &event);
+}
+
+// Замеряем, сколько ждала в очереди пачка событий: первое событие пачки - самое старое
+// delay 0 - очередь пуста
+void measureQueueDelay(struct WorkerArgs *workerArgs, uint64_t enqueuedAt) {
+    struct OverloadState *overload = &workerArgs->overload;
+    uint64_t delay = enqueuedAt != 0 ? getMonotonicNanoseconds() - enqueuedAt : 0;
+    if (reportQueueDelay(overload, delay)) {
+        fprintf(stderr, "Worker queue delay %.1f ms: overload %s\n", overload->delay / 1e6,
+                overload->overloaded ? "started" : "ended");
+    }
+    setGauge(GAUGE_QUEUE_DELAY, (long)(overload->delay / 1000));
+}
+
+// Обрабатываем события из общей очереди
+void *worker(void *args) {
+    // Получаем аргументы в новом потоке
+    struct WorkerArgs *workerArgs = args;
+    workerQueue = workerArgs->queue;
+    registerMetricsThread("worker");
+    int batchSize = workerArgs->reactor->batchSize;
+    struct Event events[batchSize];
+    // Поток завершается по событию в очереди, а не по флагу done: пробуждение очереди без события
+    // теряется, если придёт между проверкой флага и засыпанием
+    for (;;) {
+        // Забираем события пачкой, при пустой очереди засыпаем на futex
+        int eventsNumber = popQueueBatch(workerArgs->queue, events, batchSize);
+        if (eventsNumber == 0) {
+            measureQueueDelay(workerArgs, 0);
+            waitQueue(workerArgs->queue);
+            continue;
+        }
+        measureQueueDelay(workerArgs, events[0].enqueuedAt);
+        for (int i = 0; i < eventsNumber; i++) {
+            if (events[i].type == EVENT_STOP) {
+                return NULL;
+            }
+            processEvent(workerArgs->reactor, &events[i]);
+        }
+    }
+}
+
+// Обрабатываем события epoll в потоке реактора
+void processReactorEvents(struct Reactor *reactor, struct epoll_event *events, int eventsNumber) {
+    for (int i = 0; i < eventsNumber; i++) {
+        if (events[i].data.fd == reactor->timerfd) {
+            tickReactor(reactor);
+            continue;
+        }
+        if (events[i].data.fd == reactor->mailboxfd) {
+            drainMailbox(reactor);
+            continue;
+        }
+        if (events[i].data.fd == reactor->flushTimerfd) {
+            flushReactor(reactor);
+            continue;
+        }
+        struct Event event = {events[i].data.fd, events[i].events, EVENT_IO};
+        processEvent(reactor, &event);
+    }
+}
+
+// Перегрузка: останавливаем приём, новые соединения ждут в очереди accept ядра
+// При возобновлении перевзводим сокет, и epoll сообщит о накопившихся соединениях
+void pauseAccepts(struct Reactor *reactor, int paused) {
+    if (!reactor->listening || atomic_load(&reactor->acceptsPaused) == paused) {
+        return;
+    }
+    pthread_mutex_lock(&reactor->acceptMutex);
+    atomic_store(&reactor->acceptsPaused, paused);
+    changeEpoll(reactor->epollfd, reactor->socketfd, paused ? EPOLLET : EPOLLET | EPOLLIN);
+    pthread_mutex_unlock(&reactor->acceptMutex);
+    if (paused) {
+        atomic_fetch_add(&acceptStats.pauses, 1);
+    }
+}
+
+// Событие массовой передачи клиенту: вывод оболочки или готовность сокета принять его продолжение
+// Ввод клиента не откладываем: Ctrl-C должен дойти до оболочки и во время массового вывода
+int isBulkEvent(int fd, uint32_t events) {
+    struct Connection *connection = getConnection(fd);
+    if (connection == NULL || !atomic_load_explicit(&connection->bulk, memory_order_relaxed)) {
+        return 0;
+    }
+    return fd == connection->ptm || (fd == connection->connectionfd && !(events & ~EPOLLOUT));
+}
+
+// Отдаём рабочим отложенные события, возвращаем количество оставшихся
+// Пока перегрузка не кончилась, событие ждёт, пока очередь его потока не станет короче пачки,
+// но не дольше SHED_HOLD_LIMIT порогов: массовая передача замедляется, но не останавливается
+int releaseHeldEvents(struct Reactor *reactor, struct Event *held, int count, int overloaded) {
+    uint64_t now = getMonotonicNanoseconds();
+    uint64_t limit = (uint64_t)shedDelayMs * 1000000 * SHED_HOLD_LIMIT;
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        struct Queue *queue = &reactor->queues[getEventWorker(reactor, held[i].fd)];
+        int ready = !overloaded || getQueueLength(queue) < (size_t)reactor->batchSize
+                    || now - held[i].enqueuedAt > limit;
+        // Задержка в очереди считается с момента передачи рабочему, а не с момента откладывания
+        struct Event event = held[i];
+        event.enqueuedAt = now;
+        if (!ready || pushQueue(queue, &event) == -1) {
+            held[kept++] = held[i];
+        }
+    }
+    return kept;
+}
+
+// Собственный цикл событий потока: epoll, accept и ввод-вывод без передачи другим потокам
+void *reactorLoop(void *args) {
+    struct Reactor *reactor = args;
+    registerMetricsThread("reactor");
+    struct epoll_event events[reactor->batchSize];
+    while (!done) {
+        int eventsNumber = epoll_wait(reactor->epollfd, events, reactor->batchSize, -1);
+        if (eventsNumber == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("reactor epoll_wait error");
+            break;
+        }
+        processReactorEvents(reactor, events, eventsNumber);
+    }
+    return NULL;
+}
+
+// Завершилась операция сессии на io_uring
+void completeUringSession(struct Connection *connection, int op, int result, uint32_t flags) {
+    struct Uring *uring = connection->reactor->uring;
+    struct UringSession *session = &connection->uring;
+    session->ops--;
+    int status = 0;
+    switch (op) {
+        case URING_OP_READ_CLIENT:
+            status = completeUringRead(uring, &session->toPty, result, flags, &connection->toPty.audit);
+            addMetric(METRIC_BYTES_TO_PTY, result > 0 ? result : 0);
+            break;
+        case URING_OP_READ_PTM:
+            status = completeUringRead(uring, &session->toClient, result, flags, &connection->toClient.audit);
+            addMetric(METRIC_BYTES_TO_CLIENT, result > 0 ? result : 0);
+            // Запись клиенту ещё не поставлена в кольцо: пробка успевает до неё
+            coalesceChunk(&connection->coalescer, connection->connectionfd, result > 0 ? result : 0);
+            if (finishCoalescing(&connection->coalescer, connection->connectionfd, 0)) {
+                scheduleFlush(connection);
+            }
+            break;
+        case URING_OP_WRITE_PTM:
+            status = completeUringWrite(uring, &session->toPty, result);
+            break;
+        case URING_OP_WRITE_CLIENT:
+            status = completeUringWrite(uring, &session->toClient, result);
+            break;
+        case URING_OP_RETRY:
+            session->retrying = 0;
+            session->toPty.delayed = 0;
+            session->toClient.delayed = 0;
+            break;
+    }
+    if (session->closing) {
+        if (session->ops == 0) {
+            closeConnection(connection);
+        }
+        return;
+    }
+    // Буферы кольца кончились или запись прервана: повторим через миллисекунду
+    if (status == URING_NO_BUFFERS || status == URING_WRITE_DELAYED) {
+        static struct __kernel_timespec retryDelay = {0, 1000000};
+        if (!session->retrying) {
+            session->retrying = 1;
+            session->ops++;
+            prepUringTimeout(uring, &retryDelay, (uint64_t)(uintptr_t)connection | URING_OP_RETRY);
+        }
+        status = 0;
+    }
+    // Клиент отключился или оболочка завершилась, а её вывод передан
+    if (status != 0 || (op == URING_OP_WRITE_CLIENT && connection->shell.pid == -1
+                        && isUringStreamIdle(&session->toClient))) {
+        closeConnection(connection);
+        return;
+    }
+    if (op == URING_OP_READ_CLIENT || op == URING_OP_READ_PTM) {
+        connection->lastRequest = getCoarseTime();
+    }
+    pumpUringSession(connection);
+}
+
+// Разбираем завершение из кольца реактора
+void handleUringCompletion(struct Reactor *reactor, struct io_uring_cqe *cqe, int *accepted) {
+    int op = cqe->user_data & URING_OP_MASK;
+    struct Connection *connection = (struct Connection *)(uintptr_t)(cqe->user_data & ~(uint64_t)URING_OP_MASK);
+    int more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+    // Готовность epoll не считаем: события из него учтёт processEvent
+    if (op != URING_OP_EPOLL) {
+        addMetric(METRIC_EVENTS, 1);
+    }
+    if (connection != NULL) {
+        completeUringSession(connection, op, cqe->res, cqe->flags);
+    } else if (op == URING_OP_ACCEPT) {
+        if (cqe->res >= 0) {
+            int connectionfd = addAcceptedConnection(reactor, cqe->res, NULL);
+            if (connectionfd >= 0) {
+                (*accepted)++;
+                postAcceptedConnection(reactor, connectionfd);
+            } else if (connectionfd == -2) {
+                atomic_fetch_add(&acceptStats.errors, 1);
+            }
+        } else if (reactor->listening) {
+            fprintf(stderr, "Error: io_uring accept: %s\n", strerror(-cqe->res));
+            atomic_fetch_add(&acceptStats.errors, 1);
+        }
+        // Многократный приём остановился (например, EMFILE): ставим заново, если сокет ещё наш
+        if (!more && reactor->listening) {
+            prepUringAccept(reactor->uring, reactor->socketfd, URING_OP_ACCEPT);
+        }
+    } else if (op == URING_OP_EPOLL) {
+        // Аутентификация, таймер и почтовый ящик остаются на epoll, кольцо сообщает о его готовности
+        struct epoll_event events[reactor->batchSize];
+        int eventsNumber;
+        do {
+            eventsNumber = epoll_wait(reactor->epollfd, events, reactor->batchSize, 0);
+            if (eventsNumber > 0) {
+                processReactorEvents(reactor, events, eventsNumber);
+            }
+        } while (eventsNumber == reactor->batchSize);
+        if (!more) {
+            prepUringPoll(reactor->uring, reactor->epollfd, POLLIN, URING_OP_EPOLL);
+        }
+    }
+}
+
+// Цикл реактора на io_uring: соединения принимаются многократным accept,
+// данные сессий передаются чтением в буферы кольца и записью из них,
+// все запросы и завершения одной итерации проходят через один io_uring_enter
+void *uringLoop(void *args) {
+    struct Reactor *reactor = args;
+    registerMetricsThread("uring");
+    struct Uring uring;
+    // Кольцо создаёт поток, который будет с ним работать
+    if (initUring(&uring, URING_ENTRIES) == -1) {
+        fprintf(stderr, "io_uring is unavailable, reactor works on epoll\n");
+        return reactorLoop(reactor);
+    }
+    reactor->uring = &uring;
+    if (epoll_ctl(reactor->epollfd, EPOLL_CTL_DEL, reactor->socketfd, NULL) == -1) {
+        perror("removing listening socket from epoll");
+    }
+    prepUringAccept(&uring, reactor->socketfd, URING_OP_ACCEPT);
+    prepUringPoll(&uring, reactor->epollfd, POLLIN, URING_OP_EPOLL);
+    while (!done) {
+        if (submitUring(&uring, 1) == -1) {
+            break;
+        }
+        int accepted = 0;
+        struct io_uring_cqe *cqe;
+        while ((cqe = peekUringCqe(&uring)) != NULL) {
+            // Место в кольце освобождаем сразу: обработка может поставить новые запросы
+            struct io_uring_cqe completion = *cqe;
+            seenUringCqe(&uring);
+            handleUringCompletion(reactor, &completion, &accepted);
+        }
+        if (accepted > 0) {
+            recordAcceptWakeup(accepted);
+        }
+    }
+    return NULL;
+}
+
+// Слушающий сокет
+int openListener(struct addrinfo *addresses, int reusePort) {
+    int socketfd = getSocket(addresses, reusePort);
+    if (socketfd == -1) {
+        return -1;
+    }
+    if (listen(socketfd, SOMAXCONN) == -1) {
+        perror("listen\n");
+        close(socketfd);
+        return -1;
+    }
+    return socketfd;
+}
+
+// Создаём epoll и таймеры реактора, регистрируем в epoll слушающий сокет
+// Реактор принимает соединения со своего сокета по фронту,
+// а с общего для нескольких реакторов - по уровню с EPOLLEXCLUSIVE, чтобы будить только один из них
+int initReactor(struct Reactor *reactor, int socketfd, int sharedSocket, int batchSize) {
+    memset(reactor, 0, sizeof(struct Reactor));
+    reactor->batchSize = batchSize;
+    reactor->socketfd = socketfd;
+    reactor->sharedSocket = sharedSocket;
+    reactor->listening = 1;
+    if (initTimerWheel(&reactor->timers, updateCoarseTime()) == -1) {
+        return -1;
+    }
+    reactor->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor->epollfd == -1) {
+        perror("epoll_create error\n");
+        return -1;
+    }
+    if (addToEpoll(reactor->epollfd, socketfd, sharedSocket ? EPOLLIN | EPOLLEXCLUSIVE : EPOLLET | EPOLLIN) == -1) {
+        close(reactor->epollfd);
+        return -1;
+    }
+    // Тик раз в секунду: обновление грубых часов и колеса таймеров
+    reactor->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct itimerspec tick;
+    memset(&tick, 0, sizeof(tick));
+    tick.it_interval.tv_sec = 1;
+    tick.it_value.tv_sec = 1;
+    if (reactor->timerfd == -1 || timerfd_settime(reactor->timerfd, 0, &tick, NULL) == -1) {
+        perror("creating reactor timer");
+        return -1;
+    }
+    if (addToEpoll(reactor->epollfd, reactor->timerfd, EPOLLIN) == -1) {
+        return -1;
+    }
+    // Таймер сброса пробок заводится, когда соединение ставит пробку
+    reactor->flushTimerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (reactor->flushTimerfd == -1 || addToEpoll(reactor->epollfd, reactor->flushTimerfd, EPOLLIN) == -1) {
+        perror("creating flush timer");
+        return -1;
+    }
+    reactor->flushing = NULL;
+    reactor->flushingCount = 0;
+    reactor->flushingSize = 0;
+    pthread_mutex_init(&reactor->flushMutex, NULL);
+    pthread_mutex_init(&reactor->acceptMutex, NULL);
+    // Почтовый ящик для событий из других потоков (результаты проверки паролей)
+    if (initQueue(&reactor->mailbox, sizeof(struct Event)) == -1) {
+        return -1;
+    }
+    atomic_init(&reactor->mailboxSignaled, 0);
+    reactor->mailboxfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor->mailboxfd == -1) {
+        perror("creating reactor eventfd");
+        return -1;
+    }
+    if (addToEpoll(reactor->epollfd, reactor->mailboxfd, EPOLLIN) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+// Освобождаем дескрипторы реактора
+void destroyReactor(struct Reactor *reactor) {
+    close(reactor->mailboxfd);
+    destroyQueue(&reactor->mailbox);
+    close(reactor->timerfd);
+    close(reactor->flushTimerfd);
+    free(reactor->flushing);
+    pthread_mutex_destroy(&reactor->flushMutex);
+    pthread_mutex_destroy(&reactor->acceptMutex);
+    if (!reactor->sharedSocket) {
+        close(reactor->socketfd);
+    }
+    close(reactor->epollfd);
+    destroyTimerWheel(&reactor->timers);
+    free(reactor->expired);
+}
+
+// Читаем пароли из файла и публикуем новую версию базы
+// Старая версия освобождается, когда её перестанут читать все потоки
+int readPasswordsFromFile(char *path) {
+    struct Credentials *loaded = loadCredentials(path);
+    if (loaded == NULL) {
+        fprintf(stderr, "Error: loading passwords from %s\n", path);
+        return -1;
+    }
+    struct Credentials *old = atomic_exchange(&credentials, loaded);
+    if (old != NULL) {
+        rcuSynchronize();
+        freeCredentials(old);
+    }
+    fprintf(stderr, "Loaded %u login-password pairs from %s\n", loaded->index.count, path);
+    return 0;
+}
+
+// Перечитываем базу паролей по SIGHUP или при изменении файла
+void *watchCredentials(void *args) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    int signalFd = signalfd(-1, &signals, SFD_CLOEXEC);
+    if (signalFd == -1) {
+        perror("creating signalfd for SIGHUP");
+        return NULL;
+    }
+
+    // Следим за каталогом: новая база подменяется через rename
+    char *pathCopy = strdup(credentialsPath);
+    char *fileCopy = strdup(credentialsPath);
+    char *directory = dirname(pathCopy);
+    char *filename = basename(fileCopy);
+    int inotifyfd = inotify_init1(IN_CLOEXEC);
+    if (inotifyfd == -1 || inotify_add_watch(inotifyfd, directory, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        perror("watching passwords file");
+    }
+
+    // done не проверяем: поток ждёт в poll без таймаута и завершается только по watcherStopfd
+    struct pollfd fds[3] = {{watcherStopfd, POLLIN, 0}, {signalFd, POLLIN, 0}, {inotifyfd, POLLIN, 0}};
+    for (;;) {
+        if (poll(fds, inotifyfd == -1 ? 2 : 3, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("waiting for passwords file changes");
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            break;
+        }
+        int reload = 0;
+        if (fds[1].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            if (read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+                reload = 1;
+            }
+        }
+        if (inotifyfd != -1 && (fds[2].revents & POLLIN)) {
+            char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+            ssize_t length = read(inotifyfd, events, sizeof(events));
+            for (char *ptr = events; length > 0 && ptr < events + length; ) {
+                struct inotify_event *event = (struct inotify_event *)ptr;
+                if (event->len > 0 && strcmp(event->name, filename) == 0) {
+                    reload = 1;
+                }
+                ptr += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        if (reload) {
+            readPasswordsFromFile(credentialsPath);
+        }
+    }
+    close(signalFd);
+    if (inotifyfd != -1)
+        close(inotifyfd);
+    free(pathCopy);
+    free(fileCopy);
+    return NULL;
+}
+
+// Поднимаем мягкий лимит открытых дескрипторов до жёсткого
+void raiseFileLimit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+        perror("getting file limit");
+        return;
+    }
+    limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) == -1) {
+        perror("raising file limit");
+    }
+}
+
+// Просим поток соединения передать его новому процессу
+void requestHandoff(struct Connection *connection) {
+    struct Reactor *reactor = connection->reactor;
+    // Соединение только что принято и ещё не привязано к реактору: попадёт в следующий проход
+    if (reactor == NULL) {
+        return;
+    }
+    struct Event event = {connection->connectionfd, 0, EVENT_HANDOFF, connection->generation};
+    atomic_fetch_add(&handoffPending, 1);
+    sendToReactor(reactor, &event);
+}
+
+// Ждём, пока потоки соединений обработают запросы передачи
+void waitHandoff() {
+    for (int i = 0; i < HANDOFF_TIMEOUT * 1000 && atomic_load(&handoffPending) > 0; i++) {
+        usleep(1000);
+    }
+}
+
+// Передаём слушающие сокеты и ждём, пока новый процесс запустит на них реакторы
+int sendListeners(struct HandoffArgs *handoff, int socketfd) {
+    struct HandoffMessage message;
+    initHandoffMessage(&message, HANDOFF_LISTENER);
+    for (int i = 0; i < handoff->count; i++) {
+        // Общий сокет реакторов передаём один раз
+        if (i > 0 && handoff->reactors[i].sharedSocket) {
+            break;
+        }
+        if (sendHandoff(socketfd, &message, &handoff->reactors[i].socketfd, 1) == -1) {
+            return -1;
+        }
+    }
+    initHandoffMessage(&message, HANDOFF_READY);
+    if (sendHandoff(socketfd, &message, NULL, 0) == -1) {
+        return -1;
+    }
+    int fds[HANDOFF_MAX_FDS];
+    int count;
+    if (receiveHandoff(socketfd, &message, fds, &count) == -1) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        close(fds[i]);
+    }
+    return message.type == HANDOFF_READY ? 0 : -1;
+}
+
+// Передаём работу новому процессу: слушающие сокеты, затем соединения
+// Соединения, которые передать нельзя, дорабатывают здесь, процесс завершится после последнего
+void *handOver(void *args) {
+    struct HandoffArgs *handoff = args;
+    pid_t pid;
+    int socketfd = startSuccessor(serverArgv, &pid);
+    if (socketfd == -1) {
+        atomic_store(&upgradeState, UPGRADE_IDLE);
+        return NULL;
+    }
+    if (sendListeners(handoff, socketfd) == -1) {
+        fprintf(stderr, "Error: process %d didn't take listening sockets, upgrade cancelled\n", (int)pid);
+        close(socketfd);
+        atomic_store(&upgradeState, UPGRADE_IDLE);
+        return NULL;
+    }
+    // Новый процесс уже принимает соединения, наши реакторы перестают
+    for (int i = 0; i < handoff->count; i++) {
+        struct Event event = {handoff->reactors[i].socketfd, 0, EVENT_HANDOFF};
+        sendToReactor(&handoff->reactors[i], &event);
+    }
+    int total = countConnections();
+    atomic_store(&handedOver, 0);
+    atomic_store(&handoffSocket, socketfd);
+    // Соединения с данными в пути пробуем передать ещё раз, когда передача в них затихнет
+    for (int round = 0; round < HANDOFF_ROUNDS && countConnections() > 0; round++) {
+        if (round > 0) {
+            usleep(HANDOFF_RETRY_US);
+        }
+        forEachConnection(requestHandoff);
+        waitHandoff();
+    }
+    atomic_store(&handoffSocket, -1);
+    close(socketfd);
+    printf("Handed over %d of %d connections to process %d, %d stay until closed\n",
+           atomic_load(&handedOver), total, (int)pid, countConnections());
+    atomic_store(&upgradeState, UPGRADE_DRAINING);
+    return NULL;
+}
+
+// Запускаем передачу работы в отдельном потоке: главный поток общего epoll раздаёт события и во время неё
+void startUpgrade(struct Reactor *reactors, int count) {
+    static struct HandoffArgs handoff;
+    int idle = UPGRADE_IDLE;
+    if (!atomic_compare_exchange_strong(&upgradeState, &idle, UPGRADE_RUNNING)) {
+        return;
+    }
+    handoff.reactors = reactors;
+    handoff.count = count;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, handOver, &handoff) != 0) {
+        fprintf(stderr, "Error: starting handoff thread\n");
+        atomic_store(&upgradeState, UPGRADE_IDLE);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+// Заводим соединение, полученное от предыдущего процесса, и передаём его потоку реактора
+int adoptConnection(struct Reactor *reactor, struct HandoffMessage *message, int *fds, int count) {
+    // Оболочка - не наш потомок, её забирает не сервер
+    struct Shell shell = {count > 1 ? message->shellPid : -1, count > 2 ? fds[2] : -1, 1};
+    int authenticated = message->authStatus == AUTHENTICATED && count > 1;
+    int waiting = message->authStatus == LOGIN_CHECK || message->authStatus == PASSWORD_CHECK;
+    // Оболочку без pidfd нельзя ни завершить, ни дождаться: отказываемся от сессии,
+    // а закрытие последней копии ptm пошлёт оболочке SIGHUP
+    if (authenticated && shell.pidfd == -1) {
+        fprintf(stderr, "Error: connection %d came without shell pidfd, closing it\n", fds[0]);
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    struct Connection *connection = NULL;
+    if ((authenticated || waiting) && message->loginLength <= MAX_LOGIN_LEN) {
+        connection = addConnectionIntoList(fds[0]);
+    }
+    if (connection == NULL) {
+        fprintf(stderr, "Error: adopting connection %d\n", fds[0]);
+        killShell(&shell);
+        close(fds[0]);
+        if (count > 1) {
+            close(fds[1]);
+        }
+        return -1;
+    }
+    assignReactor(reactor, connection);
+    if (isRateLimited(RATE_AUTH)) {
+        getPeerRateKey(fds[0], &connection->source);
+    }
+    connection->auth.status = message->authStatus;
+    connection->auth.attempts = message->attempts;
+    memcpy(connection->login, message->login, message->loginLength);
+    connection->loginLength = message->loginLength;
+    connection->exec.requested = message->execRequested;
+    connection->channels.requested = message->muxRequested;
+    connection->compressor.requested = message->compressRequested;
+    connection->compressor.algorithm = message->algorithm;
+    connection->createdAt = message->createdAt;
+    connection->lastRequest = message->lastRequest;
+    if (authenticated) {
+        connection->ptm = fds[1];
+        connection->shell = shell;
+    }
+    struct Event event = {fds[0], 0, EVENT_ADOPT, connection->generation};
+    sendToReactor(reactor, &event);
+    return 0;
+}
+
+// Принимаем соединения от предыдущего процесса, пока он не закроет сокет передачи
+// Соединения раздаются реакторам по кругу, дальше их обрабатывает поток реактора
+void *adoptConnections(void *args) {
+    struct HandoffArgs *handoff = args;
+    struct HandoffMessage message;
+    int fds[HANDOFF_MAX_FDS];
+    int count;
+    int adopted = 0;
+    while (receiveHandoff(handoff->socketfd, &message, fds, &count) == 0) {
+        if (message.type != HANDOFF_CONNECTION || count == 0) {
+            for (int i = 0; i < count; i++) {
+                close(fds[i]);
+            }
+            continue;
+        }
+        if (adoptConnection(&handoff->reactors[adopted % handoff->count], &message, fds, count) == 0) {
+            adopted++;
+        }
+    }
+    close(handoff->socketfd);
+    printf("Adopted %d connections from previous process\n", adopted);
+    return NULL;
+}
+
+// Сообщаем предыдущему процессу, что реакторы работают, и принимаем его соединения в отдельном потоке
+void startAdoption(struct Reactor *reactors, int count, int socketfd) {
+    static struct HandoffArgs handoff;
+    handoff.reactors = reactors;
+    handoff.count = count;
+    handoff.socketfd = socketfd;
+    // Полученные слушающие сокеты, которые не понадобились (у нас меньше реакторов)
+    for (int i = inheritedTaken; i < inheritedCount; i++) {
+        close(inheritedListeners[i]);
+    }
+    free(inheritedListeners);
+    inheritedListeners = NULL;
+    struct HandoffMessage message;
+    initHandoffMessage(&message, HANDOFF_READY);
+    pthread_t thread;
+    if (sendHandoff(socketfd, &message, NULL, 0) == -1
+            || pthread_create(&thread, NULL, adoptConnections, &handoff) != 0) {
+        close(socketfd);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+// Слушающий сокет: полученный от предыдущего процесса или новый
+int getListener(struct addrinfo *addresses, int reusePort) {
+    if (inheritedTaken < inheritedCount) {
+        return inheritedListeners[inheritedTaken++];
+    }
+    return openListener(addresses, reusePort);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// MAIN
+//
+///////////////////////////////////////////////////////////////////////////////
+int main(int argc, char *argv[]) {
+    // Обработка сигнала
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = handleSigInt;
+    sigaction(SIGINT, &act, 0);
+    act.sa_handler = handleSigUsr2;
+    sigaction(SIGUSR2, &act, 0);
+    serverArgv = argv;
 
     // Проверка количества аргументов
     if (argc < 4) {
         fprintf(stderr, "Too few arguments\n");
+        fprintf(stderr, "Usage: %s <workers> <port> <passwords file> [-r] [-b <batch size>]"
+                        " [-ti <idle timeout>] [-ta <auth timeout>] [-ts <session timeout>] [-copy]"
+                        " [-auth <auth threads>] [-pool <ready shells>] [-x] [-uring] [-coalesce <0|1>]"
+                        " [-audit <log file>] [-audit-compress <zstd|lz4>] [-audit-buffer <KB>]"
+                        " [-rate-conn <per second>[:<burst>]] [-rate-auth <per second>[:<burst>]] [-rate-table <addresses>]"
+                        " [-shed <queue delay ms>]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
     // Количество потоков - 1й параметр запуска
     int numberOfWorkers = atoi(argv[1]);
+    if (numberOfWorkers < 1) {
+        fprintf(stderr, "Error: wrong number of workers\n");
+        exit(EXIT_FAILURE);
+    }
 
     // Порт - 2й параметр запуска
-    char port[4];
-    strcpy(port, argv[2]);
+    char *port = argv[2];
+
+    // Необязательные параметры:
+    // -r - у каждого потока свой epoll и свой сокет с SO_REUSEPORT
+    // -b - количество событий, забираемых за один вызов epoll_wait
+    // -ti, -ta, -ts - таймауты бездействия, аутентификации и сессии в секундах (0 - без таймаута)
+    // -copy - передавать данные сессии копированием через буфер вместо splice
+    // -coalesce 0 - не управлять TCP_NODELAY и TCP_CORK, сокеты клиентов работают с алгоритмом Нейгла
+    // -auth - количество потоков проверки паролей (0 - проверять в потоке соединения)
+    // -pool - количество заранее запущенных оболочек (0 - запускать при входе)
+    // -x - реакторы -r слушают один сокет с EPOLLEXCLUSIVE вместо своих сокетов с SO_REUSEPORT
+    // -uring - реакторы -r принимают соединения и передают данные сессий через io_uring
+    // -audit - записывать ввод и вывод сессий в файл, -audit-compress - сжимать его,
+    // -audit-buffer - размер буфера записей каждого потока в КБ
+    // -rate-conn, -rate-auth - лимиты соединений и проверок логина и пароля с одного адреса (0 - без лимита),
+    // -rate-table - сколько адресов помнит таблица лимитов
+    // -shed - порог задержки событий в очередях рабочих потоков общего epoll, после которого сервер
+    // перестаёт принимать соединения и входы и откладывает массовую передачу (0 - не отслеживать)
+    int sharded = 0;
+    int sharedListener = 0;
+    int batchSize = 0;
+    int shellPool = DEFAULT_SHELL_POOL;
+    char *auditPath = NULL;
+    int auditAlgorithm = COMPRESS_NONE;
+    long auditBuffer = AUDIT_BUFFER_SIZE;
+    struct RateLimit rateLimits[RATE_KINDS] = {{0, 0}, {0, 0}};
+    long rateTable = RATE_TABLE_SIZE;
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0) {
+            sharded = 1;
+        } else if (strcmp(argv[i], "-x") == 0) {
+            sharded = 1;
+            sharedListener = 1;
+        } else if (strcmp(argv[i], "-uring") == 0) {
+            sharded = 1;
+            useUring = 1;
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            batchSize = atoi(argv[++i]);
+            if (batchSize < 1) {
+                fprintf(stderr, "Error: wrong batch size\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-ti") == 0 && i + 1 < argc) {
+            timeouts.idle = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-ta") == 0 && i + 1 < argc) {
+            timeouts.authentication = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-ts") == 0 && i + 1 < argc) {
+            timeouts.session = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-copy") == 0) {
+            atomic_store(&spliceEnabled, 0);
+        } else if (strcmp(argv[i], "-coalesce") == 0 && i + 1 < argc) {
+            coalesceEnabled = atoi(argv[++i]) != 0;
+        } else if (strcmp(argv[i], "-auth") == 0 && i + 1 < argc) {
+            authThreads = atoi(argv[++i]);
+            if (authThreads < 0) {
+                fprintf(stderr, "Error: wrong number of auth threads\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-pool") == 0 && i + 1 < argc) {
+            shellPool = atoi(argv[++i]);
+            if (shellPool < 0) {
+                fprintf(stderr, "Error: wrong shell pool size\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-audit") == 0 && i + 1 < argc) {
+            auditPath = argv[++i];
+        } else if (strcmp(argv[i], "-audit-compress") == 0 && i + 1 < argc) {
+            i++;
+            auditAlgorithm = parseCompression(argv[i], strlen(argv[i]));
+            if (auditAlgorithm == COMPRESS_NONE) {
+                fprintf(stderr, "Error: audit log compression %s isn't available\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-audit-buffer") == 0 && i + 1 < argc) {
+            auditBuffer = atol(argv[++i]);
+            if (auditBuffer < 1) {
+                fprintf(stderr, "Error: wrong audit buffer size\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if ((strcmp(argv[i], "-rate-conn") == 0 || strcmp(argv[i], "-rate-auth") == 0) && i + 1 < argc) {
+            int kind = strcmp(argv[i], "-rate-conn") == 0 ? RATE_CONNECT : RATE_AUTH;
+            if (parseRateLimit(argv[++i], &rateLimits[kind]) == -1) {
+                fprintf(stderr, "Error: wrong rate limit %s\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(argv[i], "-shed") == 0 && i + 1 < argc) {
+            int delay = atoi(argv[++i]);
+            if (delay < 0) {
+                fprintf(stderr, "Error: wrong shedding delay\n");
+                exit(EXIT_FAILURE);
+            }
+            shedDelayMs = (unsigned int)delay;
+        } else if (strcmp(argv[i], "-rate-table") == 0 && i + 1 < argc) {
+            rateTable = atol(argv[++i]);
+            if (rateTable < 1) {
+                fprintf(stderr, "Error: wrong rate limit table size\n");
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (batchSize == 0) {
+        batchSize = sharded ? DEFAULT_EVENT_BATCH : numberOfWorkers;
+    }
 
-    // Путь к файлу с паролями - 3й параметр запуска
-    readPasswordsFromFile(argv[3]);
+    // Заготовщик оболочек создаём первым: fork безопасен, пока нет других потоков,
+    // и оболочки не наследуют сокеты и базу паролей
+    if (shellPool > 0 && startZygote(shellPool) == -1) {
+        fprintf(stderr, "Error: starting shell pool, shells will be spawned on login\n");
+    }
 
-    // Инициализация connections
-    memset(connections, 0, sizeof(connections));
+    // Журнал аудита: данные сессий должны пройти через память процесса, поэтому splice выключаем
+    if (auditPath != NULL) {
+        if (startAudit(auditPath, auditAlgorithm, (size_t)auditBuffer) == -1) {
+            exit(EXIT_FAILURE);
+        }
+        atomic_store(&spliceEnabled, 0);
+    }
 
-    struct addrinfo* addresses = getAvailableAddresses(port);
-    if (!addresses) 
+    // Таблица лимитов нужна, только если задан хотя бы один лимит
+    if ((rateLimits[RATE_CONNECT].rate > 0 || rateLimits[RATE_AUTH].rate > 0)
+            && initRateLimiter((size_t)rateTable, rateLimits) == -1) {
         exit(EXIT_FAILURE);
+    }
 
-    // Получаем дескриптор сокета
-    int _socketfd = getSocket(addresses);
-    if (_socketfd == -1) {
+    // Путь к файлу с паролями - 3й параметр запуска
+    credentialsPath = argv[3];
+    if (readPasswordsFromFile(credentialsPath) == -1) {
         exit(EXIT_FAILURE);
     }
 
-    setSocketFd(_socketfd);
+    // Счётчики потоков в разделяемой памяти для sshtop, без них сервер работает как раньше
+    if (openMetrics(port) == -1) {
+        fprintf(stderr, "Error: metrics segment isn't available\n");
+    }
 
-    // Начинаем слушать сокет
-    if (listen(socketfd, SOMAXCONN) == -1) {
-        perror("listen\n");
+    // Запись в отключившийся сокет возвращает EPIPE вместо завершения процесса
+    signal(SIGPIPE, SIG_IGN);
+
+    // SIGHUP принимает поток перезагрузки базы паролей через signalfd
+    sigset_t reloadSignals;
+    sigemptyset(&reloadSignals);
+    sigaddset(&reloadSignals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &reloadSignals, NULL);
+    pthread_t credentialsWatcher;
+    watcherStopfd = eventfd(0, EFD_CLOEXEC);
+    if (watcherStopfd == -1) {
+        perror("creating watcher eventfd");
+        exit(EXIT_FAILURE);
+    }
+    if (pthread_create(&credentialsWatcher, NULL, watchCredentials, NULL) != 0) {
+        fprintf(stderr, "Error: starting passwords file watcher\n");
         exit(EXIT_FAILURE);
     }
 
-    // Создаём потоки
-    pthread_t workers[numberOfWorkers];
-    pthread_mutex_t mutex;
-    pthread_mutexattr_t mutexattr;
-    pthread_mutexattr_init(&mutexattr);
-    pthread_mutexattr_settype(&mutexattr, PTHREAD_MUTEX_ERRORCHECK);
-    pthread_mutex_init(&mutex, &mutexattr);
-    pthread_mutex_init(&connectionsMutex, &mutexattr);
-    pthread_cond_t condition;
-    pthread_cond_init(&condition, NULL);
+    // Пул проверки паролей, чтобы медленный хеш не задерживал передачу данных сессий
+    if (authThreads > 0 && initAuthPool(&authPool, authThreads, verifyAuthRequest, postAuthResult) == -1) {
+        exit(EXIT_FAILURE);
+    }
 
-    // Создаём отдельный поток для отслеживания таймаута соединений
-    pthread_t timeoutWatcher;
-    pthread_create(&timeoutWatcher, NULL, watchTimeout, NULL);
+    // Инициализация таблицы соединений
+    raiseFileLimit();
+    initConnections();
+
+    // Запущены предыдущим процессом по SIGUSR2: слушающие сокеты берём у него, bind не нужен
+    int predecessor = takeHandoffSocket();
+    if (predecessor != -1) {
+        inheritedCount = receiveListeners(predecessor, &inheritedListeners);
+        if (inheritedCount == -1) {
+            fprintf(stderr, "Error: listening sockets weren't handed over\n");
+            close(predecessor);
+            predecessor = -1;
+            inheritedCount = 0;
+        }
+    }
 
-    // Создаём очередь
-    struct Queue queue;
-    initQueue(&queue, sizeof(struct epoll_event));
+    struct addrinfo* addresses = getAvailableAddresses(port);
+    if (!addresses) 
+        exit(EXIT_FAILURE);
 
-    struct WorkerArgs workerArgs;
-    initWorkerArgs(&workerArgs, &queue, &mutex, &condition);
+    if (sharded) {
+        // SIGINT и SIGUSR2 должен получать только главный поток
+        sigset_t blocked, previous;
+        sigemptyset(&blocked);
+        sigaddset(&blocked, SIGINT);
+        sigaddset(&blocked, SIGUSR2);
+        pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+
+        // Каждый поток - независимый реактор со своим epoll и сокетом,
+        // либо реакторы слушают один общий сокет
+        int sharedSocket = -1;
+        if (sharedListener) {
+            sharedSocket = getListener(addresses, 0);
+            if (sharedSocket == -1) {
+                exit(EXIT_FAILURE);
+            }
+        }
+        struct Reactor reactors[numberOfWorkers];
+        for (int i = 0; i < numberOfWorkers; i++) {
+            int socketfd = sharedListener ? sharedSocket : getListener(addresses, 1);
+            if (socketfd == -1 || initReactor(&reactors[i], socketfd, sharedListener, batchSize) == -1) {
+                exit(EXIT_FAILURE);
+            }
+            pthread_create(&reactors[i].thread, NULL, useUring ? uringLoop : reactorLoop, (void *) &reactors[i]);
+        }
+        freeaddrinfo(addresses);
+        if (predecessor != -1) {
+            startAdoption(reactors, numberOfWorkers, predecessor);
+        }
 
-    for (int i = 0; i < sizeof(workers) / sizeof(pthread_t); i++) {
-        pthread_create(&workers[i], NULL, worker, (void *) &workerArgs);
-    }
+        printf("Main thread: %d, %d reactors\n", (int)pthread_self(), numberOfWorkers);
+        // Во время передачи работы просыпаемся раз в секунду: процесс завершится, когда закроются оставшиеся соединения
+        struct timespec second = {1, 0};
+        while (!done) {
+            if (upgradeRequested) {
+                upgradeRequested = 0;
+                startUpgrade(reactors, numberOfWorkers);
+            }
+            int state = atomic_load(&upgradeState);
+            if (state == UPGRADE_DRAINING && countConnections() == 0) {
+                done = 1;
+                break;
+            }
+            if (state == UPGRADE_IDLE) {
+                sigsuspend(&previous);
+            } else {
+                ppoll(NULL, 0, &second, &previous);
+            }
+        }
 
-    // Создаём epoll
-    int _epollfd = epoll_create1(0);
-    if (_epollfd == -1) {
-        perror("epoll_create error\n");
-        exit(EXIT_FAILURE);
-    }
+        // Реакторы замечают done не позже следующего тика таймера
+        for (int i = 0; i < numberOfWorkers; i++) {
+            pthread_join(reactors[i].thread, NULL);
+        }
+        // Новых проверок после реакторов нет, а результаты оставшихся ещё уходят в их почтовые ящики
+        if (authThreads > 0) {
+            destroyAuthPool(&authPool);
+        }
+        for (int i = 0; i < numberOfWorkers; i++) {
+            destroyReactor(&reactors[i]);
+        }
+        if (sharedSocket != -1) {
+            close(sharedSocket);
+        }
+    } else {
+        // Один epoll в главном потоке раздаёт события рабочим потокам через очередь
+        struct Reactor reactor;
+        int socketfd = getListener(addresses, 0);
+        if (socketfd == -1 || initReactor(&reactor, socketfd, 0, batchSize) == -1) {
+            exit(EXIT_FAILURE);
+        }
+        freeaddrinfo(addresses);
 
-    setEpollFd(_epollfd);
+        // Создаём потоки
+        pthread_t workers[numberOfWorkers];
 
-    // Добавляем сокет в epoll
-    if (addToEpoll(epollfd, socketfd, EPOLLET | EPOLLIN) == -1)
-        exit(EXIT_FAILURE);
+        // Создаём очереди: у каждого рабочего потока своя, события соединения идут в очередь его потока
+        struct Queue queues[numberOfWorkers];
+        for (int i = 0; i < numberOfWorkers; i++) {
+            if (initQueue(&queues[i], sizeof(struct Event)) == -1) {
+                exit(EXIT_FAILURE);
+            }
+        }
+        reactor.queues = queues;
+        reactor.queueCount = numberOfWorkers;
 
-    int maxEventNum = numberOfWorkers;
-    struct epoll_event events[maxEventNum];
+        struct WorkerArgs workerArgs[numberOfWorkers];
+        for (int i = 0; i < numberOfWorkers; i++) {
+            initWorkerArgs(&workerArgs[i], &queues[i], &reactor);
+            pthread_create(&workers[i], NULL, worker, (void *) &workerArgs[i]);
+        }
+        if (predecessor != -1) {
+            startAdoption(&reactor, 1, predecessor);
+        }
 
-    int timeout = -1;
-    printf("Main thread: %d\n", (int)pthread_self());
-    while(!done) {
-        int eventsNumber = epoll_wait(epollfd, events, maxEventNum, timeout);
-        if (!eventsNumber)
-            printf("No events\n");
-        for (int i = 0; i < eventsNumber; i++) {
-            pthread_mutex_lock(&mutex);
-            pushQueue(&queue, &events[i]);
-            pthread_cond_signal(&condition);
-            pthread_mutex_unlock(&mutex);
+        struct epoll_event events[reactor.batchSize];
+        // События пачки, разложенные по очередям рабочих потоков
+        struct Event *batches = (struct Event *)malloc((size_t)numberOfWorkers * reactor.batchSize * sizeof(struct Event));
+        int batchCounts[numberOfWorkers];
+        // События массовой передачи, отложенные при перегрузке
+        struct Event *held = (struct Event *)malloc(SHED_HOLD_MAX * sizeof(struct Event));
+        int heldCount = 0;
+        if (batches == NULL || held == NULL) {
+            fprintf(stderr, "Error: allocating dispatch batches\n");
+            exit(EXIT_FAILURE);
         }
+
+        int timeout = -1;
+        printf("Main thread: %d\n", (int)pthread_self());
+        registerMetricsThread("dispatcher");
+        while(!done) {
+            // Таймер реактора будит цикл раз в секунду, в том числе пока дорабатывают непереданные соединения
+            if (upgradeRequested) {
+                upgradeRequested = 0;
+                startUpgrade(&reactor, 1);
+            }
+            if (atomic_load(&upgradeState) == UPGRADE_DRAINING && countConnections() == 0) {
+                done = 1;
+                break;
+            }
+            int eventsNumber = epoll_wait(reactor.epollfd, events, reactor.batchSize,
+                                          heldCount > 0 ? SHED_HOLD_POLL_MS : timeout);
+            if (!eventsNumber && heldCount == 0)
+                printf("No events\n");
+            // Перегрузку отмечают рабочие потоки по задержке в своих очередях
+            int overloaded = isOverloaded();
+            pauseAccepts(&reactor, overloaded);
+            uint64_t now = getMonotonicNanoseconds();
+            memset(batchCounts, 0, sizeof(batchCounts));
+            for (int i = 0; i < eventsNumber; i++) {
+                // Таймер обрабатывает сам главный поток, рабочим уходят только таймауты соединений
+                if (events[i].data.fd == reactor.timerfd) {
+                    tickReactor(&reactor);
+                    continue;
+                }
+                if (events[i].data.fd == reactor.mailboxfd) {
+                    drainMailbox(&reactor);
+                    continue;
+                }
+                if (events[i].data.fd == reactor.flushTimerfd) {
+                    flushReactor(&reactor);
+                    continue;
+                }
+                struct Event *event;
+                if (overloaded && heldCount < SHED_HOLD_MAX && isBulkEvent(events[i].data.fd, events[i].events)) {
+                    event = &held[heldCount++];
+                    addMetric(METRIC_SHED_DEFERRED, 1);
+                } else {
+                    int owner = getEventWorker(&reactor, events[i].data.fd);
+                    event = &batches[owner * reactor.batchSize + batchCounts[owner]++];
+                }
+                memset(event, 0, sizeof(struct Event));
+                event->fd = events[i].data.fd;
+                event->events = events[i].events;
+                event->type = EVENT_IO;
+                event->enqueuedAt = now;
+            }
+            // Очередь ограничена: если она заполнена, ждём пока рабочий поток её разгрузит
+            for (int owner = 0; owner < numberOfWorkers; owner++) {
+                struct Event *batch = &batches[owner * reactor.batchSize];
+                int pushed = 0;
+                while (pushed < batchCounts[owner]) {
+                    pushed += pushQueueBatch(&queues[owner], batch + pushed, batchCounts[owner] - pushed);
+                    if (pushed < batchCounts[owner])
+                        sched_yield();
+                }
+            }
+            if (heldCount > 0) {
+                heldCount = releaseHeldEvents(&reactor, held, heldCount, overloaded);
+            }
+        }
+
+        // Дожидаемся рабочих потоков: до выхода они пользуются очередями, таблицей ограничений и журналом
+        for (int i = 0; i < numberOfWorkers; i++) {
+            struct Event stop = {-1, 0, EVENT_STOP};
+            while (pushQueue(&queues[i], &stop) == -1) {
+                sched_yield();
+            }
+        }
+        for (int i = 0; i < numberOfWorkers; i++) {
+            pthread_join(workers[i], NULL);
+        }
+        // Новых проверок после рабочих потоков нет, а результаты оставшихся ещё уходят в их очереди
+        if (authThreads > 0) {
+            destroyAuthPool(&authPool);
+        }
+        for (int i = 0; i < numberOfWorkers; i++) {
+            destroyQueue(&queues[i]);
+        }
+        free(batches);
+        free(held);
+        destroyReactor(&reactor);
     }
 
     // Освобождение ресурсов
-    pthread_mutex_destroy(&connectionsMutex);
-    pthread_mutex_destroy(&mutex);
-    pthread_mutexattr_destroy(&mutexattr);
-    free(passPairs);
-    destroyQueue(&queue);
-    close(socketfd);
-    close(epollfd);
+    printAcceptStats();
+    stopAudit();
+    closeMetrics();
+    stopZygote();
+    destroyConnections();
+    destroyRateLimiter();
+    // Перезагрузка могла бы освободить ту же версию базы второй раз: дожидаемся потока перезагрузки
+    uint64_t stop = 1;
+    if (write(watcherStopfd, &stop, sizeof(stop)) == -1) {
+        perror("stopping passwords file watcher");
+    }
+    pthread_join(credentialsWatcher, NULL);
+    close(watcherStopfd);
+    freeCredentials(atomic_load(&credentials));
     printf("DONE!!!");
     return 0;
-}
\ No newline at end of file
+}
@@ -5,6 +5,7 @@
 
 #include "pass_pair.h"
 #include "freadline.h"
+#include "credentials.h"
 
 #define MAX_FILENAME_LEN 20
 
@@ -28,9 +29,14 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
     // Получаем имя файла и режим работы из параметров 
+    // -c <файл> - собрать из файла пар базу нового формата с индексом (её сервер отображает в память)
     char filename[MAX_FILENAME_LEN];
     char mode[3];
+    char *source = NULL;
     for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            source = argv[i+1];
+        }
         if (strcmp(argv[i], "-f") == 0) {
             int length = strlen(argv[i+1]);
             if (length < 1 || length > sizeof(filename)/sizeof(filename[0])) {
@@ -49,6 +55,23 @@ int main(int argc, char *argv[]) {
         }
     }
     printf("Filename: %s\n", filename);
+
+    if (source != NULL) {
+        uint32_t count = 0;
+        struct PassPair *pairs = readPassPairs(source, &count);
+        if (pairs == NULL) {
+            fprintf(stderr, "Error: reading pairs from %s\n", source);
+            exit(EXIT_FAILURE);
+        }
+        if (writeCredentials(filename, pairs, count) == -1) {
+            fprintf(stderr, "Error: writing database\n");
+            free(pairs);
+            exit(EXIT_FAILURE);
+        }
+        printf("Database written: %u pairs\n", count);
+        free(pairs);
+        return 0;
+    }
     printf("Mode: %s\n", mode);
 
     // Начинаем запись в файл
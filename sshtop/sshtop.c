@@ -0,0 +1,194 @@
+// Просмотр метрик работающего сервера: скорости и текущие значения по потокам
+// из сегмента разделяемой памяти, который сервер создаёт для своего порта
+// Сборка: gcc -O2 -Icommon sshtop/sshtop.c common/metrics.c -o sshtop -lrt
+// Запуск: sshtop <порт сервера> [интервал в секундах] [количество обновлений]
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "metrics.h"
+
+#define DEFAULT_INTERVAL 1
+
+// Снимок счётчиков всех потоков
+struct Snapshot {
+    int threadsCount;
+    unsigned long counters[MAX_METRICS_THREADS][METRIC_COUNTERS];
+    long gauges[MAX_METRICS_THREADS][METRIC_GAUGES];
+    double takenAt;
+};
+
+// Глобальная переменная для завершения работы по сигналу
+volatile sig_atomic_t done = 0;
+
+// Перехватчик сигнала
+void handleSigInt(int signum) {
+    done = 1;
+}
+
+double getSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Подключаемся к сегменту сервера, NULL если сервер не запущен
+const struct MetricsSegment *attachMetrics(const char *name) {
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1) {
+        return NULL;
+    }
+    const struct MetricsSegment *segment = mmap(NULL, sizeof(struct MetricsSegment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        perror("mapping metrics segment");
+        return NULL;
+    }
+    if (memcmp(segment->magic, METRICS_MAGIC, sizeof(METRICS_MAGIC)) != 0 || segment->version != METRICS_VERSION) {
+        munmap((void *)segment, sizeof(struct MetricsSegment));
+        return NULL;
+    }
+    return segment;
+}
+
+void takeSnapshot(const struct MetricsSegment *segment, struct Snapshot *snapshot) {
+    int count = atomic_load((atomic_int *)&segment->threadsCount);
+    snapshot->threadsCount = count < MAX_METRICS_THREADS ? count : MAX_METRICS_THREADS;
+    for (int i = 0; i < snapshot->threadsCount; i++) {
+        const struct ThreadMetrics *metrics = &segment->threads[i];
+        for (int j = 0; j < METRIC_COUNTERS; j++) {
+            snapshot->counters[i][j] = atomic_load_explicit((atomic_ulong *)&metrics->counters[j], memory_order_relaxed);
+        }
+        for (int j = 0; j < METRIC_GAUGES; j++) {
+            snapshot->gauges[i][j] = atomic_load_explicit((atomic_long *)&metrics->gauges[j], memory_order_relaxed);
+        }
+    }
+    snapshot->takenAt = getSeconds();
+}
+
+// Строка таблицы: скорости счётчиков и текущие значения
+void printRow(const char *name, int tid, const double *rates, const long *gauges) {
+    char tidText[16] = "";
+    if (tid > 0) {
+        snprintf(tidText, sizeof(tidText), "%d", tid);
+    }
+    printf("%-11s %7s %10.0f %9.0f %8.0f %8.0f %8.0f %8.0f %8.0f %8.0f %8.0f %10.1f %10.1f %6ld %8.1f %8ld %7ld\n",
+           name, tidText, rates[METRIC_EVENTS], rates[METRIC_ACCEPTED], rates[METRIC_AUTH_SUCCESS],
+           rates[METRIC_AUTH_FAILURE], rates[METRIC_RATE_LIMITED], rates[METRIC_SHED_LOGINS],
+           rates[METRIC_SHED_DEFERRED], rates[METRIC_SPAWNS], rates[METRIC_TIMEOUTS],
+           rates[METRIC_BYTES_TO_PTY] / 1024, rates[METRIC_BYTES_TO_CLIENT] / 1024,
+           gauges[GAUGE_QUEUE_DEPTH], gauges[GAUGE_QUEUE_DELAY] / 1000.0, gauges[GAUGE_SESSIONS],
+           gauges[GAUGE_AUTHENTICATING]);
+}
+
+// Выводим скорости между двумя снимками
+void printReport(const struct MetricsSegment *segment, const struct Snapshot *previous, const struct Snapshot *current,
+                 int clear) {
+    double elapsed = current->takenAt - previous->takenAt;
+    long uptime = (long)(time(NULL) - segment->startedAt);
+    if (clear) {
+        printf("\033[H\033[2J");
+    }
+    printf("server pid %d, up %02ld:%02ld:%02ld, %d threads\n", (int)segment->pid,
+           uptime / 3600, uptime / 60 % 60, uptime % 60, current->threadsCount);
+    printf("%-11s %7s %10s %9s %8s %8s %8s %8s %8s %8s %8s %10s %10s %6s %8s %8s %7s\n", "THREAD", "TID", "EVENTS/s",
+           "ACCEPT/s", "AUTH/s", "FAIL/s", "LIMIT/s", "SHED/s", "DEFER/s", "SPAWN/s", "TMOUT/s", "IN KB/s",
+           "OUT KB/s", "QUEUE", "DELAY ms", "SESSIONS", "AUTHING");
+    double totalRates[METRIC_COUNTERS] = {0};
+    long totalGauges[METRIC_GAUGES] = {0};
+    for (int i = 0; i < current->threadsCount; i++) {
+        double rates[METRIC_COUNTERS];
+        for (int j = 0; j < METRIC_COUNTERS; j++) {
+            // Поток мог появиться между снимками
+            unsigned long before = i < previous->threadsCount ? previous->counters[i][j] : 0;
+            rates[j] = elapsed > 0 ? (current->counters[i][j] - before) / elapsed : 0;
+            totalRates[j] += rates[j];
+        }
+        for (int j = 0; j < METRIC_GAUGES; j++) {
+            // Задержки потоков не складываются: в итоге - наибольшая
+            if (j == GAUGE_QUEUE_DELAY) {
+                totalGauges[j] = current->gauges[i][j] > totalGauges[j] ? current->gauges[i][j] : totalGauges[j];
+            } else {
+                totalGauges[j] += current->gauges[i][j];
+            }
+        }
+        char name[METRICS_THREAD_NAME_SIZE];
+        memcpy(name, segment->threads[i].name, sizeof(name));
+        name[sizeof(name) - 1] = '\0';
+        printRow(name, (int)segment->threads[i].tid, rates, current->gauges[i]);
+    }
+    printRow("total", 0, totalRates, totalGauges);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <server port> [interval seconds] [updates]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    char name[METRICS_NAME_SIZE];
+    getMetricsName(name, sizeof(name), argv[1]);
+    double interval = argc > 2 ? atof(argv[2]) : DEFAULT_INTERVAL;
+    int updates = argc > 3 ? atoi(argv[3]) : 0;
+    if (interval <= 0) {
+        fprintf(stderr, "Error: wrong interval\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = handleSigInt;
+    sigaction(SIGINT, &act, 0);
+
+    // Экран очищаем только на терминале, в файл отчёты пишутся подряд
+    int clear = isatty(STDOUT_FILENO);
+    const struct MetricsSegment *segment = NULL;
+    pid_t pid = 0;
+    struct Snapshot *previous = calloc(1, sizeof(struct Snapshot));
+    struct Snapshot *current = calloc(1, sizeof(struct Snapshot));
+    if (previous == NULL || current == NULL) {
+        fprintf(stderr, "Error: allocating snapshots\n");
+        exit(EXIT_FAILURE);
+    }
+    struct timespec delay = {(time_t)interval, (long)((interval - (time_t)interval) * 1e9)};
+    for (int printed = 0; !done && (updates == 0 || printed < updates); ) {
+        // Сервер завершился или перезапущен: подключаемся к новому сегменту
+        if (segment != NULL && kill(pid, 0) == -1 && errno == ESRCH) {
+            munmap((void *)segment, sizeof(struct MetricsSegment));
+            segment = NULL;
+        }
+        if (segment == NULL) {
+            segment = attachMetrics(name);
+            if (segment == NULL) {
+                fprintf(stderr, "Waiting for server metrics %s\n", name);
+                nanosleep(&delay, NULL);
+                continue;
+            }
+            pid = segment->pid;
+            takeSnapshot(segment, previous);
+            nanosleep(&delay, NULL);
+            continue;
+        }
+        takeSnapshot(segment, current);
+        printReport(segment, previous, current, clear);
+        printed++;
+        struct Snapshot *swap = previous;
+        previous = current;
+        current = swap;
+        nanosleep(&delay, NULL);
+    }
+
+    if (segment != NULL) {
+        munmap((void *)segment, sizeof(struct MetricsSegment));
+    }
+    free(previous);
+    free(current);
+    return 0;
+}